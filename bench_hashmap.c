@@ -0,0 +1,835 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "hashmap.h"
+#include "hashmap_typed.h"
+
+#include <sys/resource.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Names of the layouts, indexed by enum hashmap_layout. */
+static const char *layout_names[] = { "chained", "swiss", "dense" };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fill(struct hashmap *h, size_t n, int width)
+{
+    char key[80];
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "%0*zu", width, i);
+        hashmap_insert(h, key);
+    }
+}
+
+/* Workload suite: every run draws the same keys, operation order and hash seed from fixed seeds. */
+
+static uint64_t splitmix(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// @return double Resident set size in MiB: current where /proc is available, otherwise the peak.
+static double rss_mib(void)
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    struct rusage usage;
+    long pages;
+
+    if (fp) {
+        int n = fscanf(fp, "%*s %ld", &pages);
+
+        fclose(fp);
+        if (n == 1) {
+            return (double)pages * (double)sysconf(_SC_PAGESIZE) / 1048576.0;
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (double)usage.ru_maxrss / 1048576.0;
+#else
+    return (double)usage.ru_maxrss / 1024.0;
+#endif
+}
+
+/// Keys 0 to 2n - 1, of which the first n are inserted and the rest only ever missed.
+/// Short keys are 8 hex digits; long keys pad the same digits to 64 bytes like a URL path.
+static char **suite_keys(size_t n, int width)
+{
+    char **keys = malloc(2 * n * sizeof(*keys));
+    size_t i;
+
+    for (i = 0; i < 2 * n; ++i) {
+        unsigned id = (unsigned)(i * 2654435761u);
+
+        keys[i] = malloc((size_t)width + 1);
+        if (width == 8) {
+            snprintf(keys[i], 9, "%08x", id);
+
+        } else {
+            snprintf(keys[i], (size_t)width + 1, "/api/v1/accounts/%08x/preferences/notifications/email/daily", id);
+        }
+    }
+
+    return keys;
+}
+
+/// Indexes of @c n lookups over @c range keys: uniform, or Zipfian with exponent 0.99
+/// (rank r drawn with probability proportional to 1 / r^0.99, ranks scattered over the keys).
+static size_t *suite_queries(size_t n, size_t range, bool zipf, uint64_t seed)
+{
+    size_t *queries = malloc(n * sizeof(*queries));
+    double *cdf = NULL;
+    size_t i;
+
+    if (zipf) {
+        double sum = 0;
+
+        cdf = malloc(range * sizeof(*cdf));
+        for (i = 0; i < range; ++i) {
+            sum += 1.0 / pow((double)(i + 1), 0.99);
+            cdf[i] = sum;
+        }
+        for (i = 0; i < range; ++i) {
+            cdf[i] /= sum;
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        uint64_t r = splitmix(&seed);
+
+        if (zipf) {
+            double u = (double)(r >> 11) / 9007199254740992.0;
+            size_t lo = 0;
+            size_t hi = range - 1;
+
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+
+                if (cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            queries[i] = (lo * 40503u) % range;
+
+        } else {
+            queries[i] = (size_t)(r % range);
+        }
+    }
+
+    free(cdf);
+    return queries;
+}
+
+enum suite_op { SUITE_INSERT, SUITE_FIND, SUITE_ERASE };
+
+/* Every SUITE_SAMPLE-th operation is timed on its own for the percentiles; a timed lookup cannot
+ * overlap its cache misses with its neighbours, so p50 can exceed the mean of independent lookups. */
+#define SUITE_SAMPLE 16
+
+static int by_value(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/// @return double Median cost of reading the clock, which is subtracted from the timed samples.
+static double timer_overhead(void)
+{
+    double samples[1001];
+    size_t i;
+
+    for (i = 0; i < 1001; ++i) {
+        double t = now();
+
+        samples[i] = now() - t;
+    }
+
+    qsort(samples, 1001, sizeof(*samples), by_value);
+    return samples[500];
+}
+
+/// Run @c n operations on @c keys[index[i]] (or on the keys in order if @c index is NULL) and report them.
+static void suite_run(const char *name, struct hashmap *h, enum suite_op op, char **keys, const size_t *index, size_t n)
+{
+    double overhead = timer_overhead();
+    double *samples = malloc((n / SUITE_SAMPLE + 1) * sizeof(*samples));
+    size_t sampled = 0;
+    size_t hits = 0;
+    double total;
+    size_t i;
+
+    total = now();
+    for (i = 0; i < n; ++i) {
+        const char *key = keys[index ? index[i] : i];
+        double t = 0;
+
+        if (i % SUITE_SAMPLE == 0) {
+            t = now();
+        }
+
+        if (op == SUITE_INSERT) {
+            hits += hashmap_insert(h, key).ok;
+
+        } else if (op == SUITE_FIND) {
+            hits += hashmap_find(h, key) != hashmap_end(h);
+
+        } else {
+            hits += hashmap_erase_n(h, key, strlen(key));
+        }
+
+        if (i % SUITE_SAMPLE == 0) {
+            samples[sampled++] = now() - t - overhead;
+        }
+    }
+    total = now() - total;
+
+    qsort(samples, sampled, sizeof(*samples), by_value);
+
+    printf("%-36s %9zu %8.1f %8.0f %8.0f %8.0f %8.0f %8.1f %9.1f\n", name, n, (double)hits * 100.0 / (double)n,
+        total * 1e9 / (double)n, samples[sampled / 2] * 1e9, samples[sampled * 99 / 100] * 1e9,
+        samples[sampled * 999 / 1000] * 1e9, hashmap_load_factor(h), rss_mib());
+
+    free(samples);
+}
+
+/// The workload suite over every layout and both key lengths.
+static void bench_suite(size_t n)
+{
+    int layout;
+    int width;
+
+    printf("%-36s %9s %8s %8s %8s %8s %8s %8s %9s\n", "suite", "ops", "hit %", "ns/op", "p50 ns", "p99 ns", "p99.9 ns", "load", "RSS MiB");
+
+    for (width = 8; width <= 64; width *= 8) {
+        char **keys = suite_keys(n, width);
+        size_t *uniform = suite_queries(n, n, false, 1);
+        size_t *zipf = suite_queries(n, n, true, 2);
+        size_t *miss = suite_queries(n, n, false, 3);
+        size_t i;
+
+        for (i = 0; i < n; ++i) {
+            miss[i] += n;
+        }
+
+        for (layout = HASHMAP_LAYOUT_CHAINED; layout <= HASHMAP_LAYOUT_DENSE; ++layout) {
+            struct hashmap_options options = { .layout = (enum hashmap_layout)layout, .seed = 1 };
+            const char *l = layout_names[layout];
+            struct hashmap *h;
+            char name[64];
+
+            h = hashmap_new_with(8, &options);
+            snprintf(name, sizeof(name), "%s, %d-byte, insert grow", l, width);
+            suite_run(name, h, SUITE_INSERT, keys, NULL, n);
+            hashmap_delete(h);
+
+            h = hashmap_new_with(8, &options);
+            hashmap_reserve(h, n);
+            snprintf(name, sizeof(name), "%s, %d-byte, insert reserved", l, width);
+            suite_run(name, h, SUITE_INSERT, keys, NULL, n);
+
+            snprintf(name, sizeof(name), "%s, %d-byte, find uniform", l, width);
+            suite_run(name, h, SUITE_FIND, keys, uniform, n);
+            snprintf(name, sizeof(name), "%s, %d-byte, find zipf", l, width);
+            suite_run(name, h, SUITE_FIND, keys, zipf, n);
+            snprintf(name, sizeof(name), "%s, %d-byte, find miss", l, width);
+            suite_run(name, h, SUITE_FIND, keys, miss, n);
+            snprintf(name, sizeof(name), "%s, %d-byte, erase", l, width);
+            suite_run(name, h, SUITE_ERASE, keys, NULL, n);
+            hashmap_delete(h);
+        }
+
+        for (i = 0; i < 2 * n; ++i) {
+            free(keys[i]);
+        }
+        free(keys);
+        free(uniform);
+        free(zipf);
+        free(miss);
+    }
+}
+
+/// Time one explicit rehash to twice the bucket count; the cost per element should stay flat as n grows.
+static void bench_rehash(int width)
+{
+    size_t n;
+
+    printf("%-24s %10s %10s %10s %12s\n", "rehash", "elements", "buckets", "ms", "ns/element");
+
+    for (n = 1u << 17; n <= 1u << 21; n <<= 1) {
+        struct hashmap *h = hashmap_new(0);
+        size_t buckets;
+        double t;
+
+        fill(h, n, width);
+        buckets = hashmap_bucket_count(h) * 2;
+
+        t = now();
+        hashmap_rehash(h, buckets);
+        t = now() - t;
+
+        printf("chained, %2d-byte keys    %10zu %10zu %10.2f %12.1f\n", width, n, buckets, t * 1e3, t * 1e9 / (double)n);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Worst single insert while growing from empty, with and without incremental rehashing.
+static void bench_insert_latency(size_t n)
+{
+    int incremental;
+
+    printf("%-24s %10s %10s %12s\n", "insert latency", "elements", "total ms", "max us");
+
+    for (incremental = 0; incremental <= 1; ++incremental) {
+        struct hashmap_options options = { .incremental_rehash = incremental };
+        struct hashmap *h = hashmap_new_with(0, &options);
+        double total = now();
+        double worst = 0;
+        char key[32];
+        size_t i;
+
+        for (i = 0; i < n; ++i) {
+            double t;
+
+            snprintf(key, sizeof(key), "%08zu", i);
+
+            t = now();
+            hashmap_insert(h, key);
+            t = now() - t;
+
+            if (t > worst) {
+                worst = t;
+            }
+        }
+
+        total = now() - total;
+        printf("%-24s %10zu %10.2f %12.1f\n", incremental ? "incremental" : "synchronous", n, total * 1e3, worst * 1e6);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Insert into a sparse table, where most inserts start a new bucket.
+static void bench_sparse_insert(void)
+{
+    size_t reserved;
+
+    printf("%-24s %10s %10s %12s\n", "sparse insert", "elements", "buckets", "ns/insert");
+
+    for (reserved = 1u << 16; reserved <= 1u << 20; reserved <<= 2) {
+        struct hashmap *h = hashmap_new(0);
+        size_t n = 4096;
+        double t;
+
+        hashmap_max_load_factor_set(h, 0.25f);
+        hashmap_reserve(h, reserved);
+
+        t = now();
+        fill(h, n, 8);
+        t = now() - t;
+
+        printf("%-24s %10zu %10zu %12.1f\n", "load factor 0.25", n, hashmap_bucket_count(h), t * 1e9 / (double)n);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Fill and clear a large map, with nodes from malloc or from the slab, and keys duplicated or inline.
+static void bench_clear(size_t n)
+{
+    static const struct {
+        const char *name;
+        struct hashmap_options options;
+    } configs[] = {
+        { "malloc", { .slab = false } },
+        { "slab", { .slab = true } },
+        { "slab, inline keys", { .slab = true, .inline_key_size = 24 } },
+        { "key arena", { .key_arena = true } },
+    };
+    size_t i;
+
+    printf("%-24s %10s %10s %10s\n", "clear", "elements", "fill ms", "clear ms");
+
+    for (i = 0; i < sizeof(configs) / sizeof(*configs); ++i) {
+        struct hashmap *h = hashmap_new_with(8, &configs[i].options);
+        double fill_time;
+        double clear_time;
+
+        hashmap_reserve(h, n);
+
+        fill_time = now();
+        fill(h, n, 8);
+        fill_time = now() - fill_time;
+
+        clear_time = now();
+        hashmap_clear(h);
+        clear_time = now() - clear_time;
+
+        printf("%-24s %10zu %10.2f %10.2f\n", configs[i].name, n, fill_time * 1e3, clear_time * 1e3);
+
+        hashmap_delete(h);
+    }
+}
+
+static void *counted_alloc(void *context, size_t size)
+{
+    *(size_t *)context += size;
+    return malloc(size);
+}
+
+static void counted_free(void *context, void *ptr, size_t size)
+{
+    *(size_t *)context -= size;
+    free(ptr);
+}
+
+/// Bytes per element of a map with 8-byte values and 8-byte keys: element storage, then the bucket array.
+/// Keys are inline in chained nodes; swiss keys live on the heap and are not counted.
+static void bench_memory(size_t n)
+{
+    static const struct {
+        const char *name;
+        struct hashmap_options options;
+    } configs[] = {
+        { "chained", { .inline_key_size = 16 } },
+        { "swiss", { .layout = HASHMAP_LAYOUT_SWISS } },
+    };
+    size_t i;
+
+    printf("%-24s %10s %10s %10s %10s\n", "memory", "elements", "node B", "table B", "B/element");
+
+    for (i = 0; i < sizeof(configs) / sizeof(*configs); ++i) {
+        size_t bytes = 0;
+        struct hashmap_allocator allocator = { counted_alloc, counted_free, &bytes };
+        struct hashmap_options options = configs[i].options;
+        struct hashmap *h;
+        double node;
+        double table;
+
+        options.allocator = &allocator;
+        h = hashmap_new_with(8, &options);
+        fill(h, n, 8);
+
+        if (options.layout == HASHMAP_LAYOUT_SWISS) {
+            node = 0;
+            table = (double)bytes / (double)n;
+
+        } else {
+            node = (double)bytes / (double)n;
+            /* A bucket head is a node pointer and 64 tag bits. */
+            table = (double)(hashmap_bucket_count(h) * (sizeof(void *) + sizeof(uint64_t))) / (double)n;
+        }
+
+        printf("%-24s %10zu %10.1f %10.1f %10.1f\n", configs[i].name, n, node, table, node + table);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Successful lookups with modulo or mask reduction, over the same number of buckets, and once frozen.
+static void bench_find(size_t n)
+{
+    static const char *names[] = { "modulo", "mask", "frozen" };
+    char (*keys)[16] = malloc(n * sizeof(*keys));
+    size_t i;
+    int variant;
+
+    for (i = 0; i < n; ++i) {
+        snprintf(keys[i], sizeof(*keys), "%08zu", (i * 7919) % n);
+    }
+
+    printf("%-24s %10s %10s %12s\n", "find", "elements", "buckets", "ns/find");
+
+    for (variant = 0; variant <= 2; ++variant) {
+        struct hashmap_options options = { .sizing = variant ? HASHMAP_SIZING_POW2 : HASHMAP_SIZING_PRIME };
+        struct hashmap *h = hashmap_new_with(8, &options);
+        size_t found = 0;
+        double t;
+
+        hashmap_rehash(h, 2 * n);
+        fill(h, n, 8);
+
+        if (variant == 2) {
+            hashmap_freeze(h);
+        }
+
+        t = now();
+        for (i = 0; i < n; ++i) {
+            found += hashmap_find(h, keys[i]) != hashmap_end(h);
+        }
+        t = now() - t;
+
+        printf("%-24s %10zu %10zu %12.1f\n", names[variant], found, hashmap_bucket_count(h), t * 1e9 / (double)n);
+
+        hashmap_delete(h);
+    }
+
+    free(keys);
+}
+
+/// Random lookups one at a time and in batches of 64, in a table much larger than the cache.
+static void bench_find_batch(size_t n)
+{
+    const char **keys = malloc(n * sizeof(*keys));
+    struct hashmap_iter *iters[64];
+    char (*storage)[16] = malloc(n * sizeof(*storage));
+    int layout;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        snprintf(storage[i], sizeof(*storage), "%08zu", (i * 2654435761u) % n);
+        keys[i] = storage[i];
+    }
+
+    printf("%-24s %10s %12s %12s\n", "find batch", "elements", "single ns", "batch ns");
+
+    for (layout = HASHMAP_LAYOUT_CHAINED; layout <= HASHMAP_LAYOUT_DENSE; ++layout) {
+        struct hashmap_options options = { .layout = (enum hashmap_layout)layout, .seed = 1 };
+        struct hashmap *h = hashmap_new_with(8, &options);
+        double single;
+        double batch;
+
+        fill(h, n, 8);
+
+        single = now();
+        for (i = 0; i < n; ++i) {
+            hashmap_find(h, keys[i]);
+        }
+        single = now() - single;
+
+        batch = now();
+        for (i = 0; i + 64 <= n; i += 64) {
+            hashmap_find_batch(h, keys + i, 64, iters);
+        }
+        batch = now() - batch;
+
+        printf("%-24s %10zu %12.1f %12.1f\n", layout_names[layout], n, single * 1e9 / (double)n, batch * 1e9 / (double)n);
+
+        hashmap_delete(h);
+    }
+
+    free(storage);
+    free(keys);
+}
+
+/// A read-through cache of an eighth of the keys under Zipfian lookups: find, and insert on a miss.
+static void bench_cache(size_t n)
+{
+    char **keys = suite_keys(n, 8);
+    size_t *zipf = suite_queries(n, n, true, 2);
+    struct hashmap_options options = { .capacity = n / 8, .stats = true, .seed = 1 };
+    struct hashmap *h = hashmap_new_with(8, &options);
+    struct hashmap_stats stats;
+    double t;
+    size_t i;
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+        if (hashmap_find(h, keys[zipf[i]]) == hashmap_end(h)) {
+            hashmap_insert(h, keys[zipf[i]]);
+        }
+    }
+    t = now() - t;
+
+    hashmap_stats(h, &stats);
+    printf("%-24s %10s %10s %10s %12s\n", "cache", "capacity", "hit %", "evictions", "ns/op");
+    printf("%-24s %10zu %10.1f %10zu %12.1f\n", "clock", options.capacity, 100.0 * (double)(n - stats.evictions - hashmap_size(h)) / (double)n,
+        stats.evictions, t * 1e9 / (double)n);
+
+    hashmap_delete(h);
+    for (i = 0; i < 2 * n; ++i) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(zipf);
+}
+
+/// Lookups of absent keys, with and without the filter, in a table much larger than the cache.
+static void bench_find_absent(size_t n)
+{
+    char (*keys)[16] = malloc(n * sizeof(*keys));
+    int filter;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        snprintf(keys[i], sizeof(*keys), "x%07zu", (i * 2654435761u) % n);
+    }
+
+    printf("%-24s %10s %10s %12s\n", "find absent", "elements", "found", "ns/find");
+
+    for (filter = 0; filter <= 1; ++filter) {
+        struct hashmap_options options = { .filter = filter, .seed = 1 };
+        struct hashmap *h = hashmap_new_with(8, &options);
+        size_t found = 0;
+        double t;
+
+        fill(h, n, 8);
+
+        t = now();
+        for (i = 0; i < n; ++i) {
+            found += hashmap_find(h, keys[i]) != hashmap_end(h);
+        }
+        t = now() - t;
+
+        printf("%-24s %10zu %10zu %12.1f\n", filter ? "filter" : "chained", n, found, t * 1e9 / (double)n);
+
+        hashmap_delete(h);
+    }
+
+    free(keys);
+}
+
+/// Sum an 8-byte value over every element, as a metrics export does, after churn has scattered the elements.
+static void bench_scan(size_t n)
+{
+    int layout;
+    size_t i;
+
+    printf("%-24s %10s %12s\n", "scan", "elements", "ns/element");
+
+    for (layout = HASHMAP_LAYOUT_CHAINED; layout <= HASHMAP_LAYOUT_DENSE; ++layout) {
+        struct hashmap_options options = { .layout = (enum hashmap_layout)layout, .seed = 1 };
+        struct hashmap *h = hashmap_new_with(8, &options);
+        struct hashmap_iter *iter;
+        uint64_t sum = 0;
+        char key[16];
+        double t;
+        int pass;
+
+        fill(h, n, 8);
+        for (i = 0; i < n; i += 2) {
+            snprintf(key, sizeof(key), "%08zu", i);
+            hashmap_erase_n(h, key, strlen(key));
+            snprintf(key, sizeof(key), "%08zu", n + i);
+            hashmap_insert(h, key);
+        }
+
+        for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+            *(uint64_t *)hashmap_iter_deref(iter).userdata = 1;
+        }
+
+        t = now();
+        for (pass = 0; pass < 10; ++pass) {
+            for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+                sum += *(uint64_t *)hashmap_iter_deref(iter).userdata;
+            }
+        }
+        t = now() - t;
+
+        printf("%-24s %10zu %12.2f\n", layout_names[layout], (size_t)(sum / 10), t * 1e9 / (double)sum);
+
+        hashmap_delete(h);
+    }
+}
+
+HASHMAP_TYPED(bench_u64, uint64_t, uint64_t, HASHMAP_TYPED_HASH_INT, HASHMAP_TYPED_EQUAL_INT)
+
+/// Integer keys: formatted as strings for the type-erased map, or stored inline by a generated typed map and by hashmap_u64.
+static void bench_typed(size_t n)
+{
+    struct hashmap_options options = { .seed = 1 };
+    struct hashmap *h = hashmap_new_with(8, &options);
+    struct hashmap_bench_u64 *t = hashmap_bench_u64_new();
+    struct hashmap_u64 *u = hashmap_u64_new(8);
+    size_t found = 0;
+    char key[24];
+    double insert;
+    double find;
+    size_t i;
+
+    printf("%-24s %10s %12s %12s\n", "integer keys", "elements", "insert ns", "find ns");
+
+    insert = now();
+    for (i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "%zu", i * 2654435761u);
+        *(uint64_t *)hashmap_insert(h, key).pair.userdata = i;
+    }
+    insert = now() - insert;
+
+    find = now();
+    for (i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "%zu", i * 2654435761u);
+        found += hashmap_find(h, key) != hashmap_end(h);
+    }
+    find = now() - find;
+
+    printf("%-24s %10zu %12.1f %12.1f\n", "string", found, insert * 1e9 / (double)n, find * 1e9 / (double)n);
+
+    found = 0;
+    insert = now();
+    for (i = 0; i < n; ++i) {
+        *hashmap_bench_u64_insert(t, i * 2654435761u).value = i;
+    }
+    insert = now() - insert;
+
+    find = now();
+    for (i = 0; i < n; ++i) {
+        found += hashmap_bench_u64_find(t, i * 2654435761u) != hashmap_bench_u64_end(t);
+    }
+    find = now() - find;
+
+    printf("%-24s %10zu %12.1f %12.1f\n", "typed", found, insert * 1e9 / (double)n, find * 1e9 / (double)n);
+
+    found = 0;
+    insert = now();
+    for (i = 0; i < n; ++i) {
+        *(uint64_t *)hashmap_u64_insert(u, i * 2654435761u).pair.userdata = i;
+    }
+    insert = now() - insert;
+
+    find = now();
+    for (i = 0; i < n; ++i) {
+        found += hashmap_u64_find(u, i * 2654435761u) != NULL;
+    }
+    find = now() - find;
+
+    printf("%-24s %10zu %12.1f %12.1f\n", "hashmap_u64", found, insert * 1e9 / (double)n, find * 1e9 / (double)n);
+
+    hashmap_delete(h);
+    hashmap_bench_u64_delete(t);
+    hashmap_u64_delete(u);
+}
+
+struct bench_worker {
+    struct hashmap_concurrent *c;
+    size_t seed;
+    size_t ops;
+};
+
+static void *bench_work(void *arg)
+{
+    struct bench_worker *w = (struct bench_worker *)arg;
+    size_t x = w->seed;
+    char key[32];
+    size_t i;
+    int value = 0;
+
+    for (i = 0; i < w->ops; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        snprintf(key, sizeof(key), "%08zu", (size_t)(x >> 33) % (1u << 16));
+
+        if (i % 8 == 0) {
+            hashmap_concurrent_upsert(w->c, key, &value);
+        } else {
+            hashmap_concurrent_find(w->c, key, &value);
+        }
+    }
+
+    return NULL;
+}
+
+/// Mixed finds and upserts from several threads, with one lock or many.
+static void bench_concurrent(int nthreads, size_t ops)
+{
+    size_t shards;
+
+    printf("%-24s %10s %10s %12s\n", "concurrent", "threads", "shards", "Mops/s");
+
+    for (shards = 1; shards <= 64; shards *= 64) {
+        struct hashmap_concurrent *c = hashmap_concurrent_new(sizeof(int), shards, NULL);
+        struct bench_worker workers[64];
+        pthread_t threads[64];
+        double t;
+        int i;
+
+        t = now();
+        for (i = 0; i < nthreads; ++i) {
+            workers[i].c = c;
+            workers[i].seed = (size_t)i;
+            workers[i].ops = ops;
+            pthread_create(&threads[i], NULL, bench_work, &workers[i]);
+        }
+        for (i = 0; i < nthreads; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        t = now() - t;
+
+        printf("%-24s %10d %10zu %12.2f\n", shards == 1 ? "one lock" : "sharded", nthreads, shards, (double)nthreads * (double)ops / t / 1e6);
+
+        hashmap_concurrent_delete(c);
+    }
+}
+
+/// Populate an empty map from a key array, by inserting in a loop or with hashmap_build.
+static void bench_build(size_t n)
+{
+    const char **keys = malloc(n * sizeof(*keys));
+    char (*storage)[16] = malloc(n * sizeof(*storage));
+    size_t nthreads;
+    size_t i;
+    struct hashmap *h;
+    double t;
+
+    for (i = 0; i < n; ++i) {
+        snprintf(storage[i], sizeof(*storage), "%08zu", (i * 2654435761u) % n);
+        keys[i] = storage[i];
+    }
+
+    printf("%-24s %10s %10s %10s\n", "build", "elements", "threads", "ms");
+
+    h = hashmap_new(0);
+    t = now();
+    for (i = 0; i < n; ++i) {
+        hashmap_insert(h, keys[i]);
+    }
+    t = now() - t;
+    printf("%-24s %10zu %10d %10.2f\n", "insert loop", n, 1, t * 1e3);
+    hashmap_delete(h);
+
+    for (nthreads = 1; nthreads <= 4; nthreads *= 4) {
+        h = hashmap_new(0);
+        t = now();
+        hashmap_build(h, keys, n, nthreads);
+        t = now() - t;
+        printf("%-24s %10zu %10zu %10.2f\n", "hashmap_build", n, nthreads, t * 1e3);
+        hashmap_delete(h);
+    }
+
+    free(storage);
+    free(keys);
+}
+
+int main(void)
+{
+    bench_suite(1u << 20);
+    bench_rehash(8);
+    bench_rehash(64);
+    bench_insert_latency(1u << 21);
+    bench_sparse_insert();
+    bench_clear(1u << 21);
+    bench_memory(1u << 20);
+    bench_find(1u << 12);
+    bench_find(1u << 20);
+    bench_find_batch(1u << 21);
+    bench_find_absent(1u << 21);
+    bench_cache(1u << 21);
+    bench_scan(1u << 20);
+    bench_typed(1u << 20);
+    bench_concurrent(8, 1u << 19);
+    bench_build(1u << 21);
+}
@@ -1,30 +1,66 @@
 #include "hashmap.h"
+#include "hashmap_dense.h"
+#include "hashmap_flat.h"
+#include "hashmap_seed.h"
+#include "hashmap_stats.h"
+#include "hashmap_swiss.h"
 
-#include <liblist/llist.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+/* Nodes form one singly linked list, in which every bucket is a contiguous run.
+ * The bucket is not stored: it is the reduced hash, and a run ends at the first node that reduces differently.
+ * The key slot just before a node holds a key shorter than the inline key size, ending at the node, or else
+ * a pointer to the key; the top bit of the length tells which, so the key is found without the map. */
 struct hashmap_node {
-    struct list_node node;
+    struct hashmap_node *next;
     size_t hash;
-    size_t bucket;
-    char *key;
+    size_t length;
     void *userdata;
 };
 
-static struct hashmap_node *make(size_t element_size)
+#define KEY_INLINE ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+/// @return size_t Length of the key of @c node.
+static size_t impl_length(const struct hashmap_node *node)
+{
+    return node->length & ~KEY_INLINE;
+}
+
+/// Point the key slot of @c node at @c key.
+static void impl_key_point(struct hashmap_node *node, const char *key)
 {
-    return malloc(offsetof(struct hashmap_node, userdata) + element_size);
+    memcpy((char *)node - sizeof(key), &key, sizeof(key));
 }
 
-static void node_destructor(void *n)
+/// @return char* Key of @c node, in its key slot or where the slot points.
+static char *impl_key(const struct hashmap_node *node)
 {
-    struct hashmap_node *node = (struct hashmap_node *)n;
-    free(node->key);
+    char *key;
+
+    if (node->length & KEY_INLINE) {
+        return (char *)node - impl_length(node) - 1;
+    }
+
+    memcpy(&key, (const char *)node - sizeof(key), sizeof(key));
+    return key;
 }
 
-/* Iterator has the same layout as the list node.
+/* A bucket points at the node just before its run, which is @c before_begin for the run at the front,
+ * or is NULL if the bucket is empty (in the style of libstdc++). Next to it, a bit per element of the run
+ * chosen by its hash, so that most lookups of absent keys stop at the bucket without loading any node. */
+struct bucket_head {
+    struct hashmap_node *prev;
+    uint64_t tags;
+};
+
+/* Iterator is a pointer to the node, and the end is NULL.
  * Clients only ever see a pointer-to-iterator, thus the implementation is opaque. */
 struct hashmap_iter {
     int unused;
@@ -32,348 +68,2436 @@ struct hashmap_iter {
 
 struct hashmap {
     float max_load_factor;
+    /* Zero disables downsizing. */
+    float min_load_factor;
     size_t buckets;
+    bool pow2;
+    /* Userdata size as given to the constructor. */
+    size_t userdata_size;
     size_t element_size;
-    struct list *list;
-    struct list_iter **map;
+    /* Key slot plus element size; a node starts after its key slot. */
+    size_t node_size;
+    size_t inline_key_size;
+    /* Inline key size, with room for a key pointer. */
+    size_t key_slot_size;
+    size_t size;
+    struct hashmap_node before_begin;
+    struct bucket_head *map;
+    struct swiss *swiss;
+    struct dense *dense;
+    struct flat *flat;
+    bool incremental;
+    /* While an incremental rehash is in progress, old buckets from @c rehash_index on are still
+     * in use, and their runs sit in the same list as those of the new table. */
+    struct bucket_head *old_map;
+    size_t old_buckets;
+    size_t rehash_index;
+    struct hashmap_allocator allocator;
+    struct hashmap_hasher hasher;
+    /* Seed of the built-in hash; a map that drew it at random draws another if an insert meets a flooded chain. */
+    uint64_t seed;
+    bool reseed;
+    /* Size at the last reseed: the next waits until the map has doubled, so that keys which collide
+     * under every seed cannot make each insert hash the whole map again. */
+    size_t reseed_size;
+    /* Slab: nodes are carved from chunks, and erased nodes are kept on a free list. */
+    bool slab;
+    void *free_nodes;
+    struct slab_chunk *chunks;
+    unsigned char *cursor;
+    unsigned char *limit;
+    size_t chunk_nodes;
+    /* Key arena: the current block is first; keys are bump-allocated and never freed individually. */
+    bool key_arena;
+    struct key_block *key_blocks;
+    /* Counters, if the stats option was given. */
+    struct hashmap_stats *stats;
+    /* Blocked Bloom filter of the hashes of a chained map, if the filter option was given. Erasing leaves
+     * the bits of the element set; once such stale elements outnumber the live ones, the filter is rebuilt. */
+    uint64_t *filter;
+    size_t filter_blocks;
+    size_t filter_stale;
+    /* Bound of a chained cache, or zero. Each node then ends with a referenced flag, set by every hit;
+     * the CLOCK hand is the next node it inspects, NULL meaning the front of the list.
+     * An insert batch pins the elements it returns, which the hand then passes over. */
+    size_t capacity;
+    struct hashmap_evictor evictor;
+    struct hashmap_node *hand;
+    size_t pinned;
 };
 
-/* Arbitrary subset of prime numbers.
- * Trade-off memory overhead vs rehash cost. */
-static size_t primes[] =
-{
-    5, 11, 23, 47, 53, 97,
-    193, 389, 769,
-    1543, 3079, 6151,
-    12289, 24593, 49157, 98317,
-    196613, 393241, 786433,
-    1572869, 3145739, 6291469,
-    12582917, 25165843, 50331653,
-    100663319, 201326611, 402653189, 805306457,
-    1610612741
+/* Chunk header; nodes follow. */
+struct slab_chunk {
+    struct slab_chunk *next;
+    size_t size;
 };
 
-static size_t impl_bucket_count_ideal(size_t n)
-{
-    size_t i;
-    size_t ret = 5;
+/* Chunks start at this many nodes and double up to the maximum. */
+#define SLAB_MIN_CHUNK_NODES 64
+#define SLAB_MAX_CHUNK_NODES (1u << 20)
 
-    for (i = 0; i < sizeof(primes)/sizeof(*primes) && ret < n; ++i) {
-        ret = primes[i];
-    }
+/* Key block header; keys follow. */
+struct key_block {
+    struct key_block *next;
+    size_t size;
+    size_t used;
+};
 
-    return ret;
-}
+/* Keys larger than a quarter block get a block of their own, linked behind the current one. */
+#define KEY_BLOCK_SIZE 65536
 
-/// @return size_t Bucket count that supports @c elements at maximum load factor.
-static size_t impl_bucket_count_calculate(struct hashmap *h, size_t elements)
+static void *default_alloc(void *context, size_t size)
 {
-    return impl_bucket_count_ideal((size_t)((float)(elements / hashmap_max_load_factor(h))));
+    (void)context;
+    return malloc(size);
 }
 
-static void impl_alloc_buckets(struct hashmap *h, size_t n)
+static void default_free(void *context, void *ptr, size_t size)
 {
-    size_t size = n * sizeof(struct list_iter *);
+    (void)context;
+    (void)size;
+    free(ptr);
+}
 
-    h->buckets = n;
-    h->map = (struct list_iter **)realloc(h->map, size);
-    memset(h->map, 0, size);
+/* Hash in the style of wyhash (Wang Yi, public domain): the key is read 8 to 48 bytes at a time
+ * and folded with 64x64->128 bit multiplies. */
+static const uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/// Replace @c a and @c b with the low and high halves of their 128-bit product.
+static void mul128(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+#endif
 }
 
-struct hashmap *hashmap_new(size_t element_size)
+/// Replace @c a and @c b with the low and high halves of their 128-bit product, each folded with its own factor,
+/// so that a key which makes one factor zero cannot also erase the other, and with it the seed.
+static void mix128(uint64_t *a, uint64_t *b)
 {
-    struct hashmap *h = (struct hashmap *)malloc(sizeof(struct hashmap));
+    uint64_t lo = *a;
+    uint64_t hi = *b;
 
-    element_size += offsetof(struct hashmap_node, userdata);
+    mul128(&lo, &hi);
+    *a ^= lo;
+    *b ^= hi;
+}
 
-    h->max_load_factor = 1.0;
-    h->buckets = 0;
-    h->element_size = element_size;
-    h->list = list_new(offsetof(struct hashmap_node, node));
-    h->map = NULL;
-    impl_alloc_buckets(h, impl_bucket_count_calculate(h, hashmap_size(h)));
-    return h;
+/// @return uint64_t The folded 128-bit product @c a * @c b, with both halves folded together.
+static uint64_t mum(uint64_t a, uint64_t b)
+{
+    mix128(&a, &b);
+    return a ^ b;
 }
 
-void hashmap_delete(struct hashmap *h)
+static uint64_t read8(const unsigned char *p)
 {
-    if (!h) {
-        return;
-    }
+    uint64_t v;
 
-    hashmap_clear(h);
-    list_delete(h->list);
-    free(h->map);
-    free(h);
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-bool hashmap_empty(const struct hashmap *h)
+static uint64_t read4(const unsigned char *p)
 {
-    if (!h) {
-        return true;
-    }
+    uint32_t v;
 
-    return list_size(h->list) == 0;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-size_t hashmap_size(const struct hashmap *h)
+/// @param context Seed of the map.
+static size_t default_hash(void *context, const void *key, size_t len)
 {
-    if (!h) {
-        return 0;
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t seed = mum(secret[0] ^ *(const uint64_t *)context, secret[1]);
+    uint64_t a;
+    uint64_t b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+
+        } else {
+            a = b = 0;
+        }
+
+    } else {
+        size_t i = len;
+
+        if (i >= 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+
+            do {
+                seed = mum(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                see1 = mum(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                see2 = mum(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = mum(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
     }
 
-    return list_size(h->list);
+    a ^= secret[1];
+    b ^= seed;
+    mix128(&a, &b);
+    return (size_t)mum(a ^ secret[0] ^ len, b ^ secret[1]);
 }
 
-struct hashmap_iter *hashmap_begin(struct hashmap *h)
+/* Process seed, read once from the random device; each map mixes in a count of the seeds drawn so far. */
+static uint64_t seed_base;
+static pthread_once_t seed_once = PTHREAD_ONCE_INIT;
+static atomic_uint_fast64_t seed_count;
+
+static void impl_seed_init(void)
 {
-    return (struct hashmap_iter *)list_begin(h->list);
+    FILE *fp = fopen("/dev/urandom", "rb");
+    uint64_t r;
+
+    /* Without a random device, fall back on the clock and the address space layout. */
+    seed_base = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&seed_base;
+
+    if (fp) {
+        if (fread(&r, sizeof(r), 1, fp) == 1) {
+            seed_base ^= r;
+        }
+
+        fclose(fp);
+    }
 }
 
-struct hashmap_iter *hashmap_end(struct hashmap *h)
+uint64_t seed_random(void)
 {
-    return (struct hashmap_iter *)list_end(h->list);
+    uint64_t z;
+
+    pthread_once(&seed_once, impl_seed_init);
+
+    /* SplitMix64 (Sebastiano Vigna, public domain) over the count. */
+    z = seed_base + (atomic_fetch_add(&seed_count, 1) + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31)) | 1;
 }
 
-struct hashmap_iter *hashmap_iter_inc(struct hashmap_iter *iter)
+static struct hashmap_node *make(struct hashmap *h)
 {
-    return (struct hashmap_iter *)list_next((struct list_iter *)iter);
+    unsigned char *p;
+
+    if (!h->slab) {
+        p = h->allocator.alloc(h->allocator.context, h->node_size);
+        return (struct hashmap_node *)(p + h->key_slot_size);
+
+    } else if (h->free_nodes) {
+        p = h->free_nodes;
+        h->free_nodes = *(void **)p;
+        return (struct hashmap_node *)p;
+
+    } else if (h->cursor == h->limit) {
+        size_t size = sizeof(struct slab_chunk) + h->chunk_nodes * h->node_size;
+        struct slab_chunk *chunk = h->allocator.alloc(h->allocator.context, size);
+
+        chunk->next = h->chunks;
+        chunk->size = size;
+        h->chunks = chunk;
+        h->cursor = (unsigned char *)(chunk + 1);
+        h->limit = h->cursor + h->chunk_nodes * h->node_size;
+
+        if (h->chunk_nodes < SLAB_MAX_CHUNK_NODES) {
+            h->chunk_nodes *= 2;
+        }
+    }
+
+    p = h->cursor;
+    h->cursor += h->node_size;
+    return (struct hashmap_node *)(p + h->key_slot_size);
 }
 
-struct hashmap_pair hashmap_iter_deref(struct hashmap_iter *iter)
+static void unmake(struct hashmap *h, struct hashmap_node *node)
 {
-    struct hashmap_node *node = list_at((struct list_iter *)iter);
-    struct hashmap_pair pair;
-
-    if (node) {
-        pair.key = node->key;
-        pair.userdata = &node->userdata;
+    if (h->slab) {
+        *(void **)node = h->free_nodes;
+        h->free_nodes = node;
 
     } else {
-        pair.key = NULL;
-        pair.userdata = NULL;
+        h->allocator.free(h->allocator.context, (unsigned char *)node - h->key_slot_size, h->node_size);
     }
-
-    return pair;
 }
 
-static size_t hashof(const char *key)
+/// Release every slab chunk at once; the nodes must already be unlinked.
+static void impl_slab_release(struct hashmap *h)
 {
-    size_t hash = 5381;
+    while (h->chunks) {
+        struct slab_chunk *chunk = h->chunks;
 
-    while (*key) {
-        hash = ((hash << 5) + hash) + (unsigned)(*key++); /* hash * 33 * + * c * */
+        h->chunks = chunk->next;
+        h->allocator.free(h->allocator.context, chunk, chunk->size);
     }
 
-    return hash;
+    h->free_nodes = NULL;
+    h->cursor = NULL;
+    h->limit = NULL;
+    h->chunk_nodes = SLAB_MIN_CHUNK_NODES;
 }
 
-struct hashmap_iter *hashmap_find(struct hashmap *h, const char *key)
+/// @return char* Arena storage for @c len bytes.
+static char *impl_arena_alloc(struct hashmap *h, size_t len)
 {
-    size_t hash = hashof(key);
-    size_t bucket = hash % h->buckets;
-    struct list_iter *iter;
+    struct key_block *block = h->key_blocks;
+    char *p;
 
-    for (iter = h->map[bucket]; iter; iter = list_next(iter)) {
-        struct hashmap_node *node = list_at((struct list_iter *)iter);
+    if (!block || block->size - block->used < len) {
+        size_t size = sizeof(struct key_block) + (len > KEY_BLOCK_SIZE / 4 ? len : KEY_BLOCK_SIZE);
 
-        if (!node || node->bucket != bucket) {
-            break;
+        block = h->allocator.alloc(h->allocator.context, size);
+        block->size = size;
+        block->used = sizeof(struct key_block);
+
+        if (h->key_blocks && len > KEY_BLOCK_SIZE / 4) {
+            block->next = h->key_blocks->next;
+            h->key_blocks->next = block;
 
-        } else if (hash == node->hash && !strcmp(key, node->key)) {
-            return (struct hashmap_iter *)iter;
+        } else {
+            block->next = h->key_blocks;
+            h->key_blocks = block;
         }
     }
 
-    return hashmap_end(h);
+    p = (char *)block + block->used;
+    block->used += len;
+    return p;
 }
 
-/// Find insertion point for new node in given bucket.
-/// @discussion The new node should be inserted *before* the returned iterator.
-static struct list_iter *impl_insertion_point(struct hashmap *h, size_t bucket)
+/// Release every key block at once.
+static void impl_arena_release(struct hashmap *h)
 {
-    bucket++;
+    while (h->key_blocks) {
+        struct key_block *block = h->key_blocks;
 
-    for (; bucket < h->buckets; ++bucket) {
-        if (h->map[bucket]) {
-            return h->map[bucket];
-        }
+        h->key_blocks = block->next;
+        h->allocator.free(h->allocator.context, block, block->size);
     }
-
-    return list_end(h->list);
 }
 
-struct hashmap_insert_ret hashmap_insert(struct hashmap *h, const char *key)
+/* Each hash sets one bit in each word of one 64-byte block, so a test reads a single cache line.
+ * The filter has FILTER_BITS bits per element it is sized for, and is rebuilt at twice that many elements. */
+#define FILTER_WORDS 8
+#define FILTER_BITS 16
+#define FILTER_CAPACITY (FILTER_WORDS * 64 / FILTER_BITS)
+
+/* Odd multipliers that pick the bit in each word (from the split block Bloom filter of Impala). */
+static const uint32_t filter_salt[FILTER_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+/// @return uint64_t Hash of the map remixed, so that weak hashers still spread over blocks and bits.
+static uint64_t impl_filter_mix(size_t hash)
 {
-    struct list_iter *iter;
-    struct hashmap_insert_ret ret;
+    uint64_t x = (uint64_t)hash * 0x9E3779B97F4A7C15ull;
 
-    hashmap_rehash(h, impl_bucket_count_calculate(h, hashmap_size(h)));
+    return x ^ (x >> 32);
+}
 
-    iter = (struct list_iter *)hashmap_find(h, key);
-    if (iter != list_end(h->list)) {
-        ret.ok = false;
-        ret.pair = hashmap_iter_deref((struct hashmap_iter *)iter);
+static uint64_t *impl_filter_block(const struct hashmap *h, uint64_t x)
+{
+    return h->filter + ((size_t)(x >> 32) & (h->filter_blocks - 1)) * FILTER_WORDS;
+}
 
-    } else {
-        size_t hash = hashof(key);
-        size_t bucket = hash % h->buckets;
-        struct hashmap_node *node;
+static void impl_filter_add(struct hashmap *h, size_t hash)
+{
+    uint64_t x = impl_filter_mix(hash);
+    uint64_t *block = impl_filter_block(h, x);
+    size_t i;
 
-        iter = impl_insertion_point(h, bucket);
+    for (i = 0; i < FILTER_WORDS; ++i) {
+        block[i] |= (uint64_t)1 << (((uint32_t)x * filter_salt[i]) >> 26);
+    }
+}
 
-        node = list_insert(iter, make(h->element_size));
-        node->hash = hash;
-        node->bucket = bucket;
-        node->key = strdup(key);
+/// @return bool False if no element has @c hash; true if one may have it.
+static bool impl_filter_test(const struct hashmap *h, size_t hash)
+{
+    uint64_t x = impl_filter_mix(hash);
+    const uint64_t *block = impl_filter_block(h, x);
+    size_t i;
 
-        if (h->map[bucket] == NULL) {
-            h->map[bucket] = list_prev(iter);
+    for (i = 0; i < FILTER_WORDS; ++i) {
+        if (!((block[i] >> (((uint32_t)x * filter_salt[i]) >> 26)) & 1)) {
+            return false;
         }
-
-        ret.ok = true;
-        ret.pair.key = node->key;
-        ret.pair.userdata = &node->userdata;
     }
 
-    return ret;
+    return true;
 }
 
-void hashmap_erase(struct hashmap *h, struct hashmap_iter *iter)
+/// Size the filter for twice @c elements, which is at least the size of the map, and set the bits of every element.
+static void impl_filter_rebuild(struct hashmap *h, size_t elements)
 {
-    if (!h) {
-        return;
+    struct hashmap_node *node;
+    size_t blocks = 1;
 
-    } else if (iter == hashmap_end(h)) {
-        return;
+    while (blocks * FILTER_CAPACITY < 2 * elements) {
+        blocks *= 2;
+    }
 
-    } else {
-        struct hashmap_node *node = list_at((struct list_iter *)iter);
-        size_t bucket = hashmap_bucket(h, node->key);
+    if (blocks != h->filter_blocks) {
+        free(h->filter);
+        h->filter = (uint64_t *)aligned_alloc(FILTER_WORDS * sizeof(uint64_t), blocks * FILTER_WORDS * sizeof(uint64_t));
+        h->filter_blocks = blocks;
+    }
 
-        if (h->map[bucket] == (struct list_iter *)iter) {
-            struct list_iter *next = list_next((struct list_iter *)iter);
+    memset(h->filter, 0, blocks * FILTER_WORDS * sizeof(uint64_t));
+    h->filter_stale = 0;
 
-            if (next != list_end(h->list) && ((struct hashmap_node *)list_at((struct list_iter *)next))->bucket == bucket) {
-                h->map[bucket] = next;
+    for (node = h->before_begin.next; node; node = node->next) {
+        impl_filter_add(h, node->hash);
+    }
+}
 
-            } else {
-                h->map[bucket] = NULL;
-            }
-        }
+/// Store a NUL-terminated copy of @c key for @c node: inline, in the arena, or from the allocator.
+static void impl_key_store(struct hashmap *h, struct hashmap_node *node, const void *key, size_t len)
+{
+    char *copy;
 
-        node_destructor(list_unlink((struct list_iter *)iter));
+    if (len < h->inline_key_size) {
+        copy = (char *)node - len - 1;
+        node->length = len | KEY_INLINE;
+
+    } else {
+        copy = h->key_arena ? impl_arena_alloc(h, len + 1) : h->allocator.alloc(h->allocator.context, len + 1);
+        impl_key_point(node, copy);
+        node->length = len;
     }
+
+    memcpy(copy, key, len);
+    copy[len] = '\0';
 }
 
-void hashmap_clear(struct hashmap *h)
+/// Store @c key, a heap copy handed over by the caller: adopted as it is, unless it fits inline
+/// or the map keeps its keys in the arena, where it is copied and freed.
+static void impl_key_adopt(struct hashmap *h, struct hashmap_node *node, char *key, size_t len)
 {
-    if (!h) {
+    if (len < h->inline_key_size || h->key_arena) {
+        impl_key_store(h, node, key, len);
+        free(key);
         return;
     }
 
-    list_erase_all(h->list, node_destructor);
-    memset(h->map, 0, h->buckets * sizeof(struct hashmap_node *));
+    impl_key_point(node, key);
+    node->length = len;
 }
 
-size_t hashmap_bucket_count(struct hashmap *h)
+/// @return bool True if the key of @c node was duplicated on its own, from the allocator or adopted.
+static bool impl_key_on_heap(const struct hashmap *h, const struct hashmap_node *node)
 {
-    return h->buckets;
+    return !h->key_arena && !(node->length & KEY_INLINE);
 }
 
-size_t hashmap_bucket_size(struct hashmap *h, size_t bucket)
+/// Free the key of @c node if it was duplicated on its own.
+static void impl_key_release(struct hashmap *h, struct hashmap_node *node)
 {
-    if (!h) {
-        return 0;
+    if (!impl_key_on_heap(h, node)) {
+        return;
+    }
 
-    } else if (bucket >= h->buckets) {
-        return 0;
+    h->allocator.free(h->allocator.context, impl_key(node), node->length + 1);
+}
 
-    } else {
-        struct list_iter *iter;
-        size_t count = 0;
+/* Old buckets migrated by each operation during an incremental rehash. */
+#define REHASH_STEP 2
 
-        for (iter = h->map[bucket]; iter; iter = list_next(iter)) {
-            struct hashmap_node *node = list_at((struct list_iter *)iter);
+/* Arbitrary subset of prime numbers.
+ * Trade-off memory overhead vs rehash cost. */
+static size_t primes[] =
+{
+    5, 11, 23, 47, 53, 97,
+    193, 389, 769,
+    1543, 3079, 6151,
+    12289, 24593, 49157, 98317,
+    196613, 393241, 786433,
+    1572869, 3145739, 6291469,
+    12582917, 25165843, 50331653,
+    100663319, 201326611, 402653189, 805306457,
+    1610612741
+};
 
-            if (!node || node->bucket != bucket) {
-                break;
-            }
+/* Smallest power-of-two bucket count. */
+#define POW2_MIN_BUCKETS 8
 
-            count++;
+static size_t impl_bucket_count_ideal(const struct hashmap *h, size_t n)
+{
+    size_t i;
+    size_t ret = 5;
+
+    if (h->pow2) {
+        for (ret = POW2_MIN_BUCKETS; ret < n; ret <<= 1) {
         }
 
-        return count;
+        return ret;
+    }
+
+    for (i = 0; i < sizeof(primes)/sizeof(*primes) && ret < n; ++i) {
+        ret = primes[i];
     }
+
+    return ret;
 }
 
-size_t hashmap_bucket(const struct hashmap *h, const char *key)
+/// @return size_t Bucket count that supports @c elements at maximum load factor.
+static size_t impl_bucket_count_calculate(struct hashmap *h, size_t elements)
 {
-    if (!h) {
-        return 0;
+    return impl_bucket_count_ideal(h, (size_t)((float)(elements / hashmap_max_load_factor(h))));
+}
+
+/// @return size_t Bucket of @c hash in a table of @c n buckets.
+static size_t impl_reduce(const struct hashmap *h, size_t hash, size_t n)
+{
+    if (h->pow2) {
+        return hash & (n - 1);
     }
 
-    return hashof(key) % h->buckets;
+    return hash % n;
 }
 
-float hashmap_load_factor(struct hashmap *h)
+static void impl_alloc_buckets(struct hashmap *h, size_t n)
 {
-    if (!h) {
-        return 0;
-    }
+    size_t size = n * sizeof(struct bucket_head);
 
-    return hashmap_size(h) / (float)h->buckets;
+    h->buckets = n;
+    h->map = (struct bucket_head *)realloc(h->map, size);
+    memset(h->map, 0, size);
 }
 
-float hashmap_max_load_factor(struct hashmap *h)
+struct hashmap *hashmap_new(size_t element_size)
 {
-    return h->max_load_factor;
+    struct hashmap_options options = { .layout = HASHMAP_LAYOUT_CHAINED };
+
+    return hashmap_new_with(element_size, &options);
 }
 
-void hashmap_max_load_factor_set(struct hashmap *h, float z)
+/// Allocate a map with no storage yet.
+static struct hashmap *impl_new(size_t element_size, const struct hashmap_options *options)
 {
-    if (z < 0.25f) {
-        z = 0.25f;
+    struct hashmap *h = (struct hashmap *)malloc(sizeof(struct hashmap));
+    size_t align = sizeof(void *);
+
+    h->max_load_factor = 1.0;
+    h->min_load_factor = 0;
+    h->buckets = 0;
+    h->pow2 = options->sizing == HASHMAP_SIZING_POW2;
+    h->userdata_size = element_size;
+    h->element_size = (offsetof(struct hashmap_node, userdata) + element_size + align - 1) & ~(align - 1);
+    h->inline_key_size = options->inline_key_size;
+    h->key_slot_size = h->inline_key_size > sizeof(char *) ? (h->inline_key_size + align - 1) & ~(align - 1) : sizeof(char *);
+    h->node_size = (h->key_slot_size + h->element_size + (options->capacity ? 1 : 0) + align - 1) & ~(align - 1);
+    h->size = 0;
+    h->before_begin.next = NULL;
+    h->map = NULL;
+    h->swiss = NULL;
+    h->dense = NULL;
+    h->flat = NULL;
+    h->incremental = options->incremental_rehash;
+    h->old_map = NULL;
+    h->old_buckets = 0;
+    h->rehash_index = 0;
+    h->slab = options->slab;
+    h->chunks = NULL;
+    impl_slab_release(h);
+    h->key_arena = options->key_arena;
+    h->key_blocks = NULL;
+    h->stats = options->stats ? (struct hashmap_stats *)calloc(1, sizeof(struct hashmap_stats)) : NULL;
+    h->filter = NULL;
+    h->filter_blocks = 0;
+    h->filter_stale = 0;
+    h->capacity = 0;
+    h->hand = NULL;
+    h->pinned = 0;
+
+    if (options->evictor) {
+        h->evictor = *options->evictor;
+
+    } else {
+        h->evictor.evict = NULL;
+        h->evictor.context = NULL;
     }
 
-    h->max_load_factor = z;
+    if (options->allocator) {
+        h->allocator = *options->allocator;
 
-    hashmap_rehash(h, impl_bucket_count_calculate(h, hashmap_size(h)));
+    } else {
+        h->allocator.alloc = default_alloc;
+        h->allocator.free = default_free;
+        h->allocator.context = NULL;
+    }
+
+    h->seed = options->seed ? options->seed : seed_random();
+    h->reseed = !options->seed && !options->hasher;
+    h->reseed_size = 0;
+
+    if (options->hasher) {
+        h->hasher = *options->hasher;
+
+    } else {
+        h->hasher.hash = default_hash;
+        h->hasher.context = &h->seed;
+    }
+
+    return h;
 }
 
-void hashmap_rehash(struct hashmap *h, size_t n)
+struct hashmap *hashmap_new_with(size_t element_size, const struct hashmap_options *options)
 {
-    struct list_iter *iter;
+    struct hashmap *h = impl_new(element_size, options);
 
-    if (n <= h->buckets) {
-        return;
+    if (options->layout == HASHMAP_LAYOUT_SWISS) {
+        h->max_load_factor = SWISS_MAX_LOAD_FACTOR;
+        h->swiss = swiss_new(element_size, h->max_load_factor, &h->allocator);
+        swiss_set_stats(h->swiss, h->stats);
+
+    } else if (options->layout == HASHMAP_LAYOUT_DENSE) {
+        h->max_load_factor = DENSE_LOAD_FACTOR;
+        h->dense = dense_new(element_size, h->max_load_factor, &h->allocator, h->inline_key_size);
+        dense_set_stats(h->dense, h->stats);
+
+    } else {
+        impl_alloc_buckets(h, impl_bucket_count_calculate(h, hashmap_size(h)));
+
+        if (options->filter) {
+            impl_filter_rebuild(h, 0);
+        }
+
+        h->capacity = options->capacity;
     }
 
-    impl_alloc_buckets(h, n);
+    return h;
+}
+
+struct hashmap *hashmap_open(const char *path, const struct hashmap_options *options)
+{
+    struct hashmap_options defaults = { .layout = HASHMAP_LAYOUT_CHAINED };
+    struct flat *f = flat_open(path);
+    struct hashmap *h;
 
-    for (iter = list_begin(h->list); iter != list_end(h->list); ) {
-        struct list_iter *next = list_next(iter);
-        struct hashmap_node *node = (struct hashmap_node *)list_at(iter);
+    if (!f) {
+        return NULL;
+    }
 
-        if ((struct list_iter *)hashmap_find(h, node->key) == list_end(h->list)) {
-            node->bucket = hashmap_bucket(h, node->key);
+    h = impl_new(flat_element_size(f), options ? options : &defaults);
+    h->flat = f;
+    h->seed = flat_seed(f);
+    flat_set_stats(f, h->stats);
+    return h;
+}
 
-            if (h->map[node->bucket]) {
-                list_splice(h->map[node->bucket], iter);
-            }
+int hashmap_save(struct hashmap *h, const char *path)
+{
+    struct flat *f;
+    int r;
 
-            h->map[node->bucket] = iter;
-        }
+    if (h->flat) {
+        return flat_save(h->flat, path);
+    }
+
+    f = flat_build(h, h->userdata_size, h->seed);
+    r = flat_save(f, path);
+    flat_delete(f);
+    return r;
+}
+
+/// Release the storage of whichever layout the map has.
+static void impl_release(struct hashmap *h)
+{
+    if (h->swiss) {
+        swiss_delete(h->swiss);
+        h->swiss = NULL;
+
+    } else if (h->dense) {
+        dense_delete(h->dense);
+        h->dense = NULL;
 
-        iter = next;
+    } else if (h->flat) {
+        flat_delete(h->flat);
+        h->flat = NULL;
+
+    } else {
+        hashmap_clear(h);
+        free(h->map);
+        h->map = NULL;
+        h->buckets = 0;
+        free(h->filter);
+        h->filter = NULL;
+        h->filter_blocks = 0;
     }
 }
 
-void hashmap_reserve(struct hashmap *h, size_t elements)
+bool hashmap_freeze(struct hashmap *h)
 {
-    size_t capacity = (size_t)(h->buckets * h->max_load_factor);
+    struct flat *f = flat_freeze(h, h->userdata_size, h->seed);
 
-    if (elements > capacity) {
-        hashmap_rehash(h, impl_bucket_count_calculate(h, elements));
+    if (!f) {
+        return false;
     }
+
+    impl_release(h);
+    h->flat = f;
+    flat_set_stats(f, h->stats);
+    h->max_load_factor = 1.0;
+    return true;
+}
+
+void hashmap_delete(struct hashmap *h)
+{
+    if (!h) {
+        return;
+    }
+
+    impl_release(h);
+    free(h->stats);
+    free(h);
+}
+
+bool hashmap_empty(const struct hashmap *h)
+{
+    return hashmap_size(h) == 0;
+}
+
+size_t hashmap_size(const struct hashmap *h)
+{
+    if (!h) {
+        return 0;
+
+    } else if (h->swiss) {
+        return swiss_size(h->swiss);
+
+    } else if (h->dense) {
+        return dense_size(h->dense);
+
+    } else if (h->flat) {
+        return flat_size(h->flat);
+    }
+
+    return h->size;
+}
+
+struct hashmap_iter *hashmap_begin(struct hashmap *h)
+{
+    if (h->swiss) {
+        return swiss_begin(h->swiss);
+
+    } else if (h->dense) {
+        return dense_begin(h->dense);
+
+    } else if (h->flat) {
+        return flat_begin(h->flat);
+    }
+
+    return (struct hashmap_iter *)h->before_begin.next;
+}
+
+struct hashmap_iter *hashmap_end(struct hashmap *h)
+{
+    if (h->swiss) {
+        return swiss_end(h->swiss);
+
+    } else if (h->dense) {
+        return dense_end(h->dense);
+
+    } else if (h->flat) {
+        return flat_end(h->flat);
+    }
+
+    return NULL;
+}
+
+struct hashmap_iter *hashmap_iter_inc(struct hashmap_iter *iter)
+{
+    if (dense_is_iter(iter)) {
+        return dense_iter_inc(iter);
+
+    } else if (swiss_is_iter(iter)) {
+        return swiss_iter_inc(iter);
+
+    } else if (flat_is_iter(iter)) {
+        return flat_iter_inc(iter);
+    }
+
+    return iter ? (struct hashmap_iter *)((struct hashmap_node *)iter)->next : NULL;
+}
+
+struct hashmap_pair hashmap_iter_deref(struct hashmap_iter *iter)
+{
+    struct hashmap_node *node;
+    struct hashmap_pair pair;
+
+    if (dense_is_iter(iter)) {
+        return dense_iter_deref(iter);
+
+    } else if (swiss_is_iter(iter)) {
+        return swiss_iter_deref(iter);
+
+    } else if (flat_is_iter(iter)) {
+        return flat_iter_deref(iter);
+    }
+
+    node = (struct hashmap_node *)iter;
+
+    if (node) {
+        pair.key = impl_key(node);
+        pair.userdata = &node->userdata;
+        pair.length = impl_length(node);
+
+    } else {
+        pair.key = NULL;
+        pair.userdata = NULL;
+        pair.length = 0;
+    }
+
+    return pair;
+}
+
+static size_t hashof(const struct hashmap *h, const void *key, size_t len)
+{
+    return h->hasher.hash(h->hasher.context, key, len);
+}
+
+size_t hashmap_hash(const struct hashmap *h, const char *key)
+{
+    return hashof(h, key, strlen(key));
+}
+
+size_t hashmap_hash_n(const struct hashmap *h, const void *key, size_t len)
+{
+    return hashof(h, key, len);
+}
+
+/// @return uint64_t Tag bit of @c hash, taken from the top bits of a multiplicative mix, which the bucket index does not use.
+static uint64_t impl_tag(size_t hash)
+{
+    return (uint64_t)1 << (((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 58);
+}
+
+/// Locate the bucket for @c hash, which is in the old table if it has not been migrated yet.
+/// @return Pointer to the bucket, which points at the node before its run.
+static struct bucket_head *impl_locate(const struct hashmap *h, size_t hash)
+{
+    if (h->old_map) {
+        size_t bucket = impl_reduce(h, hash, h->old_buckets);
+
+        if (bucket >= h->rehash_index) {
+            return &h->old_map[bucket];
+        }
+    }
+
+    return &h->map[impl_reduce(h, hash, h->buckets)];
+}
+
+/// @return bool True if @c node belongs to the run of @c bucket.
+static bool impl_in_run(const struct hashmap *h, const struct hashmap_node *node, const struct bucket_head *bucket)
+{
+    return node && impl_locate(h, node->hash) == bucket;
+}
+
+/* Referenced flag of a node that an insert batch returned, until the batch ends. */
+#define CLOCK_PINNED 2
+
+/// @return Referenced flag of @c node in a bounded map, after its userdata.
+static unsigned char *impl_referenced(const struct hashmap *h, struct hashmap_node *node)
+{
+    return (unsigned char *)node + h->element_size;
+}
+
+/// Search one bucket.
+/// @return Node with @c key, or NULL.
+/// @param last Set on a miss to the last node of the run, or to NULL if the bucket is empty or the filter
+/// or the tags ruled the key out before the run was walked (see @c impl_run_last).
+/// @param probes Set to the number of nodes compared; on a miss, the length of the run, or zero if the tags rule it out.
+static struct hashmap_node *impl_lookup(const struct hashmap *h, struct bucket_head *bucket, size_t hash, const void *key, size_t len, struct hashmap_node **last, size_t *probes)
+{
+    struct hashmap_node *node;
+
+    *last = NULL;
+    *probes = 0;
+
+    /* Most misses end here, without reading the bucket or any node. */
+    if (h->filter && !impl_filter_test(h, hash)) {
+        if (h->stats) {
+            stats_lookup(h->stats, 0, false);
+            h->stats->filtered++;
+        }
+
+        return NULL;
+    }
+
+    if (bucket->tags & impl_tag(hash)) {
+        for (node = bucket->prev->next; impl_in_run(h, node, bucket); node = node->next) {
+            ++*probes;
+            if (hash == node->hash && len == impl_length(node) && !memcmp(key, impl_key(node), len)) {
+                if (h->stats) {
+                    stats_lookup(h->stats, *probes, true);
+                }
+
+                /* Only the first hit since the hand passed writes to the node. */
+                if (h->capacity && !*impl_referenced(h, node)) {
+                    *impl_referenced(h, node) = 1;
+                }
+
+                return node;
+            }
+
+            *last = node;
+        }
+    }
+
+    if (h->stats) {
+        stats_lookup(h->stats, *probes, false);
+    }
+
+    return NULL;
+}
+
+/// @return The last node of the run of @c bucket, or NULL if it is empty.
+/// @param length Set to the number of nodes in the run.
+static struct hashmap_node *impl_run_last(const struct hashmap *h, const struct bucket_head *bucket, size_t *length)
+{
+    struct hashmap_node *node = bucket->prev;
+
+    *length = 0;
+
+    if (node) {
+        for (node = node->next, *length = 1; impl_in_run(h, node->next, bucket); node = node->next) {
+            ++*length;
+        }
+    }
+
+    return node;
+}
+
+/// The node before @c node changed from @c from to @c to; if it starts a run, its bucket must follow.
+static void impl_relink(struct hashmap *h, struct hashmap_node *node, struct hashmap_node *from, struct hashmap_node *to)
+{
+    if (node) {
+        struct bucket_head *bucket = impl_locate(h, node->hash);
+
+        if (bucket->prev == from) {
+            bucket->prev = to;
+        }
+    }
+}
+
+/// Link @c node into @c bucket: after @c last, the last node of the run as found by @c impl_lookup,
+/// or at the start of the run if @c last is NULL. A new bucket starts at the front of the list.
+static void impl_link(struct hashmap *h, struct bucket_head *bucket, struct hashmap_node *last, struct hashmap_node *node)
+{
+    bucket->tags |= impl_tag(node->hash);
+
+    if (!bucket->prev) {
+        node->next = h->before_begin.next;
+        h->before_begin.next = node;
+        impl_relink(h, node->next, &h->before_begin, node);
+        bucket->prev = &h->before_begin;
+
+    } else if (!last) {
+        node->next = bucket->prev->next;
+        bucket->prev->next = node;
+
+    } else {
+        node->next = last->next;
+        last->next = node;
+        impl_relink(h, node->next, last, node);
+    }
+}
+
+/// Unlink @c node, which follows @c prev in the list; the caller releases it.
+static void impl_unlink_after(struct hashmap *h, struct hashmap_node *prev, struct hashmap_node *node)
+{
+    struct bucket_head *bucket = impl_locate(h, node->hash);
+    struct hashmap_node *next = node->next;
+    struct hashmap_node *rest;
+
+    prev->next = next;
+
+    if (bucket->prev == prev && !impl_in_run(h, next, bucket)) {
+        bucket->prev = NULL;
+        bucket->tags = 0;
+
+    } else {
+        /* Other elements may share the tag of @c node, so collect the tags of the rest of the run again. */
+        bucket->tags = 0;
+        for (rest = bucket->prev->next; impl_in_run(h, rest, bucket); rest = rest->next) {
+            bucket->tags |= impl_tag(rest->hash);
+        }
+    }
+
+    impl_relink(h, next, node, prev);
+}
+
+/// @return The node before @c node in the list, found by walking its run.
+static struct hashmap_node *impl_prev(const struct hashmap *h, const struct hashmap_node *node)
+{
+    struct hashmap_node *prev = impl_locate(h, node->hash)->prev;
+
+    while (prev->next != node) {
+        prev = prev->next;
+    }
+
+    return prev;
+}
+
+struct hashmap_iter *hashmap_find(struct hashmap *h, const char *key)
+{
+    return hashmap_find_n(h, key, strlen(key));
+}
+
+/// Find with a known hash; lookups leave a pending rehash alone, so that they do not reorder an iteration.
+static struct hashmap_iter *impl_find(struct hashmap *h, size_t hash, const void *key, size_t len)
+{
+    struct hashmap_node *node;
+    struct hashmap_node *last;
+    size_t probes;
+
+    if (h->swiss) {
+        return swiss_find(h->swiss, hash, key, len);
+
+    } else if (h->dense) {
+        return dense_find(h->dense, hash, key, len);
+
+    } else if (h->flat) {
+        return flat_find(h->flat, hash, key, len);
+    }
+
+    node = impl_lookup(h, impl_locate(h, hash), hash, key, len, &last, &probes);
+    if (node) {
+        return (struct hashmap_iter *)node;
+    }
+
+    return hashmap_end(h);
+}
+
+struct hashmap_iter *hashmap_find_n(struct hashmap *h, const void *key, size_t len)
+{
+    return impl_find(h, hashof(h, key, len), key, len);
+}
+
+struct hashmap_iter *hashmap_find_with_hash(struct hashmap *h, const char *key, size_t hash)
+{
+    return impl_find(h, hash, key, strlen(key));
+}
+
+/// Start an incremental rehash into @c n buckets, or rehash at once if incremental rehashing is disabled.
+static void impl_grow(struct hashmap *h, size_t n)
+{
+    if (n <= h->buckets) {
+        return;
+
+    } else if (!h->incremental) {
+        hashmap_rehash(h, n);
+        return;
+    }
+
+    hashmap_rehash_step(h, SIZE_MAX);
+
+    h->old_map = h->map;
+    h->old_buckets = h->buckets;
+    h->rehash_index = 0;
+
+    h->map = NULL;
+    impl_alloc_buckets(h, n);
+
+    if (h->stats) {
+        h->stats->rehashes++;
+    }
+}
+
+/// Move the nodes of the next old bucket into the new table.
+static void impl_migrate(struct hashmap *h)
+{
+    struct bucket_head *bucket = &h->old_map[h->rehash_index];
+    struct hashmap_node *node = NULL;
+
+    /* Detach the whole run first: its nodes belong to the new table as soon as the index moves on. */
+    if (bucket->prev) {
+        struct hashmap_node *prev = bucket->prev;
+        struct hashmap_node *last = prev->next;
+
+        node = last;
+        while (impl_in_run(h, last->next, bucket)) {
+            last = last->next;
+        }
+
+        prev->next = last->next;
+        bucket->prev = NULL;
+        bucket->tags = 0;
+        impl_relink(h, last->next, last, prev);
+        last->next = NULL;
+    }
+
+    h->rehash_index++;
+
+    while (node) {
+        struct hashmap_node *next = node->next;
+
+        impl_link(h, &h->map[impl_reduce(h, node->hash, h->buckets)], NULL, node);
+        node = next;
+    }
+
+    if (h->rehash_index == h->old_buckets) {
+        free(h->old_map);
+        h->old_map = NULL;
+    }
+}
+
+/// Move a chained map with no rehash pending to @c n buckets, more or fewer than now.
+static void impl_rebucket(struct hashmap *h, size_t n)
+{
+    struct hashmap_node *node = h->before_begin.next;
+    double start = h->stats ? stats_now() : 0;
+    size_t front = n;
+
+    impl_alloc_buckets(h, n);
+    h->before_begin.next = NULL;
+
+    /* One pass over the list, using the stored hash: a node joins the start of its bucket's run,
+     * or starts a new run at the front of the list, behind which the previous front run now sits. */
+    while (node) {
+        struct hashmap_node *next = node->next;
+        size_t bucket = impl_reduce(h, node->hash, n);
+
+        if (h->map[bucket].prev) {
+            node->next = h->map[bucket].prev->next;
+            h->map[bucket].prev->next = node;
+
+        } else {
+            node->next = h->before_begin.next;
+            h->before_begin.next = node;
+            h->map[bucket].prev = &h->before_begin;
+
+            if (node->next) {
+                h->map[front].prev = node;
+            }
+
+            front = bucket;
+        }
+
+        h->map[bucket].tags |= impl_tag(node->hash);
+
+        node = next;
+    }
+
+    /* Rehashing is a pass over every element anyway; it also clears the bits of erased elements. */
+    if (h->filter) {
+        impl_filter_rebuild(h, h->size);
+    }
+
+    if (h->stats) {
+        h->stats->rehashes++;
+        h->stats->rehash_seconds += stats_now() - start;
+    }
+}
+
+/* A map with a random seed draws a new one when an insert meets a chain this many times longer than
+ * the maximum load factor (or than one); under a seed unknown to the keys' author, such a chain is all but impossible. */
+#define RESEED_CHAIN 32
+
+/// Hash every key again under a new seed, after keys flooded one chain.
+static void impl_reseed(struct hashmap *h)
+{
+    struct hashmap_node *node;
+
+    hashmap_rehash_step(h, SIZE_MAX);
+    h->seed = seed_random();
+
+    for (node = h->before_begin.next; node; node = node->next) {
+        node->hash = hashof(h, impl_key(node), impl_length(node));
+    }
+
+    impl_rebucket(h, h->buckets);
+    h->reseed_size = h->size;
+
+    if (h->stats) {
+        h->stats->reseeds++;
+    }
+}
+
+struct hashmap_insert_ret hashmap_insert(struct hashmap *h, const char *key)
+{
+    return hashmap_insert_n(h, key, strlen(key));
+}
+
+/// Erase @c node of a chained map, which follows @c prev in the list.
+static void impl_erase_after(struct hashmap *h, struct hashmap_node *prev, struct hashmap_node *node)
+{
+    if (h->hand == node) {
+        h->hand = node->next;
+    }
+
+    impl_unlink_after(h, prev, node);
+    h->size--;
+    impl_key_release(h, node);
+    unmake(h, node);
+
+    if (h->filter && ++h->filter_stale > h->size) {
+        impl_filter_rebuild(h, h->size);
+    }
+}
+
+/// Evict one element, neither @c keep nor pinned, from a bounded map that holds more than its capacity.
+/// The hand sweeps the list round, clearing the referenced flags it finds set, and evicts the first
+/// element whose flag is clear; each hit is thus paid for by one step of the hand.
+static void impl_evict(struct hashmap *h, struct hashmap_node *keep)
+{
+    struct hashmap_node *node = h->hand;
+
+    for (;; node = node->next) {
+        if (!node) {
+            node = h->before_begin.next;
+        }
+
+        if (node != keep && !*impl_referenced(h, node)) {
+            break;
+
+        } else if (*impl_referenced(h, node) != CLOCK_PINNED) {
+            *impl_referenced(h, node) = 0;
+        }
+    }
+
+    if (h->evictor.evict) {
+        h->evictor.evict(h->evictor.context, impl_key(node), impl_length(node), &node->userdata);
+    }
+
+    /* Erasing moves the hand on past the victim. */
+    h->hand = node;
+    impl_erase_after(h, impl_prev(h, node), node);
+
+    if (h->stats) {
+        h->stats->evictions++;
+    }
+}
+
+/// Insert with a known hash; the caller advances any pending rehash and grows the table.
+/// @param take Heap key to adopt instead of copying @c key, or NULL; freed if not adopted.
+static struct hashmap_insert_ret impl_insert(struct hashmap *h, size_t hash, const void *key, size_t len, char *take)
+{
+    struct bucket_head *bucket;
+    struct hashmap_node *node;
+    struct hashmap_node *last;
+    struct hashmap_insert_ret ret;
+    size_t probes;
+
+    /* Keys come from the allocator, so a key from malloc is adopted only when the allocator is malloc. */
+    if (take && h->allocator.alloc != default_alloc) {
+        ret = impl_insert(h, hash, take, len, NULL);
+        free(take);
+        return ret;
+    }
+
+    if (h->swiss) {
+        return swiss_insert(h->swiss, hash, key, len, take);
+
+    } else if (h->dense) {
+        return dense_insert(h->dense, hash, key, len, take);
+
+    } else if (h->flat) {
+        /* Read-only: report the element that exists, if any. */
+        ret.ok = false;
+        ret.pair = hashmap_iter_deref(flat_find(h->flat, hash, key, len));
+        free(take);
+        return ret;
+    }
+
+    bucket = impl_locate(h, hash);
+    node = impl_lookup(h, bucket, hash, key, len, &last, &probes);
+    if (node) {
+        free(take);
+        ret.ok = false;
+        ret.pair = hashmap_iter_deref((struct hashmap_iter *)node);
+
+    } else {
+        node = make(h);
+        node->hash = hash;
+
+        if (take) {
+            impl_key_adopt(h, node, take, len);
+
+        } else {
+            impl_key_store(h, node, key, len);
+        }
+
+        /* Keep the run in insertion order; the link writes to its last node anyway. If the filter or
+         * the tags ruled the key out, that walk also measures the run for the flood check below. */
+        if (!last) {
+            last = impl_run_last(h, bucket, &probes);
+        }
+
+        impl_link(h, bucket, last, node);
+        h->size++;
+
+        if (h->filter && h->size > h->filter_blocks * FILTER_CAPACITY) {
+            impl_filter_rebuild(h, h->size);
+
+        } else if (h->filter) {
+            impl_filter_add(h, hash);
+        }
+
+        if (h->capacity) {
+            *impl_referenced(h, node) = 0;
+
+            /* During a batch the map may outgrow its capacity while every other element is pinned. */
+            if (h->size > h->capacity && h->size > h->pinned + 1) {
+                impl_evict(h, node);
+            }
+        }
+
+        if (h->reseed && probes >= RESEED_CHAIN * (h->max_load_factor > 1 ? h->max_load_factor : 1) && h->size >= 2 * h->reseed_size) {
+            impl_reseed(h);
+        }
+
+        ret.ok = true;
+        ret.pair.key = impl_key(node);
+        ret.pair.userdata = &node->userdata;
+        ret.pair.length = len;
+    }
+
+    return ret;
+}
+
+/// Make room for @c n more elements of a chained map.
+static void impl_grow_for(struct hashmap *h, size_t n)
+{
+    if (h->map) {
+        impl_grow(h, impl_bucket_count_calculate(h, hashmap_size(h) + n));
+    }
+}
+
+struct hashmap_insert_ret hashmap_insert_n(struct hashmap *h, const void *key, size_t len)
+{
+    hashmap_rehash_step(h, REHASH_STEP);
+    impl_grow_for(h, 0);
+    return impl_insert(h, hashof(h, key, len), key, len, NULL);
+}
+
+struct hashmap_insert_ret hashmap_insert_with_hash(struct hashmap *h, const char *key, size_t hash)
+{
+    hashmap_rehash_step(h, REHASH_STEP);
+    impl_grow_for(h, 0);
+    return impl_insert(h, hash, key, strlen(key), NULL);
+}
+
+struct hashmap_insert_ret hashmap_insert_take(struct hashmap *h, char *key)
+{
+    size_t len = strlen(key);
+
+    hashmap_rehash_step(h, REHASH_STEP);
+    impl_grow_for(h, 0);
+    return impl_insert(h, hashof(h, key, len), key, len, key);
+}
+
+struct hashmap_insert_ret hashmap_try_emplace(struct hashmap *h, const char *key, void (*init)(void *context, void *userdata), void *context)
+{
+    struct hashmap_insert_ret ret = hashmap_insert(h, key);
+
+    if (ret.ok) {
+        init(context, ret.pair.userdata);
+    }
+
+    return ret;
+}
+
+/// Shrink the table to the smallest that holds @c elements within the maximum load factor.
+static void impl_shrink(struct hashmap *h, size_t elements)
+{
+    size_t n;
+
+    if (h->swiss) {
+        swiss_shrink(h->swiss, elements);
+        return;
+
+    } else if (h->dense) {
+        dense_shrink(h->dense, elements);
+        return;
+
+    } else if (h->flat) {
+        return;
+    }
+
+    hashmap_rehash_step(h, SIZE_MAX);
+    n = impl_bucket_count_calculate(h, elements);
+
+    if (n < h->buckets) {
+        impl_rebucket(h, n);
+    }
+}
+
+/// Shrink a table that erasing or clearing left below the minimum load factor.
+static void impl_shrink_for(struct hashmap *h)
+{
+    /* Leave room for twice the elements, so that the load factor lands halfway to the maximum,
+     * well clear of the minimum, which is at most a quarter of it. Never interrupt an incremental rehash. */
+    if (h->min_load_factor > 0 && !h->old_map && hashmap_load_factor(h) < h->min_load_factor) {
+        impl_shrink(h, hashmap_size(h) * 2);
+    }
+}
+
+/// Erase the element at @c iter, which is not the end; the caller advances any pending rehash.
+static void impl_erase(struct hashmap *h, struct hashmap_iter *iter)
+{
+    struct hashmap_node *node = (struct hashmap_node *)iter;
+
+    if (h->swiss) {
+        swiss_erase(h->swiss, iter);
+        return;
+
+    } else if (h->dense) {
+        dense_erase(h->dense, iter);
+        return;
+
+    } else if (h->flat) {
+        return;
+    }
+
+    impl_erase_after(h, impl_prev(h, node), node);
+}
+
+void hashmap_erase(struct hashmap *h, struct hashmap_iter *iter)
+{
+    if (!h) {
+        return;
+
+    } else if (iter == hashmap_end(h)) {
+        return;
+    }
+
+    /* No migration here either: erasing at an iterator is how a loop over the map removes elements. */
+    impl_erase(h, iter);
+    impl_shrink_for(h);
+}
+
+/// Erase the element with @c key, if any; the caller advances any pending rehash.
+/// @param out Receives a copy of the userdata of the element, if not NULL.
+/// @return bool True if an element was erased.
+static bool impl_erase_key(struct hashmap *h, size_t hash, const void *key, size_t len, void *out)
+{
+    struct bucket_head *bucket;
+    struct hashmap_node *node;
+    struct hashmap_node *last;
+    struct hashmap_iter *iter;
+    size_t probes;
+
+    if (h->swiss) {
+        iter = swiss_find(h->swiss, hash, key, len);
+        if (iter == swiss_end(h->swiss)) {
+            return false;
+        }
+
+        if (out) {
+            memcpy(out, swiss_iter_deref(iter).userdata, h->userdata_size);
+        }
+
+        swiss_erase(h->swiss, iter);
+        return true;
+
+    } else if (h->dense) {
+        iter = dense_find(h->dense, hash, key, len);
+        if (iter == dense_end(h->dense)) {
+            return false;
+        }
+
+        if (out) {
+            memcpy(out, dense_iter_deref(iter).userdata, h->userdata_size);
+        }
+
+        dense_erase(h->dense, iter);
+        return true;
+
+    } else if (h->flat) {
+        return false;
+    }
+
+    /* The lookup stops just after the predecessor, so the erase needs no second walk. */
+    bucket = impl_locate(h, hash);
+    node = impl_lookup(h, bucket, hash, key, len, &last, &probes);
+    if (!node) {
+        return false;
+    }
+
+    if (out) {
+        memcpy(out, &node->userdata, h->userdata_size);
+    }
+
+    impl_erase_after(h, last ? last : bucket->prev, node);
+    return true;
+}
+
+bool hashmap_erase_n(struct hashmap *h, const void *key, size_t len)
+{
+    bool erased;
+
+    if (!h) {
+        return false;
+    }
+
+    hashmap_rehash_step(h, REHASH_STEP);
+    erased = impl_erase_key(h, hashof(h, key, len), key, len, NULL);
+    impl_shrink_for(h);
+    return erased;
+}
+
+bool hashmap_erase_with_hash(struct hashmap *h, const char *key, size_t hash)
+{
+    bool erased;
+
+    if (!h) {
+        return false;
+    }
+
+    hashmap_rehash_step(h, REHASH_STEP);
+    erased = impl_erase_key(h, hash, key, strlen(key), NULL);
+    impl_shrink_for(h);
+    return erased;
+}
+
+bool hashmap_erase_key(struct hashmap *h, const char *key)
+{
+    return hashmap_erase_n(h, key, strlen(key));
+}
+
+bool hashmap_extract(struct hashmap *h, const char *key, void *out)
+{
+    return hashmap_extract_n(h, key, strlen(key), out);
+}
+
+bool hashmap_extract_n(struct hashmap *h, const void *key, size_t len, void *out)
+{
+    bool erased;
+
+    if (!h) {
+        return false;
+    }
+
+    hashmap_rehash_step(h, REHASH_STEP);
+    erased = impl_erase_key(h, hashof(h, key, len), key, len, out);
+    impl_shrink_for(h);
+    return erased;
+}
+
+size_t hashmap_erase_if(struct hashmap *h, bool (*pred)(void *context, struct hashmap_pair pair), void *context)
+{
+    struct hashmap_node *prev = &h->before_begin;
+    struct hashmap_node *node;
+    struct hashmap_iter *iter;
+    size_t erased = 0;
+
+    if (h->swiss) {
+        /* Erasing leaves other slots where they are, so the scan can go on from the next one. */
+        for (iter = swiss_begin(h->swiss); iter != swiss_end(h->swiss);) {
+            struct hashmap_iter *next = swiss_iter_inc(iter);
+
+            if (pred(context, swiss_iter_deref(iter))) {
+                swiss_erase(h->swiss, iter);
+                erased++;
+            }
+
+            iter = next;
+        }
+
+    } else if (h->dense) {
+        /* Erasing moves the last element into the hole, so the scan looks at the same entry again. */
+        for (iter = dense_begin(h->dense); iter != dense_end(h->dense);) {
+            if (pred(context, dense_iter_deref(iter))) {
+                dense_erase(h->dense, iter);
+                erased++;
+
+            } else {
+                iter = dense_iter_inc(iter);
+            }
+        }
+
+    } else if (h->map) {
+        /* One pass over the list, erasing behind a predecessor that is always known. */
+        while ((node = prev->next)) {
+            if (pred(context, hashmap_iter_deref((struct hashmap_iter *)node))) {
+                impl_erase_after(h, prev, node);
+                erased++;
+
+            } else {
+                prev = node;
+            }
+        }
+    }
+
+    /* Shrink once, after the sweep, so that the table never moves under it. */
+    impl_shrink_for(h);
+    return erased;
+}
+
+/* Keys hashed and prefetched ahead of resolving them. */
+#define BATCH 32
+
+/// Hash @c n keys, at most BATCH, and prefetch their buckets, so that the cache misses of all of them overlap.
+/// The first pass touches the buckets, the second the node before each run, the third the first node of each run.
+static void impl_batch_prepare(struct hashmap *h, const char *const *keys, size_t n, size_t *hash, size_t *len)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        len[i] = strlen(keys[i]);
+        hash[i] = hashof(h, keys[i], len[i]);
+
+        if (h->swiss) {
+            swiss_prefetch(h->swiss, hash[i]);
+
+        } else if (h->dense) {
+            dense_prefetch(h->dense, hash[i]);
+
+        } else if (h->map) {
+            __builtin_prefetch(impl_locate(h, hash[i]));
+        }
+    }
+
+    /* Runs that the tags rule out are never walked, so their nodes are not worth fetching. */
+    for (i = 0; i < n && h->map; ++i) {
+        struct bucket_head *bucket = impl_locate(h, hash[i]);
+
+        if (bucket->tags & impl_tag(hash[i])) {
+            __builtin_prefetch(bucket->prev);
+        }
+    }
+
+    for (i = 0; i < n && h->map; ++i) {
+        struct bucket_head *bucket = impl_locate(h, hash[i]);
+
+        if (bucket->tags & impl_tag(hash[i])) {
+            __builtin_prefetch(bucket->prev->next);
+        }
+    }
+}
+
+void hashmap_find_batch(struct hashmap *h, const char *const *keys, size_t n, struct hashmap_iter **iters)
+{
+    size_t hash[BATCH];
+    size_t len[BATCH];
+    size_t i;
+    size_t j;
+    size_t k;
+
+    for (i = 0; i < n; i += k) {
+        k = n - i < BATCH ? n - i : BATCH;
+
+        impl_batch_prepare(h, keys + i, k, hash, len);
+
+        for (j = 0; j < k; ++j) {
+            iters[i + j] = impl_find(h, hash[j], keys[i + j], len[j]);
+        }
+    }
+}
+
+/// Pin the element of a bounded map with @c userdata for the rest of an insert batch, or unpin it as referenced.
+static void impl_pin(struct hashmap *h, void *userdata, bool pin)
+{
+    struct hashmap_node *node = (struct hashmap_node *)((char *)userdata - offsetof(struct hashmap_node, userdata));
+    unsigned char *flag = impl_referenced(h, node);
+
+    if (pin && *flag != CLOCK_PINNED) {
+        *flag = CLOCK_PINNED;
+        h->pinned++;
+
+    } else if (!pin && *flag == CLOCK_PINNED) {
+        *flag = 1;
+        h->pinned--;
+    }
+}
+
+void hashmap_insert_batch(struct hashmap *h, const char *const *keys, size_t n, struct hashmap_insert_ret *rets)
+{
+    size_t hash[BATCH];
+    size_t len[BATCH];
+    size_t i;
+    size_t j;
+    size_t k;
+
+    for (i = 0; i < n; i += k) {
+        k = n - i < BATCH ? n - i : BATCH;
+
+        hashmap_rehash_step(h, REHASH_STEP * k);
+        impl_grow_for(h, k);
+        impl_batch_prepare(h, keys + i, k, hash, len);
+
+        for (j = 0; j < k; ++j) {
+            uint64_t seed = h->seed;
+
+            rets[i + j] = impl_insert(h, hash[j], keys[i + j], len[j], NULL);
+
+            if (h->capacity) {
+                impl_pin(h, rets[i + j].pair.userdata, true);
+            }
+
+            /* A reseed invalidates the hashes prepared for the rest of the batch. */
+            if (h->seed != seed) {
+                impl_batch_prepare(h, keys + i, k, hash, len);
+            }
+        }
+    }
+
+    if (h->capacity) {
+        for (i = 0; i < n; ++i) {
+            impl_pin(h, rets[i].pair.userdata, false);
+        }
+
+        while (h->size > h->capacity) {
+            impl_evict(h, NULL);
+        }
+    }
+}
+
+size_t hashmap_erase_batch(struct hashmap *h, const char *const *keys, size_t n)
+{
+    size_t hash[BATCH];
+    size_t len[BATCH];
+    size_t erased = 0;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (!h) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i += k) {
+        k = n - i < BATCH ? n - i : BATCH;
+
+        hashmap_rehash_step(h, REHASH_STEP * k);
+        impl_batch_prepare(h, keys + i, k, hash, len);
+
+        for (j = 0; j < k; ++j) {
+            erased += impl_erase_key(h, hash[j], keys[i + j], len[j], NULL);
+        }
+    }
+
+    impl_shrink_for(h);
+    return erased;
+}
+
+/* Buckets per partition of a bulk build, small enough that linking one partition stays in cache. */
+#define BUILD_PARTITION_BUCKETS 4096
+#define BUILD_MAX_PARTITIONS 65536
+
+/// Share of a bulk build done by one thread.
+struct build_slice {
+    struct hashmap *h;
+    const char *const *keys;
+    struct hashmap_node **nodes;
+    struct hashmap_node **sorted;
+    size_t begin;
+    size_t end;
+    size_t partitions;
+    /* Nodes of the slice per partition, then where the slice scatters them. */
+    size_t *counts;
+    /* Allocator and key storage are safe to use from several threads. */
+    bool make;
+    bool store;
+};
+
+static size_t impl_partition_of(const struct build_slice *slice, const struct hashmap_node *node)
+{
+    return (size_t)((uint64_t)impl_reduce(slice->h, node->hash, slice->h->buckets) * slice->partitions / slice->h->buckets);
+}
+
+/// Prepare the nodes of a slice: hash, bucket and, where safe, allocation and key copy.
+static void *impl_build_prepare(void *arg)
+{
+    struct build_slice *slice = (struct build_slice *)arg;
+    struct hashmap *h = slice->h;
+    size_t i;
+
+    for (i = slice->begin; i < slice->end; ++i) {
+        const char *key = slice->keys[i];
+        struct hashmap_node *node = slice->make ? make(h) : slice->nodes[i];
+
+        node->length = strlen(key);
+        node->hash = hashof(h, key, node->length);
+
+        if (slice->store) {
+            impl_key_store(h, node, key, node->length);
+
+        } else {
+            impl_key_point(node, key);
+        }
+
+        slice->nodes[i] = node;
+        slice->counts[impl_partition_of(slice, node)]++;
+    }
+
+    return NULL;
+}
+
+/// Scatter the nodes of a slice into partition order.
+static void *impl_build_scatter(void *arg)
+{
+    struct build_slice *slice = (struct build_slice *)arg;
+    size_t i;
+
+    for (i = slice->begin; i < slice->end; ++i) {
+        slice->sorted[slice->counts[impl_partition_of(slice, slice->nodes[i])]++] = slice->nodes[i];
+    }
+
+    return NULL;
+}
+
+/// Run @c fn on every slice, the first in the calling thread.
+static void impl_build_run(struct build_slice *slices, size_t nthreads, void *(*fn)(void *))
+{
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    size_t t;
+
+    for (t = 1; t < nthreads; ++t) {
+        pthread_create(&threads[t], NULL, fn, &slices[t]);
+    }
+
+    fn(&slices[0]);
+
+    for (t = 1; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+}
+
+size_t hashmap_build(struct hashmap *h, const char *const *keys, size_t n, size_t nthreads)
+{
+    struct build_slice *slices;
+    struct hashmap_node **nodes;
+    struct hashmap_node **sorted;
+    size_t partitions;
+    size_t inserted = 0;
+    size_t offset = 0;
+    size_t i;
+    size_t p;
+    size_t t;
+
+    if (h->flat) {
+        return 0;
+
+    } else if (h->swiss) {
+        swiss_reserve(h->swiss, swiss_size(h->swiss) + n);
+
+        for (i = 0; i < n; ++i) {
+            inserted += swiss_insert(h->swiss, hashof(h, keys[i], strlen(keys[i])), keys[i], strlen(keys[i]), NULL).ok;
+        }
+
+        return inserted;
+
+    } else if (h->dense) {
+        dense_reserve(h->dense, dense_size(h->dense) + n);
+
+        for (i = 0; i < n; ++i) {
+            inserted += dense_insert(h->dense, hashof(h, keys[i], strlen(keys[i])), keys[i], strlen(keys[i]), NULL).ok;
+        }
+
+        return inserted;
+    }
+
+    /* Size the table once; nothing below checks the load factor. */
+    hashmap_rehash_step(h, SIZE_MAX);
+    hashmap_reserve(h, hashmap_size(h) + n);
+
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    partitions = h->buckets / BUILD_PARTITION_BUCKETS + 1;
+    partitions = partitions < BUILD_MAX_PARTITIONS ? partitions : BUILD_MAX_PARTITIONS;
+
+    nodes = (struct hashmap_node **)malloc(n * sizeof(*nodes));
+    sorted = (struct hashmap_node **)malloc(n * sizeof(*sorted));
+    slices = (struct build_slice *)malloc(nthreads * sizeof(*slices));
+
+    for (t = 0; t < nthreads; ++t) {
+        slices[t].h = h;
+        slices[t].keys = keys;
+        slices[t].nodes = nodes;
+        slices[t].sorted = sorted;
+        slices[t].begin = n * t / nthreads;
+        slices[t].end = n * (t + 1) / nthreads;
+        slices[t].partitions = partitions;
+        slices[t].counts = (size_t *)calloc(partitions, sizeof(size_t));
+        /* The slab, the arena and a custom allocator need not be thread-safe; they serve the calling thread only. */
+        slices[t].make = !h->slab && h->allocator.alloc == default_alloc;
+        slices[t].store = !h->key_arena && h->allocator.alloc == default_alloc;
+    }
+
+    if (!slices[0].make) {
+        for (i = 0; i < n; ++i) {
+            nodes[i] = make(h);
+        }
+    }
+
+    impl_build_run(slices, nthreads, impl_build_prepare);
+
+    /* Partition p of slice t starts after all earlier partitions, and after partition p of earlier slices. */
+    for (p = 0; p < partitions; ++p) {
+        for (t = 0; t < nthreads; ++t) {
+            size_t count = slices[t].counts[p];
+
+            slices[t].counts[p] = offset;
+            offset += count;
+        }
+    }
+
+    impl_build_run(slices, nthreads, impl_build_scatter);
+
+    if (h->filter && h->size + n > h->filter_blocks * FILTER_CAPACITY) {
+        impl_filter_rebuild(h, h->size + n);
+    }
+
+    /* Link one partition after another, so the bucket heads touched stay in cache. */
+    for (i = 0; i < n; ++i) {
+        struct hashmap_node *node = sorted[i];
+        struct bucket_head *bucket = &h->map[impl_reduce(h, node->hash, h->buckets)];
+        struct hashmap_node *last;
+        size_t probes;
+
+        if (impl_lookup(h, bucket, node->hash, impl_key(node), impl_length(node), &last, &probes)) {
+            if (slices[0].store) {
+                impl_key_release(h, node);
+            }
+
+            unmake(h, node);
+            continue;
+        }
+
+        if (!slices[0].store) {
+            impl_key_store(h, node, impl_key(node), node->length);
+        }
+
+        if (!last) {
+            last = impl_run_last(h, bucket, &probes);
+        }
+
+        impl_link(h, bucket, last, node);
+        inserted++;
+
+        if (h->filter) {
+            impl_filter_add(h, node->hash);
+        }
+
+        if (h->capacity) {
+            *impl_referenced(h, node) = 0;
+        }
+    }
+
+    h->size += inserted;
+
+    while (h->capacity && h->size > h->capacity) {
+        impl_evict(h, NULL);
+    }
+
+    for (t = 0; t < nthreads; ++t) {
+        free(slices[t].counts);
+    }
+
+    free(slices);
+    free(sorted);
+    free(nodes);
+
+    return inserted;
+}
+
+void hashmap_clear(struct hashmap *h)
+{
+    if (!h) {
+        return;
+
+    } else if (h->swiss) {
+        swiss_clear(h->swiss);
+        impl_shrink_for(h);
+        return;
+
+    } else if (h->dense) {
+        dense_clear(h->dense);
+        impl_shrink_for(h);
+        return;
+
+    } else if (h->flat) {
+        return;
+    }
+
+    while (h->before_begin.next) {
+        struct hashmap_node *node = h->before_begin.next;
+
+        h->before_begin.next = node->next;
+        impl_key_release(h, node);
+
+        if (!h->slab) {
+            unmake(h, node);
+        }
+    }
+
+    h->size = 0;
+    h->hand = NULL;
+
+    impl_slab_release(h);
+    impl_arena_release(h);
+    memset(h->map, 0, h->buckets * sizeof(struct bucket_head));
+
+    free(h->old_map);
+    h->old_map = NULL;
+
+    if (h->filter) {
+        impl_filter_rebuild(h, 0);
+    }
+
+    impl_shrink_for(h);
+}
+
+/// @return Iterator to the first element in positions @c i up to @c last, or the end.
+static struct hashmap_iter *impl_seek(struct hashmap *h, size_t i, size_t last)
+{
+    if (h->swiss) {
+        return swiss_seek(h->swiss, i, last);
+
+    } else if (h->dense) {
+        return dense_seek(h->dense, i, last);
+
+    } else if (h->flat) {
+        return flat_seek(h->flat, i, last);
+    }
+
+    for (; i < last; ++i) {
+        if (h->map[i].prev) {
+            return (struct hashmap_iter *)h->map[i].prev->next;
+        }
+    }
+
+    return hashmap_end(h);
+}
+
+void hashmap_partition(struct hashmap *h, size_t k, struct hashmap_range *ranges)
+{
+    size_t positions;
+    size_t i;
+
+    hashmap_rehash_step(h, SIZE_MAX);
+
+    if (h->swiss) {
+        positions = swiss_bucket_count(h->swiss);
+
+    } else if (h->dense) {
+        positions = dense_size(h->dense);
+
+    } else if (h->flat) {
+        positions = flat_size(h->flat);
+
+    } else {
+        positions = h->buckets;
+    }
+
+    /* The first positions % k ranges take one position more than the others. */
+    for (i = 0; i < k; ++i) {
+        ranges[i].map = h;
+        ranges[i].first = positions / k * i + (i < positions % k ? i : positions % k);
+        ranges[i].last = ranges[i].first + positions / k + (i < positions % k);
+    }
+}
+
+struct hashmap_iter *hashmap_range_begin(const struct hashmap_range *r)
+{
+    return impl_seek(r->map, r->first, r->last);
+}
+
+struct hashmap_iter *hashmap_range_inc(const struct hashmap_range *r, struct hashmap_iter *iter)
+{
+    struct hashmap *h = r->map;
+    struct hashmap_node *node = (struct hashmap_node *)iter;
+    size_t bucket;
+
+    if (h->swiss) {
+        return swiss_seek(h->swiss, swiss_position(h->swiss, iter) + 1, r->last);
+
+    } else if (h->dense) {
+        return dense_seek(h->dense, dense_position(h->dense, iter) + 1, r->last);
+
+    } else if (h->flat) {
+        return flat_seek(h->flat, flat_position(h->flat, iter) + 1, r->last);
+    }
+
+    /* Follow the run of the bucket, then jump to the run of the next bucket of the range. */
+    bucket = impl_reduce(h, node->hash, h->buckets);
+    if (impl_in_run(h, node->next, &h->map[bucket])) {
+        return (struct hashmap_iter *)node->next;
+    }
+
+    return impl_seek(h, bucket + 1, r->last);
+}
+
+struct scan_thread {
+    struct hashmap_range *ranges;
+    size_t count;
+    atomic_size_t *next;
+    void (*fn)(void *context, struct hashmap_pair pair);
+    void *context;
+};
+
+static void *impl_scan(void *arg)
+{
+    struct scan_thread *scan = (struct scan_thread *)arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(scan->next, 1)) < scan->count) {
+        struct hashmap_range *r = &scan->ranges[i];
+        struct hashmap_iter *iter;
+
+        for (iter = hashmap_range_begin(r); iter != hashmap_end(r->map); iter = hashmap_range_inc(r, iter)) {
+            scan->fn(scan->context, hashmap_iter_deref(iter));
+        }
+    }
+
+    return NULL;
+}
+
+/* Ranges per thread of hashmap_for_each_parallel. */
+#define SCAN_RANGES 4
+
+void hashmap_for_each_parallel(struct hashmap *h, void (*fn)(void *context, struct hashmap_pair pair), void *context, size_t nthreads)
+{
+    struct scan_thread scan;
+    atomic_size_t next;
+    pthread_t *threads;
+    size_t t;
+
+    if (nthreads == 0) {
+        nthreads = 1;
+    }
+
+    scan.count = nthreads * SCAN_RANGES;
+    scan.ranges = (struct hashmap_range *)malloc(scan.count * sizeof(struct hashmap_range));
+    scan.next = &next;
+    scan.fn = fn;
+    scan.context = context;
+    atomic_init(&next, 0);
+    hashmap_partition(h, scan.count, scan.ranges);
+
+    threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    for (t = 1; t < nthreads; ++t) {
+        pthread_create(&threads[t], NULL, impl_scan, &scan);
+    }
+
+    impl_scan(&scan);
+
+    for (t = 1; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+    free(scan.ranges);
+}
+
+size_t hashmap_bucket_count(struct hashmap *h)
+{
+    if (h->swiss) {
+        return swiss_bucket_count(h->swiss);
+
+    } else if (h->dense) {
+        return dense_bucket_count(h->dense);
+
+    } else if (h->flat) {
+        return flat_bucket_count(h->flat);
+    }
+
+    return h->buckets;
+}
+
+size_t hashmap_bucket_size(struct hashmap *h, size_t bucket)
+{
+    if (!h) {
+        return 0;
+
+    } else if (h->swiss) {
+        return swiss_bucket_size(h->swiss, bucket);
+
+    } else if (h->dense) {
+        return dense_bucket_size(h->dense, bucket);
+
+    } else if (h->flat) {
+        return flat_bucket_size(h->flat, bucket);
+
+    } else if (bucket >= h->buckets) {
+        return 0;
+
+    } else {
+        struct hashmap_node *node;
+        size_t count = 0;
+
+        if (h->map[bucket].prev) {
+            for (node = h->map[bucket].prev->next; impl_in_run(h, node, &h->map[bucket]); node = node->next) {
+                count++;
+            }
+        }
+
+        return count;
+    }
+}
+
+size_t hashmap_bucket(const struct hashmap *h, const char *key)
+{
+    if (!h) {
+        return 0;
+
+    } else if (h->swiss) {
+        return swiss_bucket(h->swiss, hashof(h, key, strlen(key)), key, strlen(key));
+
+    } else if (h->dense) {
+        return dense_bucket(h->dense, hashof(h, key, strlen(key)), key, strlen(key));
+
+    } else if (h->flat) {
+        return flat_bucket(h->flat, hashof(h, key, strlen(key)));
+    }
+
+    return impl_reduce(h, hashof(h, key, strlen(key)), h->buckets);
+}
+
+/// Count a chain of @c length elements.
+static void impl_chain_length(size_t *counts, size_t length)
+{
+    counts[length < HASHMAP_STATS_CHAIN_LENGTHS ? length : HASHMAP_STATS_CHAIN_LENGTHS - 1]++;
+}
+
+void hashmap_stats(struct hashmap *h, struct hashmap_stats *out)
+{
+    struct bucket_head *bucket = NULL;
+    struct hashmap_node *node;
+    struct slab_chunk *chunk;
+    struct key_block *block;
+    size_t length = 0;
+    size_t runs = 0;
+    size_t i;
+
+    if (h->stats) {
+        *out = *h->stats;
+
+    } else {
+        memset(out, 0, sizeof(*out));
+    }
+
+    out->average_probe_length = out->lookups ? (double)out->probes / (double)out->lookups : 0;
+    out->allocated_bytes = sizeof(struct hashmap) + (h->stats ? sizeof(struct hashmap_stats) : 0);
+    memset(out->chain_lengths, 0, sizeof(out->chain_lengths));
+
+    if (h->swiss) {
+        out->allocated_bytes += swiss_allocated(h->swiss);
+        swiss_chain_lengths(h->swiss, out->chain_lengths, HASHMAP_STATS_CHAIN_LENGTHS);
+        return;
+
+    } else if (h->dense) {
+        out->allocated_bytes += dense_allocated(h->dense);
+        dense_chain_lengths(h->dense, out->chain_lengths, HASHMAP_STATS_CHAIN_LENGTHS);
+        return;
+
+    } else if (h->flat) {
+        out->allocated_bytes += flat_allocated(h->flat);
+        for (i = 0; i < flat_bucket_count(h->flat); ++i) {
+            impl_chain_length(out->chain_lengths, flat_bucket_size(h->flat, i));
+        }
+        return;
+    }
+
+    out->allocated_bytes += (h->buckets + (h->old_map ? h->old_buckets : 0)) * sizeof(struct bucket_head);
+
+    if (h->slab) {
+        for (chunk = h->chunks; chunk; chunk = chunk->next) {
+            out->allocated_bytes += chunk->size;
+        }
+
+    } else {
+        out->allocated_bytes += h->size * h->node_size;
+    }
+
+    for (block = h->key_blocks; block; block = block->next) {
+        out->allocated_bytes += block->size;
+    }
+
+    out->allocated_bytes += h->filter_blocks * FILTER_WORDS * sizeof(uint64_t);
+
+    /* Runs are contiguous, so one pass over the list measures every chain; buckets that start no run are empty. */
+    for (node = h->before_begin.next; node; node = node->next) {
+        if (impl_locate(h, node->hash) != bucket) {
+            if (bucket) {
+                impl_chain_length(out->chain_lengths, length);
+            }
+
+            bucket = impl_locate(h, node->hash);
+            length = 0;
+            runs++;
+        }
+
+        length++;
+
+        if (impl_key_on_heap(h, node)) {
+            out->allocated_bytes += node->length + 1;
+        }
+    }
+
+    if (bucket) {
+        impl_chain_length(out->chain_lengths, length);
+    }
+
+    out->chain_lengths[0] += h->buckets + (h->old_map ? h->old_buckets - h->rehash_index : 0) - runs;
+}
+
+float hashmap_load_factor(struct hashmap *h)
+{
+    if (!h) {
+        return 0;
+    }
+
+    return hashmap_size(h) / (float)hashmap_bucket_count(h);
+}
+
+float hashmap_max_load_factor(struct hashmap *h)
+{
+    return h->max_load_factor;
+}
+
+void hashmap_max_load_factor_set(struct hashmap *h, float z)
+{
+    if (h->flat) {
+        return;
+
+    } else if (z < 0.25f) {
+        z = 0.25f;
+    }
+
+    if (h->swiss) {
+        if (z > SWISS_MAX_LOAD_FACTOR) {
+            z = SWISS_MAX_LOAD_FACTOR;
+        }
+
+        h->max_load_factor = z;
+        h->min_load_factor = h->min_load_factor < z / 4 ? h->min_load_factor : z / 4;
+        swiss_max_load_factor_set(h->swiss, z);
+        return;
+
+    } else if (h->dense) {
+        if (z > DENSE_MAX_LOAD_FACTOR) {
+            z = DENSE_MAX_LOAD_FACTOR;
+        }
+
+        h->max_load_factor = z;
+        h->min_load_factor = h->min_load_factor < z / 4 ? h->min_load_factor : z / 4;
+        dense_max_load_factor_set(h->dense, z);
+        return;
+    }
+
+    h->max_load_factor = z;
+    h->min_load_factor = h->min_load_factor < z / 4 ? h->min_load_factor : z / 4;
+
+    hashmap_rehash(h, impl_bucket_count_calculate(h, hashmap_size(h)));
+}
+
+void hashmap_rehash(struct hashmap *h, size_t n)
+{
+    if (h->swiss) {
+        swiss_rehash(h->swiss, n);
+        return;
+
+    } else if (h->dense) {
+        dense_rehash(h->dense, n);
+        return;
+
+    } else if (h->flat) {
+        return;
+    }
+
+    hashmap_rehash_step(h, SIZE_MAX);
+
+    if (h->pow2) {
+        n = impl_bucket_count_ideal(h, n);
+    }
+
+    if (n > h->buckets) {
+        impl_rebucket(h, n);
+    }
+}
+
+void hashmap_shrink_to_fit(struct hashmap *h)
+{
+    impl_shrink(h, hashmap_size(h));
+}
+
+float hashmap_min_load_factor(struct hashmap *h)
+{
+    return h->min_load_factor;
+}
+
+void hashmap_min_load_factor_set(struct hashmap *h, float z)
+{
+    if (z > h->max_load_factor / 4) {
+        z = h->max_load_factor / 4;
+    }
+
+    h->min_load_factor = z > 0 ? z : 0;
+    impl_shrink_for(h);
+}
+
+void hashmap_reserve(struct hashmap *h, size_t elements)
+{
+    if (h->swiss) {
+        swiss_reserve(h->swiss, elements);
+
+    } else if (h->dense) {
+        dense_reserve(h->dense, elements);
+
+    } else if (h->map && elements > (size_t)(h->buckets * h->max_load_factor)) {
+        hashmap_rehash(h, impl_bucket_count_calculate(h, elements));
+    }
+}
+
+bool hashmap_rehash_step(struct hashmap *h, size_t budget)
+{
+    bool timed;
+    double start;
+
+    if (!h) {
+        return false;
+    }
+
+    timed = h->old_map && h->stats;
+    start = timed ? stats_now() : 0;
+
+    for (; h->old_map && budget; --budget) {
+        impl_migrate(h);
+    }
+
+    if (timed) {
+        h->stats->rehash_seconds += stats_now() - start;
+    }
+
+    return h->old_map != NULL;
 }
@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __has_attribute
 # define PUBLIC __attribute__ ((visibility("default")))
@@ -7,9 +8,107 @@
 # define PUBLIC /*NOTHING*/
 #endif
 
+/// Storage layout.
+enum hashmap_layout {
+    /// Separate chaining; nodes are linked into one list and never move (default).
+    HASHMAP_LAYOUT_CHAINED,
+    /// Open addressing with a control byte per slot, probed a group at a time (SSE2/NEON).
+    /// Hash, key and userdata are stored inline; growing the table moves them,
+    /// which invalidates iterators and userdata pointers.
+    HASHMAP_LAYOUT_SWISS,
+    /// Elements packed in one contiguous array, found through an open-addressing index of 32-bit positions
+    /// (Robin Hood probing), so a full scan reads memory in order. Erasing moves the last element into the hole,
+    /// so an iterator to the erased element then refers to the moved one and is not to be incremented;
+    /// growing moves every element. Both invalidate userdata pointers. Holds fewer than 2^32 elements.
+    HASHMAP_LAYOUT_DENSE
+};
+
+/// Bucket count policy of the chained layout.
+enum hashmap_sizing {
+    /// Prime bucket counts; the bucket is the hash modulo the count (default).
+    HASHMAP_SIZING_PRIME,
+    /// Power-of-two bucket counts; the bucket is the low bits of the hash, which avoids a division per lookup.
+    /// Explicit bucket counts are rounded up to a power of two.
+    HASHMAP_SIZING_POW2
+};
+
+/// Memory allocator.
+struct hashmap_allocator {
+    /// @return void* Block of at least @c size bytes, suitably aligned for any object.
+    void *(*alloc)(void *context, size_t size);
+    /// Release a block returned by @c alloc; @c size is the size that was requested.
+    void (*free)(void *context, void *ptr, size_t size);
+    void *context;
+};
+
+/// Hash function.
+struct hashmap_hasher {
+    /// @return size_t Hash of the @c len bytes at @c key; equal keys must have equal hashes.
+    size_t (*hash)(void *context, const void *key, size_t len);
+    void *context;
+};
+
+/// Receives the elements that a map bounded by the @c capacity option evicts.
+struct hashmap_evictor {
+    /// Called with the key and userdata of each evicted element just before it is released;
+    /// it must not modify the map.
+    void (*evict)(void *context, const char *key, size_t len, void *userdata);
+    void *context;
+};
+
+/// Construction options.
+/// @discussion Zero-initialised options give the same map as @c hashmap_new.
+struct hashmap_options {
+    enum hashmap_layout layout;
+    /// Spread growth of a chained map over later operations instead of rehashing at once.
+    /// The old and new bucket arrays coexist while each insert, and each erase by key, moves a few buckets,
+    /// so no single insert pays for the whole table. Moving a bucket reorders the elements, so a loop over
+    /// the map may skip or repeat elements if it inserts or erases by key; finding, and erasing at an
+    /// iterator, leave the order alone.
+    bool incremental_rehash;
+    /// Allocator for element storage (chained nodes, swiss slot arrays, dense arrays) and for the keys stored
+    /// outside them; NULL selects malloc and free. The chained bucket array and filter use malloc. The allocator is copied.
+    const struct hashmap_allocator *allocator;
+    /// Carve chained nodes from large chunks and reuse erased nodes through a per-map free list.
+    /// Clearing or deleting the map then releases a few chunks instead of every node.
+    bool slab;
+    /// Bytes reserved in each chained node or dense entry for the key, including its terminator; the same slot
+    /// holds a pointer to a longer key. Keys that fit are stored in place instead of being duplicated on the heap.
+    size_t inline_key_size;
+    /// Copy longer keys of a chained map into large append-only blocks instead of duplicating each one.
+    /// Erasing does not reclaim key storage; clearing or deleting the map releases it all.
+    /// Suits maps that are built once and read many times.
+    bool key_arena;
+    /// Hash function, for example to use a hash already embedded in structured keys;
+    /// NULL selects the built-in 64-bit hash. The hasher is copied.
+    const struct hashmap_hasher *hasher;
+    enum hashmap_sizing sizing;
+    /// Count lookups, probes and rehashes for @c hashmap_stats, at the cost of a few increments per lookup.
+    bool stats;
+    /// Keep a blocked Bloom filter of the hashes in front of a chained map, so that most lookups of absent keys
+    /// read one cache line instead of a bucket and its chain; it costs two to four bytes per element. Other layouts ignore it.
+    bool filter;
+    /// Bound a chained map, for use as a cache, to this many elements; zero leaves it unbounded.
+    /// Inserting a new key into a full map evicts an element chosen by CLOCK: a hand sweeps the elements,
+    /// sparing once each one found since it last passed, so a hit only sets a flag in its node.
+    /// Other layouts, and the concurrent and RCU maps, ignore it.
+    size_t capacity;
+    /// Receives evicted elements; NULL evicts them silently. The evictor is copied.
+    const struct hashmap_evictor *evictor;
+    /// Seed of the built-in hash. Zero draws a random seed for each map, so that the author of the keys
+    /// cannot foresee which keys collide; a chained map with a random seed also draws a new one and rehashes
+    /// if an insert meets a chain far longer than the load factor allows, at most once each time the map
+    /// doubles in size, so that rehashing stays amortised constant per insert. Any other seed is kept,
+    /// so maps created with it hash alike from run to run.
+    uint64_t seed;
+};
+
 /// Constructor.
 struct hashmap *hashmap_new(size_t element_size) PUBLIC;
 
+/// Constructor with options.
+struct hashmap *hashmap_new_with(size_t element_size, const struct hashmap_options *options) PUBLIC;
+
 /// Destructor.
 void hashmap_delete(struct hashmap *h) PUBLIC;
 
@@ -32,17 +131,36 @@ struct hashmap_iter *hashmap_end(struct hashmap *h) PUBLIC;
 struct hashmap_iter *hashmap_iter_inc(struct hashmap_iter *iter) PUBLIC;
 
 struct hashmap_pair {
+    /// Key, always followed by a terminating NUL.
     const char *key;
     void *userdata;
+    /// Length of key in bytes, excluding the terminator.
+    size_t length;
 };
 
 /// Dereference iterator.
 /// @return void* Pointer to element at iterator position.
 struct hashmap_pair hashmap_iter_deref(struct hashmap_iter *iter) PUBLIC;
 
+/// @return size_t Hash of @c key, as used by this map.
+/// @discussion Pass it to the @c _with_hash functions to hash a key once for several operations,
+/// or to route keys by hash before they reach the map. A map that reseeds itself (see
+/// @c hashmap_options.seed) invalidates hashes from before; give a seed to keep them valid.
+size_t hashmap_hash(const struct hashmap *h, const char *key) PUBLIC;
+
+/// @return size_t Hash of a key of @c len bytes, as used by this map.
+size_t hashmap_hash_n(const struct hashmap *h, const void *key, size_t len) PUBLIC;
+
 /// Find element with specific key.
 struct hashmap_iter *hashmap_find(struct hashmap *h, const char *key) PUBLIC;
 
+/// Find element with a key of @c len bytes, which need not be NUL-terminated and may contain NUL.
+struct hashmap_iter *hashmap_find_n(struct hashmap *h, const void *key, size_t len) PUBLIC;
+
+/// Find element with specific key, whose hash is already known.
+/// @param hash Must be @c hashmap_hash(h, key).
+struct hashmap_iter *hashmap_find_with_hash(struct hashmap *h, const char *key, size_t hash) PUBLIC;
+
 struct hashmap_insert_ret {
     bool ok;
     struct hashmap_pair pair;
@@ -51,13 +169,118 @@ struct hashmap_insert_ret {
 /// Insert element.
 struct hashmap_insert_ret hashmap_insert(struct hashmap *h, const char *key) PUBLIC;
 
+/// Insert element with a key of @c len bytes.
+/// @discussion The stored copy is NUL-terminated, so @c pair.key remains usable as a string.
+struct hashmap_insert_ret hashmap_insert_n(struct hashmap *h, const void *key, size_t len) PUBLIC;
+
+/// Insert element whose hash is already known.
+/// @param hash Must be @c hashmap_hash(h, key).
+struct hashmap_insert_ret hashmap_insert_with_hash(struct hashmap *h, const char *key, size_t hash) PUBLIC;
+
+/// Insert element, handing over a key allocated with @c malloc instead of having it copied.
+/// @discussion The map owns @c key from then on: it keeps it as the stored key, or frees it if the key exists
+/// already. Keys that fit inline, that go to the key arena, or that a map with its own allocator stores,
+/// are copied there and freed at once.
+struct hashmap_insert_ret hashmap_insert_take(struct hashmap *h, char *key) PUBLIC;
+
+/// Insert element if it does not exist, initialising its userdata in place.
+/// @discussion @c init is called only on a miss, with the userdata of the new element, before this returns;
+/// on a hit the existing element is returned untouched.
+struct hashmap_insert_ret hashmap_try_emplace(struct hashmap *h, const char *key, void (*init)(void *context, void *userdata), void *context) PUBLIC;
+
 /// Erase element.
 void hashmap_erase(struct hashmap *h, struct hashmap_iter *iter) PUBLIC;
 
+/// Erase element with a key of @c len bytes.
+/// @return bool True if an element was erased.
+bool hashmap_erase_n(struct hashmap *h, const void *key, size_t len) PUBLIC;
+
+/// Erase element with specific key, whose hash is already known.
+/// @param hash Must be @c hashmap_hash(h, key).
+/// @return bool True if an element was erased.
+bool hashmap_erase_with_hash(struct hashmap *h, const char *key, size_t hash) PUBLIC;
+
+/// Erase element with specific key.
+/// @return bool True if an element was erased.
+bool hashmap_erase_key(struct hashmap *h, const char *key) PUBLIC;
+
+/// Erase element with specific key, keeping a copy of its userdata.
+/// @discussion The element is found and unlinked in one probe.
+/// @param out Receives a copy of the userdata of the element, if one was erased and @c out is not NULL.
+/// @return bool True if an element was erased.
+bool hashmap_extract(struct hashmap *h, const char *key, void *out) PUBLIC;
+
+/// Erase element with a key of @c len bytes, keeping a copy of its userdata.
+/// @param out Receives a copy of the userdata of the element, if one was erased and @c out is not NULL.
+/// @return bool True if an element was erased.
+bool hashmap_extract_n(struct hashmap *h, const void *key, size_t len, void *out) PUBLIC;
+
+/// Erase every element for which @c pred returns true.
+/// @discussion One pass over the elements, each erased without a lookup; @c pred must not use the map.
+/// A minimum load factor shrinks the table at most once, after the pass.
+/// Read-only maps erase nothing and do not call @c pred.
+/// @return size_t Number of elements erased.
+size_t hashmap_erase_if(struct hashmap *h, bool (*pred)(void *context, struct hashmap_pair pair), void *context) PUBLIC;
+
 /// Clears the contents of the map.
 void hashmap_clear(struct hashmap *h) PUBLIC;
 
-/// @return size_t Number of buckets.
+/// Find many elements at once.
+/// @param iters Receives, for each key, an iterator to its element or the end.
+/// @discussion All keys of a batch are hashed and their buckets prefetched before any is resolved,
+/// so the cache misses of different keys overlap instead of following one another.
+void hashmap_find_batch(struct hashmap *h, const char *const *keys, size_t n, struct hashmap_iter **iters) PUBLIC;
+
+/// Insert many elements at once, prefetching like @c hashmap_find_batch.
+/// @param rets Receives, for each key, the result @c hashmap_insert would give.
+/// @discussion With the swiss and dense layouts a later insert may move the elements of an earlier one.
+/// A map bounded by the @c capacity option evicts none of the elements of the batch until it ends, and may
+/// exceed its capacity meanwhile; it then evicts down to the capacity. Only if the batch returns more elements
+/// than the capacity may that evict some of them, whose results then point at freed memory.
+void hashmap_insert_batch(struct hashmap *h, const char *const *keys, size_t n, struct hashmap_insert_ret *rets) PUBLIC;
+
+/// Erase many elements at once, prefetching like @c hashmap_find_batch.
+/// @return size_t Number of elements erased.
+size_t hashmap_erase_batch(struct hashmap *h, const char *const *keys, size_t n) PUBLIC;
+
+/// Insert many elements, using several threads.
+/// @discussion The table is sized once, then keys are hashed and their nodes prepared in parallel,
+/// grouped by bucket, and linked in one pass. Userdata of the new elements is uninitialised.
+/// The swiss and dense layouts insert in the calling thread after one reserve.
+/// @param nthreads Number of threads to use, including the calling thread.
+/// @return size_t Number of elements inserted; duplicate keys are skipped. A map bounded by the @c capacity
+/// option then evicts down to its capacity, and may evict new elements, whose userdata is uninitialised.
+size_t hashmap_build(struct hashmap *h, const char *const *keys, size_t n, size_t nthreads) PUBLIC;
+
+/// Part of a map, to be iterated independently of the other parts, for example by another thread.
+struct hashmap_range {
+    struct hashmap *map;
+    /// Positions covered, from @c first up to but excluding @c last:
+    /// buckets (chained), slots (swiss) or elements (dense and read-only).
+    size_t first;
+    size_t last;
+};
+
+/// Split the map on bucket boundaries into @c k disjoint ranges of about equal size, which together hold every element.
+/// @discussion Finishes any pending rehash. The map must not change while its ranges are iterated;
+/// userdata may be written, each element by one thread.
+void hashmap_partition(struct hashmap *h, size_t k, struct hashmap_range *ranges) PUBLIC;
+
+/// @return Iterator Returns an iterator to the first element of the range, or to the end of the map.
+struct hashmap_iter *hashmap_range_begin(const struct hashmap_range *r) PUBLIC;
+
+/// Increment iterator position within the range.
+/// @return Iterator Returns an iterator to the next element of the range, or to the end of the map.
+struct hashmap_iter *hashmap_range_inc(const struct hashmap_range *r, struct hashmap_iter *iter) PUBLIC;
+
+/// Call @c fn for every element, using several threads.
+/// @discussion The map is partitioned into more ranges than threads, which take the next unscanned range
+/// as they finish, so that a crowded range does not hold the others up. @c fn is called concurrently
+/// and must not change the map; it may write the userdata of the element it is given.
+/// @param nthreads Number of threads to use, including the calling thread.
+void hashmap_for_each_parallel(struct hashmap *h, void (*fn)(void *context, struct hashmap_pair pair), void *context, size_t nthreads) PUBLIC;
+
+/// @return size_t Number of buckets (slots for the swiss layout, index buckets for the dense layout).
 size_t hashmap_bucket_count(struct hashmap *h) PUBLIC;
 
 /// @return size_t The number of elements in the bucket @c n.
@@ -73,11 +296,224 @@ float hashmap_load_factor(struct hashmap *h) PUBLIC;
 float hashmap_max_load_factor(struct hashmap *h) PUBLIC;
 
 /// Set maximum load factor.
+/// @discussion The swiss and dense layouts cap the maximum load factor at 0.875.
 void hashmap_max_load_factor_set(struct hashmap *h, float z) PUBLIC;
 
+/// @return float Minimum load factor; zero, the default, never shrinks the table.
+float hashmap_min_load_factor(struct hashmap *h) PUBLIC;
+
+/// Set minimum load factor.
+/// @discussion An erase or clear that leaves the load factor below the minimum shrinks the table until the
+/// load factor is about half the maximum, so the size must halve again before the next shrink.
+/// The minimum is capped at a quarter of the maximum load factor, so that shrinking and growing never alternate.
+/// Shrinking rehashes at once: it reorders a chained map and moves the elements of a swiss or dense map.
+void hashmap_min_load_factor_set(struct hashmap *h, float z) PUBLIC;
+
+/// Shrink the table to the fewest buckets that respect the maximum load factor.
+void hashmap_shrink_to_fit(struct hashmap *h) PUBLIC;
+
 /// Rehash
-/// @param n Number of buckets.
+/// @param n Number of buckets; a smaller number than now leaves the table as it is.
 void hashmap_rehash(struct hashmap *h, size_t n) PUBLIC;
 
 /// Request a capacity change.
 void hashmap_reserve(struct hashmap *h, size_t elements) PUBLIC;
+
+/// Advance a pending incremental rehash.
+/// @param budget Maximum number of old buckets to migrate.
+/// @return bool True if the rehash is still in progress.
+/// @discussion Bucket functions describe the new table, so finish the rehash before inspecting buckets.
+bool hashmap_rehash_step(struct hashmap *h, size_t budget) PUBLIC;
+
+/// Chain lengths counted separately by @c hashmap_stats; longer chains share the last count.
+#define HASHMAP_STATS_CHAIN_LENGTHS 16
+
+/// Runtime statistics.
+/// @discussion The counters from @c lookups to @c evictions are zero unless the map was created
+/// with the @c stats option; the others describe the table as it is.
+struct hashmap_stats {
+    /// Key searches by find, insert and erase, including batches.
+    size_t lookups;
+    size_t hits;
+    size_t misses;
+    /// Lookups that the filter answered without reading a chain; they also count as misses.
+    size_t filtered;
+    /// Probes of all lookups: nodes compared (chained), groups scanned (swiss), index buckets read (dense)
+    /// or entries compared (read-only).
+    size_t probes;
+    double average_probe_length;
+    size_t max_probe_length;
+    /// Rehashes, including growth, shrinking and swiss cleanups, and the time they took;
+    /// an incremental rehash counts once and adds the time of each step.
+    size_t rehashes;
+    double rehash_seconds;
+    /// Inserts that met a flooded chain and drew a new seed; each also counts as a rehash.
+    size_t reseeds;
+    /// Elements evicted from a map bounded by the @c capacity option.
+    size_t evictions;
+    /// Bytes of table, elements and keys held by the map.
+    size_t allocated_bytes;
+    /// Entry @c i counts the buckets holding @c i elements (chained and read-only),
+    /// or the elements that lie @c i groups past the first group their lookup scans (swiss)
+    /// or @c i buckets past their home bucket (dense).
+    size_t chain_lengths[HASHMAP_STATS_CHAIN_LENGTHS];
+};
+
+/// Collect runtime statistics.
+/// @discussion The counters are read as they are; the byte count and histogram take a pass over the map.
+void hashmap_stats(struct hashmap *h, struct hashmap_stats *out) PUBLIC;
+
+/// Convert the map into a read-only map with a minimal perfect hash, for key sets that no longer change.
+/// @discussion Every element moves into a flat array with exactly one slot per element, and each lookup
+/// probes a single slot. Userdata is copied and may still be written; earlier iterators and userdata pointers
+/// become invalid. Insert only reports an existing element; erase, clear and rehash do nothing.
+/// @return bool False, leaving the map unchanged, if two keys have equal hashes and cannot be separated.
+bool hashmap_freeze(struct hashmap *h) PUBLIC;
+
+/// Write the map to a file that @c hashmap_open maps back.
+/// @discussion The file holds the buckets, hashes, keys and userdata, with offsets in place of pointers.
+/// Userdata is copied byte for byte, so it must not hold pointers. The byte order is that of the machine.
+/// @return int Zero on success, otherwise a negative errno.
+int hashmap_save(struct hashmap *h, const char *path) PUBLIC;
+
+/// Map a file written by @c hashmap_save as a read-only map; a frozen map stays perfectly hashed.
+/// @discussion Nothing is deserialised: find and iteration read the mapped pages, and userdata must not be written.
+/// Insert only reports an existing element; erase, clear and rehash do nothing. Opening reads the index and every
+/// entry once to check that their offsets stay inside the file, so a truncated or damaged file is refused; hashes
+/// and userdata are not checked, and a wrong hash only makes its element unreachable.
+/// @param options Options whose hasher matches that of the saved map, or NULL; other options are ignored.
+/// @return NULL on error, with errno set.
+struct hashmap *hashmap_open(const char *path, const struct hashmap_options *options) PUBLIC;
+
+/// Map shared between threads, made of independently locked shards.
+/// @discussion Keys are spread over the shards by the high bits of their hash, and each shard is
+/// an ordinary map behind a reader/writer lock. Iterators and userdata pointers are not safe
+/// across threads, so elements are copied in and out instead.
+struct hashmap_concurrent;
+
+/// Constructor.
+/// @param shards Number of shards, rounded up to a power of two.
+/// @param options Options for every shard, or NULL; incremental rehashing, stats and capacity are not supported
+/// and are ignored, since finds run concurrently under a read lock.
+/// The shards share one seed, random unless given, and never reseed. They also share the allocator, which need
+/// not be thread-safe: the map serialises calls to it, so a thread-safe allocator does better without one.
+struct hashmap_concurrent *hashmap_concurrent_new(size_t element_size, size_t shards, const struct hashmap_options *options) PUBLIC;
+
+/// Destructor; no other thread may be using the map.
+void hashmap_concurrent_delete(struct hashmap_concurrent *c) PUBLIC;
+
+/// @return size_t The number of elements in the map; other threads may change it at any time.
+size_t hashmap_concurrent_size(struct hashmap_concurrent *c) PUBLIC;
+
+/// Find element with specific key and copy it.
+/// @param out Receives a copy of the element, if found and not NULL.
+/// @return bool True if the element was found.
+bool hashmap_concurrent_find(struct hashmap_concurrent *c, const char *key, void *out) PUBLIC;
+
+/// Insert element, or overwrite it if it already exists.
+/// @param value Element to copy into the map.
+/// @return bool True if the element was inserted.
+bool hashmap_concurrent_upsert(struct hashmap_concurrent *c, const char *key, const void *value) PUBLIC;
+
+/// Insert element if it does not exist, then call @c update on it while its shard is locked.
+/// @discussion @c update receives the userdata, which is uninitialised if @c inserted is true.
+/// It must not use the map.
+/// @return bool True if the element was inserted.
+bool hashmap_concurrent_update(struct hashmap_concurrent *c, const char *key, void (*update)(void *context, void *userdata, bool inserted), void *context) PUBLIC;
+
+/// Erase element with specific key.
+/// @return bool True if an element was erased.
+bool hashmap_concurrent_erase(struct hashmap_concurrent *c, const char *key) PUBLIC;
+
+/// Read-mostly map with wait-free readers.
+/// @discussion Readers find and iterate an immutable version of the map without taking locks.
+/// Writers change a private copy and publish it atomically; the old version is freed once every
+/// reader that could still see it has left its read-side section (epoch-based reclamation).
+/// Each write copies the map, so batch changes into one write section.
+struct hashmap_rcu;
+
+/// Registered reader; each thread that reads uses its own.
+struct hashmap_rcu_reader;
+
+/// Constructor.
+/// @param options Options for every version, or NULL; incremental rehashing, stats and capacity are not supported
+/// and are ignored, since readers must not write to a published version. The allocator, hasher and evictor are copied.
+struct hashmap_rcu *hashmap_rcu_new(size_t element_size, const struct hashmap_options *options) PUBLIC;
+
+/// Destructor; every reader must have left.
+void hashmap_rcu_delete(struct hashmap_rcu *m) PUBLIC;
+
+/// Register a reader.
+struct hashmap_rcu_reader *hashmap_rcu_join(struct hashmap_rcu *m) PUBLIC;
+
+/// Unregister a reader, which must not be in a read-side section.
+void hashmap_rcu_leave(struct hashmap_rcu_reader *r) PUBLIC;
+
+/// Enter a read-side section.
+/// @return The current version, which may be searched and iterated, but not modified, until @c hashmap_rcu_read_unlock.
+struct hashmap *hashmap_rcu_read_lock(struct hashmap_rcu_reader *r) PUBLIC;
+
+/// Leave a read-side section; iterators and userdata of the version become invalid.
+void hashmap_rcu_read_unlock(struct hashmap_rcu_reader *r) PUBLIC;
+
+/// Enter the write section, excluding other writers.
+/// @return A private copy of the current version, to be modified freely.
+struct hashmap *hashmap_rcu_write_lock(struct hashmap_rcu *m) PUBLIC;
+
+/// Publish the copy and leave the write section.
+/// @discussion Waits until no reader can still see the previous version, then frees it.
+void hashmap_rcu_write_unlock(struct hashmap_rcu *m) PUBLIC;
+
+/// Map from 64-bit integers, for keys that would otherwise be formatted as strings.
+/// @discussion Keys are stored inline next to their userdata, found by linear probing from a multiplicative mix
+/// of the key, and an occupancy bitmap marks the full slots, so no key is allocated or compared as a string.
+/// Inserting may move every element and erasing may move others; positions and userdata pointers are valid
+/// until the next insert or erase. The mix is fixed, so keys chosen by an adversary can collide.
+struct hashmap_u64;
+
+struct hashmap_u64_pair {
+    uint64_t key;
+    void *userdata;
+};
+
+struct hashmap_u64_insert_ret {
+    bool ok;
+    struct hashmap_u64_pair pair;
+};
+
+/// Constructor.
+struct hashmap_u64 *hashmap_u64_new(size_t element_size) PUBLIC;
+
+/// Destructor.
+void hashmap_u64_delete(struct hashmap_u64 *h) PUBLIC;
+
+/// @return size_t The number of elements in the map.
+size_t hashmap_u64_size(const struct hashmap_u64 *h) PUBLIC;
+
+/// @return void* Userdata of the element with @c key, or NULL.
+void *hashmap_u64_find(const struct hashmap_u64 *h, uint64_t key) PUBLIC;
+
+/// Insert element; the userdata of a new element is uninitialised.
+struct hashmap_u64_insert_ret hashmap_u64_insert(struct hashmap_u64 *h, uint64_t key) PUBLIC;
+
+/// Erase element with specific key.
+/// @return bool True if an element was erased.
+bool hashmap_u64_erase(struct hashmap_u64 *h, uint64_t key) PUBLIC;
+
+/// Clears the contents of the map.
+void hashmap_u64_clear(struct hashmap_u64 *h) PUBLIC;
+
+/// Request a capacity change.
+void hashmap_u64_reserve(struct hashmap_u64 *h, size_t elements) PUBLIC;
+
+/// @return size_t Position of the first element, or @c hashmap_u64_end.
+size_t hashmap_u64_begin(const struct hashmap_u64 *h) PUBLIC;
+
+/// @return size_t Position past the last slot.
+size_t hashmap_u64_end(const struct hashmap_u64 *h) PUBLIC;
+
+/// @return size_t Position of the element after @c pos, or @c hashmap_u64_end.
+size_t hashmap_u64_inc(const struct hashmap_u64 *h, size_t pos) PUBLIC;
+
+/// @return Element at position @c pos, which is not the end.
+struct hashmap_u64_pair hashmap_u64_deref(struct hashmap_u64 *h, size_t pos) PUBLIC;
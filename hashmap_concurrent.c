@@ -0,0 +1,371 @@
+#include "hashmap.h"
+#include "hashmap_seed.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each shard has a cache line to itself, so that locking one does not disturb its neighbours. */
+#define CACHE_LINE 64
+
+struct shard {
+    pthread_rwlock_t lock;
+    struct hashmap *map;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+struct hashmap_concurrent {
+    size_t element_size;
+    size_t count;
+    /* Number of high hash bits that select the shard. */
+    unsigned bits;
+    struct shard *shards;
+    /* A caller's allocator need not be thread-safe: writers to different shards take turns with it. */
+    pthread_mutex_t allocator_lock;
+    struct hashmap_allocator allocator;
+    struct hashmap_allocator locked;
+};
+
+static void *impl_locked_alloc(void *context, size_t size)
+{
+    struct hashmap_concurrent *c = (struct hashmap_concurrent *)context;
+    void *p;
+
+    pthread_mutex_lock(&c->allocator_lock);
+    p = c->allocator.alloc(c->allocator.context, size);
+    pthread_mutex_unlock(&c->allocator_lock);
+    return p;
+}
+
+static void impl_locked_free(void *context, void *ptr, size_t size)
+{
+    struct hashmap_concurrent *c = (struct hashmap_concurrent *)context;
+
+    pthread_mutex_lock(&c->allocator_lock);
+    c->allocator.free(c->allocator.context, ptr, size);
+    pthread_mutex_unlock(&c->allocator_lock);
+}
+
+/// @return Shard that holds keys with @c hash.
+static struct shard *impl_shard(struct hashmap_concurrent *c, size_t hash)
+{
+    if (c->bits == 0) {
+        return c->shards;
+    }
+
+    return &c->shards[hash >> (sizeof(size_t) * CHAR_BIT - c->bits)];
+}
+
+/// @return size_t Hash of @c key; every shard hashes alike, and the hasher never changes.
+static size_t impl_hash(struct hashmap_concurrent *c, const char *key)
+{
+    return hashmap_hash(c->shards[0].map, key);
+}
+
+struct hashmap_concurrent *hashmap_concurrent_new(size_t element_size, size_t shards, const struct hashmap_options *options)
+{
+    struct hashmap_concurrent *c = (struct hashmap_concurrent *)malloc(sizeof(struct hashmap_concurrent));
+    struct hashmap_options o = { .layout = HASHMAP_LAYOUT_CHAINED };
+    size_t i;
+
+    if (options) {
+        o = *options;
+    }
+
+    /* Finding would bump the counters or mark a hit for eviction, which must not happen under a read lock.
+     * Incremental rehashing stays off, so that lookups under a read lock probe a single table. */
+    o.incremental_rehash = false;
+    o.stats = false;
+    o.capacity = 0;
+
+    /* One seed for every shard: a shard that reseeded itself would no longer hash like shard 0. */
+    if (!o.seed) {
+        o.seed = seed_random();
+    }
+
+    pthread_mutex_init(&c->allocator_lock, NULL);
+
+    if (o.allocator) {
+        c->allocator = *o.allocator;
+        c->locked.alloc = impl_locked_alloc;
+        c->locked.free = impl_locked_free;
+        c->locked.context = c;
+        o.allocator = &c->locked;
+    }
+
+    c->element_size = element_size;
+    c->count = 1;
+    c->bits = 0;
+
+    while (c->count < shards) {
+        c->count <<= 1;
+        c->bits++;
+    }
+
+    c->shards = (struct shard *)aligned_alloc(CACHE_LINE, c->count * sizeof(struct shard));
+
+    for (i = 0; i < c->count; ++i) {
+        pthread_rwlock_init(&c->shards[i].lock, NULL);
+        c->shards[i].map = hashmap_new_with(element_size, &o);
+    }
+
+    return c;
+}
+
+void hashmap_concurrent_delete(struct hashmap_concurrent *c)
+{
+    size_t i;
+
+    if (!c) {
+        return;
+    }
+
+    for (i = 0; i < c->count; ++i) {
+        hashmap_delete(c->shards[i].map);
+        pthread_rwlock_destroy(&c->shards[i].lock);
+    }
+
+    pthread_mutex_destroy(&c->allocator_lock);
+    free(c->shards);
+    free(c);
+}
+
+size_t hashmap_concurrent_size(struct hashmap_concurrent *c)
+{
+    size_t size = 0;
+    size_t i;
+
+    for (i = 0; i < c->count; ++i) {
+        pthread_rwlock_rdlock(&c->shards[i].lock);
+        size += hashmap_size(c->shards[i].map);
+        pthread_rwlock_unlock(&c->shards[i].lock);
+    }
+
+    return size;
+}
+
+bool hashmap_concurrent_find(struct hashmap_concurrent *c, const char *key, void *out)
+{
+    size_t hash = impl_hash(c, key);
+    struct shard *shard = impl_shard(c, hash);
+    struct hashmap_iter *iter;
+    bool found;
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    iter = hashmap_find_with_hash(shard->map, key, hash);
+    found = iter != hashmap_end(shard->map);
+
+    if (found && out) {
+        memcpy(out, hashmap_iter_deref(iter).userdata, c->element_size);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    return found;
+}
+
+bool hashmap_concurrent_upsert(struct hashmap_concurrent *c, const char *key, const void *value)
+{
+    size_t hash = impl_hash(c, key);
+    struct shard *shard = impl_shard(c, hash);
+    struct hashmap_insert_ret ret;
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    ret = hashmap_insert_with_hash(shard->map, key, hash);
+    memcpy(ret.pair.userdata, value, c->element_size);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    return ret.ok;
+}
+
+bool hashmap_concurrent_update(struct hashmap_concurrent *c, const char *key, void (*update)(void *context, void *userdata, bool inserted), void *context)
+{
+    size_t hash = impl_hash(c, key);
+    struct shard *shard = impl_shard(c, hash);
+    struct hashmap_insert_ret ret;
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    ret = hashmap_insert_with_hash(shard->map, key, hash);
+    update(context, ret.pair.userdata, ret.ok);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    return ret.ok;
+}
+
+bool hashmap_concurrent_erase(struct hashmap_concurrent *c, const char *key)
+{
+    size_t hash = impl_hash(c, key);
+    struct shard *shard = impl_shard(c, hash);
+    bool erased;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    erased = hashmap_erase_with_hash(shard->map, key, hash);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return erased;
+}
+
+/* Reader of a read-mostly map, on its own cache line.
+ * @c epoch is the global epoch seen on entering a read-side section, or 0 outside one. */
+struct hashmap_rcu_reader {
+    _Atomic uint64_t epoch;
+    struct hashmap_rcu *m;
+    struct hashmap_rcu_reader *next;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+struct hashmap_rcu {
+    _Atomic(struct hashmap *) current;
+    _Atomic uint64_t epoch;
+    /* Serialises writers, and changes to the reader list. */
+    pthread_mutex_t lock;
+    struct hashmap_rcu_reader *readers;
+    struct hashmap *draft;
+    size_t element_size;
+    /* Options for each new version; they point at the copies below, not at the caller's structures. */
+    struct hashmap_options options;
+    struct hashmap_allocator allocator;
+    struct hashmap_hasher hasher;
+    struct hashmap_evictor evictor;
+};
+
+struct hashmap_rcu *hashmap_rcu_new(size_t element_size, const struct hashmap_options *options)
+{
+    struct hashmap_rcu *m = (struct hashmap_rcu *)malloc(sizeof(struct hashmap_rcu));
+    struct hashmap_options o = { .layout = HASHMAP_LAYOUT_CHAINED };
+
+    if (options) {
+        o = *options;
+    }
+
+    /* Finding would bump the counters or mark a hit for eviction, which would modify a published version.
+     * Each version is built whole by its writer, so there is no growth to spread. */
+    o.incremental_rehash = false;
+    o.stats = false;
+    o.capacity = 0;
+
+    if (o.allocator) {
+        m->allocator = *o.allocator;
+        o.allocator = &m->allocator;
+    }
+
+    if (o.hasher) {
+        m->hasher = *o.hasher;
+        o.hasher = &m->hasher;
+    }
+
+    if (o.evictor) {
+        m->evictor = *o.evictor;
+        o.evictor = &m->evictor;
+    }
+
+    m->element_size = element_size;
+    m->options = o;
+    m->readers = NULL;
+    m->draft = NULL;
+    pthread_mutex_init(&m->lock, NULL);
+    atomic_init(&m->epoch, 1);
+    atomic_init(&m->current, hashmap_new_with(element_size, &m->options));
+    return m;
+}
+
+void hashmap_rcu_delete(struct hashmap_rcu *m)
+{
+    if (!m) {
+        return;
+    }
+
+    hashmap_delete(atomic_load(&m->current));
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
+struct hashmap_rcu_reader *hashmap_rcu_join(struct hashmap_rcu *m)
+{
+    struct hashmap_rcu_reader *r = (struct hashmap_rcu_reader *)aligned_alloc(CACHE_LINE, sizeof(struct hashmap_rcu_reader));
+
+    atomic_init(&r->epoch, 0);
+    r->m = m;
+
+    pthread_mutex_lock(&m->lock);
+    r->next = m->readers;
+    m->readers = r;
+    pthread_mutex_unlock(&m->lock);
+
+    return r;
+}
+
+void hashmap_rcu_leave(struct hashmap_rcu_reader *r)
+{
+    struct hashmap_rcu *m = r->m;
+    struct hashmap_rcu_reader **p;
+
+    pthread_mutex_lock(&m->lock);
+    for (p = &m->readers; *p != r; p = &(*p)->next) {
+    }
+    *p = r->next;
+    pthread_mutex_unlock(&m->lock);
+
+    free(r);
+}
+
+struct hashmap *hashmap_rcu_read_lock(struct hashmap_rcu_reader *r)
+{
+    /* Announce the epoch before loading the version: a writer that then misses the announcement
+     * published its version before this load, so the reader sees the new one. */
+    atomic_store(&r->epoch, atomic_load(&r->m->epoch));
+    return atomic_load(&r->m->current);
+}
+
+void hashmap_rcu_read_unlock(struct hashmap_rcu_reader *r)
+{
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+struct hashmap *hashmap_rcu_write_lock(struct hashmap_rcu *m)
+{
+    struct hashmap *current;
+    struct hashmap_iter *iter;
+
+    pthread_mutex_lock(&m->lock);
+
+    current = atomic_load(&m->current);
+    m->draft = hashmap_new_with(m->element_size, &m->options);
+    hashmap_reserve(m->draft, hashmap_size(current));
+
+    for (iter = hashmap_begin(current); iter != hashmap_end(current); iter = hashmap_iter_inc(iter)) {
+        struct hashmap_pair pair = hashmap_iter_deref(iter);
+        struct hashmap_insert_ret ret = hashmap_insert_n(m->draft, pair.key, pair.length);
+
+        memcpy(ret.pair.userdata, pair.userdata, m->element_size);
+    }
+
+    return m->draft;
+}
+
+void hashmap_rcu_write_unlock(struct hashmap_rcu *m)
+{
+    struct hashmap *old = atomic_exchange(&m->current, m->draft);
+    uint64_t epoch = atomic_fetch_add(&m->epoch, 1) + 1;
+    struct hashmap_rcu_reader *r;
+
+    /* Readers that entered before the new epoch may still hold the old version. */
+    for (r = m->readers; r; r = r->next) {
+        uint64_t seen;
+
+        while ((seen = atomic_load(&r->epoch)) != 0 && seen < epoch) {
+            sched_yield();
+        }
+    }
+
+    hashmap_delete(old);
+    m->draft = NULL;
+    pthread_mutex_unlock(&m->lock);
+}
@@ -0,0 +1,541 @@
+#include "hashmap.h"
+#include "hashmap_dense.h"
+#include "hashmap_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Entries are packed at the front of one vector, in no particular order, and a scan walks them back to back.
+ * The index is a power-of-two array of buckets, with Robin Hood linear probing: each occupied bucket holds
+ * the position of an entry, its distance from its home bucket plus one, and 8 bits of its hash. */
+#define MIN_BUCKETS 16
+
+#define DIST_INC ((uint32_t)1 << 8)
+
+/* The key slot at the end of an entry holds a key shorter than the inline key size, ending with the entry,
+ * or else a pointer to the key; the top bit of the length tells which. Inline keys move with their entry. */
+struct dense_entry {
+    uint32_t hash;
+    uint32_t stride;
+    size_t length;
+    void *userdata;
+};
+
+#define KEY_INLINE ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+struct dense_bucket {
+    /* Distance in the high 24 bits, fingerprint in the low 8; zero if the bucket is empty. */
+    uint32_t dist_fp;
+    uint32_t index;
+};
+
+struct dense {
+    float max_load_factor;
+    size_t stride;
+    size_t inline_key_size;
+    size_t size;
+    size_t buckets;
+    size_t growth_limit;
+    /* Entries allocated, besides the end entry that follows the last element. */
+    size_t limit;
+    struct dense_bucket *table;
+    unsigned char *entries;
+    struct hashmap_allocator allocator;
+    struct hashmap_stats *stats;
+};
+
+/* Key of the end entry. */
+static char sentinel[1];
+
+/// @return uint32_t Stored hash; the low bits select the home bucket and the top 8 bits are the fingerprint.
+static uint32_t mix(size_t hash)
+{
+    return (uint32_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/// @return uint32_t Distance and fingerprint of @c hash in its home bucket.
+static uint32_t home_dist_fp(uint32_t hash)
+{
+    return DIST_INC | (hash >> 24);
+}
+
+static struct dense_entry *entry_at(const struct dense *d, size_t i)
+{
+    return (struct dense_entry *)(d->entries + i * d->stride);
+}
+
+static struct hashmap_iter *iter_of(struct dense_entry *entry)
+{
+    return (struct hashmap_iter *)((uintptr_t)entry | DENSE_ITER_TAG);
+}
+
+static struct dense_entry *entry_of(struct hashmap_iter *iter)
+{
+    return (struct dense_entry *)((uintptr_t)iter & ~DENSE_ITER_TAG);
+}
+
+/// @return size_t Length of the key of @c entry.
+static size_t impl_length(const struct dense_entry *entry)
+{
+    return entry->length & ~KEY_INLINE;
+}
+
+/// Point the key slot of @c entry at @c key.
+static void impl_key_point(struct dense_entry *entry, const char *key)
+{
+    memcpy((char *)entry + entry->stride - sizeof(key), &key, sizeof(key));
+}
+
+/// @return char* Key of @c entry, in its key slot or where the slot points.
+static char *impl_key(const struct dense_entry *entry)
+{
+    char *key;
+
+    if (entry->length & KEY_INLINE) {
+        return (char *)entry + entry->stride - impl_length(entry) - 1;
+    }
+
+    memcpy(&key, (const char *)entry + entry->stride - sizeof(key), sizeof(key));
+    return key;
+}
+
+static struct hashmap_pair pair_of(struct dense_entry *entry)
+{
+    struct hashmap_pair pair;
+
+    pair.key = impl_key(entry);
+    pair.userdata = &entry->userdata;
+    pair.length = impl_length(entry);
+    return pair;
+}
+
+/// Free the key of @c entry if it is not inline.
+static void impl_key_release(struct dense *d, struct dense_entry *entry)
+{
+    if (!(entry->length & KEY_INLINE)) {
+        d->allocator.free(d->allocator.context, impl_key(entry), entry->length + 1);
+    }
+}
+
+/// Mark the entry after the last element as the end.
+static void impl_terminate(struct dense *d)
+{
+    struct dense_entry *end = entry_at(d, d->size);
+
+    end->stride = (uint32_t)d->stride;
+    end->length = 0;
+    impl_key_point(end, sentinel);
+}
+
+/// Allocate an empty index of @c buckets buckets, and entries up to its growth limit.
+static void impl_alloc(struct dense *d, size_t buckets)
+{
+    d->buckets = buckets;
+    d->growth_limit = (size_t)((float)buckets * d->max_load_factor);
+    d->table = (struct dense_bucket *)d->allocator.alloc(d->allocator.context, buckets * sizeof(struct dense_bucket));
+    memset(d->table, 0, buckets * sizeof(struct dense_bucket));
+    d->limit = d->growth_limit;
+    d->entries = (unsigned char *)d->allocator.alloc(d->allocator.context, (d->limit + 1) * d->stride);
+}
+
+static void impl_free(struct dense *d, struct dense_bucket *table, size_t buckets, unsigned char *entries, size_t limit)
+{
+    d->allocator.free(d->allocator.context, table, buckets * sizeof(struct dense_bucket));
+    d->allocator.free(d->allocator.context, entries, (limit + 1) * d->stride);
+}
+
+/// Point a bucket at entry @c index, shifting the buckets that are closer to their home up by one.
+static void impl_place(struct dense *d, uint32_t hash, size_t index)
+{
+    size_t mask = d->buckets - 1;
+    size_t i = hash & mask;
+    struct dense_bucket b;
+
+    b.dist_fp = home_dist_fp(hash);
+    b.index = (uint32_t)index;
+
+    while (b.dist_fp <= d->table[i].dist_fp) {
+        b.dist_fp += DIST_INC;
+        i = (i + 1) & mask;
+    }
+
+    while (d->table[i].dist_fp) {
+        struct dense_bucket displaced = d->table[i];
+
+        d->table[i] = b;
+        b.dist_fp = displaced.dist_fp + DIST_INC;
+        b.index = displaced.index;
+        i = (i + 1) & mask;
+    }
+
+    d->table[i] = b;
+}
+
+/// @param stats Counters to record the lookup in, or NULL.
+/// @return Bucket of the element, or NULL.
+static struct dense_bucket *impl_lookup(const struct dense *d, uint32_t hash, const void *key, size_t len, struct hashmap_stats *stats)
+{
+    size_t mask = d->buckets - 1;
+    size_t i = hash & mask;
+    uint32_t dist_fp = home_dist_fp(hash);
+    size_t probes;
+
+    /* The key cannot lie past a bucket whose element is closer to its own home than the key would be. */
+    for (probes = 1;; ++probes) {
+        struct dense_bucket *b = &d->table[i];
+
+        if (b->dist_fp < dist_fp) {
+            if (stats) {
+                stats_lookup(stats, probes, false);
+            }
+
+            return NULL;
+
+        } else if (b->dist_fp == dist_fp) {
+            struct dense_entry *entry = entry_at(d, b->index);
+
+            if (entry->hash == hash && impl_length(entry) == len && !memcmp(key, impl_key(entry), len)) {
+                if (stats) {
+                    stats_lookup(stats, probes, true);
+                }
+
+                return b;
+            }
+        }
+
+        dist_fp += DIST_INC;
+        i = (i + 1) & mask;
+    }
+}
+
+/// @return size_t Bucket that points at entry @c index, whose stored hash is @c hash.
+static size_t impl_bucket_of(const struct dense *d, uint32_t hash, size_t index)
+{
+    size_t mask = d->buckets - 1;
+    size_t i = hash & mask;
+
+    while (!d->table[i].dist_fp || d->table[i].index != index) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+/// Move to a fresh index of @c buckets buckets; the entries are copied as they are and only the index is rebuilt.
+static void impl_resize(struct dense *d, size_t buckets)
+{
+    struct dense_bucket *table = d->table;
+    unsigned char *entries = d->entries;
+    size_t old = d->buckets;
+    size_t limit = d->limit;
+    double start = d->stats ? stats_now() : 0;
+    size_t i;
+
+    impl_alloc(d, buckets);
+    memcpy(d->entries, entries, d->size * d->stride);
+    impl_terminate(d);
+
+    for (i = 0; i < d->size; ++i) {
+        impl_place(d, entry_at(d, i)->hash, i);
+    }
+
+    impl_free(d, table, old, entries, limit);
+
+    if (d->stats) {
+        d->stats->rehashes++;
+        d->stats->rehash_seconds += stats_now() - start;
+    }
+}
+
+/// @return size_t Smallest power-of-two bucket count of at least @c buckets that holds @c elements.
+static size_t impl_capacity(const struct dense *d, size_t buckets, size_t elements)
+{
+    size_t capacity = MIN_BUCKETS;
+
+    while (capacity < buckets || (size_t)((float)capacity * d->max_load_factor) < elements) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+struct dense *dense_new(size_t element_size, float max_load_factor, const struct hashmap_allocator *allocator, size_t inline_key_size)
+{
+    struct dense *d = (struct dense *)malloc(sizeof(struct dense));
+    size_t align = sizeof(void *);
+    size_t key_slot_size = inline_key_size > sizeof(char *) ? (inline_key_size + align - 1) & ~(align - 1) : sizeof(char *);
+
+    d->allocator = *allocator;
+    d->stats = NULL;
+    d->max_load_factor = max_load_factor;
+    d->inline_key_size = inline_key_size;
+    d->stride = ((offsetof(struct dense_entry, userdata) + element_size + align - 1) & ~(align - 1)) + key_slot_size;
+    d->size = 0;
+    impl_alloc(d, MIN_BUCKETS);
+    impl_terminate(d);
+    return d;
+}
+
+void dense_delete(struct dense *d)
+{
+    dense_clear(d);
+    impl_free(d, d->table, d->buckets, d->entries, d->limit);
+    free(d);
+}
+
+size_t dense_size(const struct dense *d)
+{
+    return d->size;
+}
+
+struct hashmap_iter *dense_begin(struct dense *d)
+{
+    return iter_of(entry_at(d, 0));
+}
+
+struct hashmap_iter *dense_end(struct dense *d)
+{
+    return iter_of(entry_at(d, d->size));
+}
+
+struct hashmap_iter *dense_iter_inc(struct hashmap_iter *iter)
+{
+    struct dense_entry *entry = entry_of(iter);
+
+    if (impl_key(entry) == sentinel) {
+        return iter;
+    }
+
+    return iter_of((struct dense_entry *)((unsigned char *)entry + entry->stride));
+}
+
+struct hashmap_pair dense_iter_deref(struct hashmap_iter *iter)
+{
+    struct dense_entry *entry = entry_of(iter);
+    struct hashmap_pair pair;
+
+    if (impl_key(entry) != sentinel) {
+        return pair_of(entry);
+    }
+
+    pair.key = NULL;
+    pair.userdata = NULL;
+    pair.length = 0;
+    return pair;
+}
+
+void dense_prefetch(const struct dense *d, size_t hash)
+{
+    __builtin_prefetch(&d->table[mix(hash) & (d->buckets - 1)]);
+}
+
+struct hashmap_iter *dense_find(struct dense *d, size_t hash, const void *key, size_t len)
+{
+    struct dense_bucket *b = impl_lookup(d, mix(hash), key, len, d->stats);
+
+    if (b) {
+        return iter_of(entry_at(d, b->index));
+    }
+
+    return dense_end(d);
+}
+
+struct hashmap_insert_ret dense_insert(struct dense *d, size_t hash, const void *key, size_t len, char *take)
+{
+    uint32_t m = mix(hash);
+    struct dense_bucket *b = impl_lookup(d, m, key, len, d->stats);
+    struct dense_entry *entry;
+    struct hashmap_insert_ret ret;
+
+    if (b) {
+        free(take);
+        entry = entry_at(d, b->index);
+        ret.ok = false;
+
+    } else {
+        if (d->size >= d->growth_limit) {
+            impl_resize(d, d->buckets * 2);
+        }
+
+        /* Append: the new element takes the place of the end entry. */
+        entry = entry_at(d, d->size);
+        entry->hash = m;
+        entry->stride = (uint32_t)d->stride;
+        if (len < d->inline_key_size) {
+            char *copy = (char *)entry + d->stride - len - 1;
+
+            memcpy(copy, key, len);
+            copy[len] = '\0';
+            entry->length = len | KEY_INLINE;
+            free(take);
+
+        } else if (take) {
+            impl_key_point(entry, take);
+            entry->length = len;
+
+        } else {
+            char *copy = d->allocator.alloc(d->allocator.context, len + 1);
+
+            memcpy(copy, key, len);
+            copy[len] = '\0';
+            impl_key_point(entry, copy);
+            entry->length = len;
+        }
+
+        impl_place(d, m, d->size);
+        d->size++;
+        impl_terminate(d);
+
+        ret.ok = true;
+    }
+
+    ret.pair = pair_of(entry);
+    return ret;
+}
+
+void dense_erase(struct dense *d, struct hashmap_iter *iter)
+{
+    struct dense_entry *entry = entry_of(iter);
+    size_t index = dense_position(d, iter);
+    size_t last = d->size - 1;
+    size_t mask = d->buckets - 1;
+    size_t i = impl_bucket_of(d, entry->hash, index);
+    size_t next = (i + 1) & mask;
+
+    /* Backward shift: each following element that is away from its home moves one bucket closer. */
+    while (d->table[next].dist_fp >= 2 * DIST_INC) {
+        d->table[i].dist_fp = d->table[next].dist_fp - DIST_INC;
+        d->table[i].index = d->table[next].index;
+        i = next;
+        next = (next + 1) & mask;
+    }
+
+    d->table[i].dist_fp = 0;
+
+    impl_key_release(d, entry);
+
+    /* Swap and pop: the last entry fills the hole, so that the entries stay packed. */
+    if (index != last) {
+        d->table[impl_bucket_of(d, entry_at(d, last)->hash, last)].index = (uint32_t)index;
+        memcpy(entry, entry_at(d, last), d->stride);
+    }
+
+    d->size--;
+    impl_terminate(d);
+}
+
+void dense_clear(struct dense *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->size; ++i) {
+        impl_key_release(d, entry_at(d, i));
+    }
+
+    memset(d->table, 0, d->buckets * sizeof(struct dense_bucket));
+    d->size = 0;
+    impl_terminate(d);
+}
+
+size_t dense_bucket_count(const struct dense *d)
+{
+    return d->buckets;
+}
+
+size_t dense_bucket_size(const struct dense *d, size_t n)
+{
+    return n < d->buckets && d->table[n].dist_fp;
+}
+
+size_t dense_bucket(const struct dense *d, size_t hash, const void *key, size_t len)
+{
+    uint32_t m = mix(hash);
+    struct dense_bucket *b = impl_lookup(d, m, key, len, NULL);
+
+    if (b) {
+        return (size_t)(b - d->table);
+    }
+
+    return m & (d->buckets - 1);
+}
+
+void dense_max_load_factor_set(struct dense *d, float z)
+{
+    size_t capacity;
+
+    d->max_load_factor = z;
+    capacity = impl_capacity(d, d->buckets, d->size);
+
+    /* Resize once if the index is too small now, or if its growth limit outruns the entries allocated. */
+    if (capacity > d->buckets || (size_t)((float)capacity * z) > d->limit) {
+        impl_resize(d, capacity);
+
+    } else {
+        d->growth_limit = (size_t)((float)d->buckets * z);
+    }
+}
+
+void dense_rehash(struct dense *d, size_t n)
+{
+    size_t capacity = impl_capacity(d, n, d->size);
+
+    if (capacity > d->buckets) {
+        impl_resize(d, capacity);
+    }
+}
+
+void dense_reserve(struct dense *d, size_t elements)
+{
+    dense_rehash(d, impl_capacity(d, 0, elements));
+}
+
+void dense_shrink(struct dense *d, size_t elements)
+{
+    size_t capacity = impl_capacity(d, 0, elements);
+
+    if (capacity < d->buckets) {
+        impl_resize(d, capacity);
+    }
+}
+
+void dense_set_stats(struct dense *d, struct hashmap_stats *stats)
+{
+    d->stats = stats;
+}
+
+size_t dense_allocated(const struct dense *d)
+{
+    size_t bytes = sizeof(struct dense) + d->buckets * sizeof(struct dense_bucket) + (d->limit + 1) * d->stride;
+    size_t i;
+
+    for (i = 0; i < d->size; ++i) {
+        if (!(entry_at(d, i)->length & KEY_INLINE)) {
+            bytes += entry_at(d, i)->length + 1;
+        }
+    }
+
+    return bytes;
+}
+
+void dense_chain_lengths(const struct dense *d, size_t *counts, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < d->buckets; ++i) {
+        if (d->table[i].dist_fp) {
+            size_t k = d->table[i].dist_fp / DIST_INC - 1;
+
+            counts[k < n ? k : n - 1]++;
+        }
+    }
+}
+
+struct hashmap_iter *dense_seek(struct dense *d, size_t i, size_t last)
+{
+    return i < last ? iter_of(entry_at(d, i)) : dense_end(d);
+}
+
+size_t dense_position(const struct dense *d, struct hashmap_iter *iter)
+{
+    return (size_t)((unsigned char *)entry_of(iter) - d->entries) / d->stride;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+/* Dense engine behind the hashmap API: elements sit in one contiguous vector, and an open-addressing index maps
+ * hashes to positions in it. Internal interface; the caller computes the hash, as for the swiss engine. */
+
+struct dense;
+
+/* Dense iterators point at an entry and are tagged with both low bits, which every tag test must check
+ * before the swiss and flat tags, since each of those sees one of the two bits. */
+#define DENSE_ITER_TAG ((uintptr_t)3)
+
+#define dense_is_iter(iter) (((uintptr_t)(iter) & DENSE_ITER_TAG) == DENSE_ITER_TAG)
+
+/// Maximum load factor of the index.
+#define DENSE_MAX_LOAD_FACTOR 0.875f
+
+/// Default load factor of the index, low enough that Robin Hood probes stay short.
+#define DENSE_LOAD_FACTOR 0.8f
+
+/// @param inline_key_size Bytes reserved at the end of each entry for the key, including its terminator.
+struct dense *dense_new(size_t element_size, float max_load_factor, const struct hashmap_allocator *allocator, size_t inline_key_size);
+
+void dense_delete(struct dense *d);
+
+size_t dense_size(const struct dense *d);
+
+struct hashmap_iter *dense_begin(struct dense *d);
+
+struct hashmap_iter *dense_end(struct dense *d);
+
+struct hashmap_iter *dense_iter_inc(struct hashmap_iter *iter);
+
+struct hashmap_pair dense_iter_deref(struct hashmap_iter *iter);
+
+/// Prefetch the first bucket probed for @c hash.
+void dense_prefetch(const struct dense *d, size_t hash);
+
+struct hashmap_iter *dense_find(struct dense *d, size_t hash, const void *key, size_t len);
+
+/// @param take Heap copy of @c key to adopt instead of copying it, or NULL; freed if the key exists.
+struct hashmap_insert_ret dense_insert(struct dense *d, size_t hash, const void *key, size_t len, char *take);
+
+/// Erase the element at @c iter; the last element moves into its place, so @c iter then refers to that one.
+void dense_erase(struct dense *d, struct hashmap_iter *iter);
+
+void dense_clear(struct dense *d);
+
+size_t dense_bucket_count(const struct dense *d);
+
+size_t dense_bucket_size(const struct dense *d, size_t n);
+
+size_t dense_bucket(const struct dense *d, size_t hash, const void *key, size_t len);
+
+void dense_max_load_factor_set(struct dense *d, float z);
+
+void dense_rehash(struct dense *d, size_t n);
+
+void dense_reserve(struct dense *d, size_t elements);
+
+/// Move to the smallest index that holds @c elements, if smaller than the current one.
+void dense_shrink(struct dense *d, size_t elements);
+
+/// Record lookups and rehashes in @c stats from now on, or stop if NULL.
+void dense_set_stats(struct dense *d, struct hashmap_stats *stats);
+
+/// @return size_t Bytes of the index, the entries and the keys.
+size_t dense_allocated(const struct dense *d);
+
+/// Add to @c counts[k] each element that lies @c k buckets past its home bucket; the last of the @c n counts takes the rest.
+void dense_chain_lengths(const struct dense *d, size_t *counts, size_t n);
+
+/// @return Iterator to entry @c i, or the end if @c i is not below @c last.
+struct hashmap_iter *dense_seek(struct dense *d, size_t i, size_t last);
+
+/// @return size_t Index of the entry at @c iter.
+size_t dense_position(const struct dense *d, struct hashmap_iter *iter);
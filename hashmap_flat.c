@@ -0,0 +1,679 @@
+#include "hashmap.h"
+#include "hashmap_flat.h"
+#include "hashmap_stats.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The image is the header, an index, the entries, then the keys.
+ * Offsets replace pointers: the header locates the sections, and each entry locates its key relative
+ * to itself, so that iterators need neither the map nor the base address.
+ *
+ * A bucketed image indexes the first entry of each bucket, with entries in bucket order.
+ * A perfect image places each entry in its own slot, chosen by a minimal perfect hash in the style
+ * of PTHash: keys are split into small groups, and each group has a pilot value, found at freeze time,
+ * that sends all of its keys to free slots. A lookup hashes to a group, reads its pilot, and probes one slot. */
+
+#define FLAT_MAGIC "hashmap"
+#define FLAT_VERSION 2
+/* Written in native order; an image from a machine of the other byte order reads back differently. */
+#define FLAT_ORDER 0x01020304u
+
+struct flat_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint64_t size;
+    /* Power of two; the bucket is the low bits of the hash. */
+    uint64_t buckets;
+    uint64_t element_size;
+    uint64_t stride;
+    /* Offset of the first entry; the bucket index follows the header. */
+    uint64_t entries;
+    uint64_t length;
+    /* Pilots of a perfect image, whose bucket count is then its slot count; zero for a bucketed image. */
+    uint64_t groups;
+    /* Seed of the built-in hash that placed the entries. */
+    uint64_t seed;
+};
+
+/* Average keys per group of a perfect image; each group costs a 32-bit pilot. */
+#define FLAT_GROUP_KEYS 4
+
+/* Entry header; userdata follows. */
+struct flat_entry {
+    uint64_t hash;
+    uint64_t length;
+    /* Offset of the key from the entry. */
+    int64_t key;
+    uint32_t stride;
+    /* Set in the end entry, which follows the last real entry. */
+    uint32_t end;
+};
+
+struct flat {
+    unsigned char *image;
+    size_t length;
+    bool mapped;
+    const struct flat_header *header;
+    /* Entries of bucket b are first[b] up to first[b + 1]. */
+    const uint64_t *first;
+    const uint32_t *pilots;
+    unsigned char *entries;
+    struct hashmap_stats *stats;
+};
+
+static size_t impl_stride(size_t element_size)
+{
+    return (sizeof(struct flat_entry) + element_size + 7) & ~(size_t)7;
+}
+
+static struct flat_entry *entry_at(const struct flat *f, size_t i)
+{
+    return (struct flat_entry *)(f->entries + i * f->header->stride);
+}
+
+static struct hashmap_iter *iter_of(struct flat_entry *entry)
+{
+    return (struct hashmap_iter *)((uintptr_t)entry | FLAT_ITER_TAG);
+}
+
+static struct flat_entry *entry_of(struct hashmap_iter *iter)
+{
+    return (struct flat_entry *)((uintptr_t)iter & ~FLAT_ITER_TAG);
+}
+
+/// Locate the sections of the image.
+static struct flat *impl_attach(unsigned char *image, size_t length, bool mapped)
+{
+    struct flat *f = (struct flat *)malloc(sizeof(struct flat));
+
+    f->image = image;
+    f->length = length;
+    f->mapped = mapped;
+    f->header = (const struct flat_header *)image;
+    f->first = (const uint64_t *)(image + sizeof(struct flat_header));
+    f->pilots = (const uint32_t *)(image + sizeof(struct flat_header));
+    f->entries = image + f->header->entries;
+    f->stats = NULL;
+    return f;
+}
+
+/* Finalizer of MurmurHash3 (Austin Appleby, public domain), so that weak hashes still spread over groups and slots. */
+static uint64_t remix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static size_t impl_group(uint64_t hash, size_t groups)
+{
+    return (size_t)(remix(hash) % groups);
+}
+
+static size_t impl_slot(uint64_t hash, uint32_t pilot, size_t slots)
+{
+    return (size_t)(remix(hash ^ remix((uint64_t)pilot + 1)) % slots);
+}
+
+/* Element collected from the map, with its bucket or group. */
+struct flat_item {
+    size_t bucket;
+    size_t hash;
+    struct hashmap_pair pair;
+};
+
+/// Collect every element of @c h, with its hash.
+/// @param keys Set to the bytes needed for all the keys and their terminators.
+static struct flat_item *impl_collect(struct hashmap *h, size_t *keys)
+{
+    struct flat_item *items = (struct flat_item *)malloc((hashmap_size(h) + 1) * sizeof(struct flat_item));
+    struct hashmap_iter *iter;
+    size_t i;
+
+    *keys = 0;
+
+    for (i = 0, iter = hashmap_begin(h); iter != hashmap_end(h); ++i, iter = hashmap_iter_inc(iter)) {
+        items[i].pair = hashmap_iter_deref(iter);
+        items[i].hash = hashmap_hash_n(h, items[i].pair.key, items[i].pair.length);
+        *keys += items[i].pair.length + 1;
+    }
+
+    return items;
+}
+
+/// Allocate an image with its header filled in and @c index bytes of index.
+static unsigned char *impl_image(size_t size, size_t buckets, size_t groups, size_t element_size, size_t index, size_t keys, uint64_t seed)
+{
+    size_t stride = impl_stride(element_size);
+    size_t entries = sizeof(struct flat_header) + ((index + 7) & ~(size_t)7);
+    size_t length = entries + (size + 1) * stride + keys;
+    unsigned char *image = (unsigned char *)calloc(1, length);
+    struct flat_header *header = (struct flat_header *)image;
+
+    memcpy(header->magic, FLAT_MAGIC, sizeof(FLAT_MAGIC));
+    header->version = FLAT_VERSION;
+    header->order = FLAT_ORDER;
+    header->size = size;
+    header->buckets = buckets;
+    header->element_size = element_size;
+    header->stride = stride;
+    header->entries = entries;
+    header->length = length;
+    header->groups = groups;
+    header->seed = seed;
+    return image;
+}
+
+/// Write the entries, in the order of @c sorted, then the end entry, then the keys.
+static void impl_fill(unsigned char *image, const struct flat_item *sorted)
+{
+    const struct flat_header *header = (const struct flat_header *)image;
+    size_t keys = header->entries + (header->size + 1) * header->stride;
+    size_t i;
+
+    for (i = 0; i <= header->size; ++i) {
+        size_t offset = header->entries + i * header->stride;
+        struct flat_entry *entry = (struct flat_entry *)(image + offset);
+
+        entry->stride = (uint32_t)header->stride;
+
+        if (i == header->size) {
+            entry->end = 1;
+            break;
+        }
+
+        entry->hash = sorted[i].hash;
+        entry->length = sorted[i].pair.length;
+        entry->key = (int64_t)(keys - offset);
+        memcpy(entry + 1, sorted[i].pair.userdata, header->element_size);
+        memcpy(image + keys, sorted[i].pair.key, sorted[i].pair.length);
+        keys += sorted[i].pair.length + 1;
+    }
+}
+
+struct flat *flat_build(struct hashmap *h, size_t element_size, uint64_t seed)
+{
+    size_t size = hashmap_size(h);
+    size_t keys;
+    struct flat_item *items = impl_collect(h, &keys);
+    struct flat_item *sorted = (struct flat_item *)malloc((size + 1) * sizeof(struct flat_item));
+    unsigned char *image;
+    uint64_t *first;
+    size_t buckets = 1;
+    size_t i;
+
+    while (buckets < size) {
+        buckets *= 2;
+    }
+
+    image = impl_image(size, buckets, 0, element_size, (buckets + 1) * sizeof(uint64_t), keys, seed);
+    first = (uint64_t *)(image + sizeof(struct flat_header));
+
+    /* Count each bucket, then turn the counts into starting positions. */
+    for (i = 0; i < size; ++i) {
+        items[i].bucket = items[i].hash & (buckets - 1);
+        first[items[i].bucket + 1]++;
+    }
+
+    for (i = 0; i < buckets; ++i) {
+        first[i + 1] += first[i];
+    }
+
+    for (i = 0; i < size; ++i) {
+        sorted[first[items[i].bucket]++] = items[i];
+    }
+
+    /* Scattering advanced each start to the next bucket; shift them back. */
+    memmove(first + 1, first, buckets * sizeof(uint64_t));
+    first[0] = 0;
+
+    impl_fill(image, sorted);
+
+    free(sorted);
+    free(items);
+
+    return impl_attach(image, ((struct flat_header *)image)->length, false);
+}
+
+/// Find a pilot that sends the @c n keys of a group to distinct free slots, and take them.
+/// @return bool False if no pilot works.
+static bool impl_place(const struct flat_item *group, size_t n, uint8_t *taken, size_t slots, uint32_t *pilot, size_t *slot)
+{
+    size_t i;
+    size_t j;
+
+    /* Keys of equal hash can never be separated. */
+    for (i = 0; i < n; ++i) {
+        for (j = i + 1; j < n; ++j) {
+            if (group[i].hash == group[j].hash) {
+                return false;
+            }
+        }
+    }
+
+    for (*pilot = 0; ; ++*pilot) {
+        for (i = 0; i < n; ++i) {
+            slot[i] = impl_slot(group[i].hash, *pilot, slots);
+
+            if (taken[slot[i]]) {
+                break;
+            }
+
+            taken[slot[i]] = 1;
+        }
+
+        if (i == n) {
+            return true;
+        }
+
+        while (i--) {
+            taken[slot[i]] = 0;
+        }
+
+        if (*pilot == UINT32_MAX) {
+            return false; // UNREACHABLE
+        }
+    }
+}
+
+/* Group of a perfect image, placed largest first while the table is emptiest. */
+struct flat_group {
+    size_t group;
+    size_t begin;
+    size_t size;
+};
+
+static int impl_larger(const void *a, const void *b)
+{
+    const struct flat_group *x = (const struct flat_group *)a;
+    const struct flat_group *y = (const struct flat_group *)b;
+
+    if (x->size != y->size) {
+        return x->size < y->size ? 1 : -1;
+    }
+
+    return x->group < y->group ? -1 : x->group > y->group;
+}
+
+struct flat *flat_freeze(struct hashmap *h, size_t element_size, uint64_t seed)
+{
+    size_t size = hashmap_size(h);
+    size_t slots = size ? size : 1;
+    size_t groups = (size + FLAT_GROUP_KEYS - 1) / FLAT_GROUP_KEYS + 1;
+    size_t keys;
+    struct flat_item *items = impl_collect(h, &keys);
+    struct flat_item *sorted = (struct flat_item *)malloc((size + 1) * sizeof(struct flat_item));
+    struct flat_item *placed = (struct flat_item *)malloc((size + 1) * sizeof(struct flat_item));
+    struct flat_group *order = (struct flat_group *)calloc(groups, sizeof(struct flat_group));
+    uint8_t *taken = (uint8_t *)calloc(slots, 1);
+    size_t *slot = (size_t *)malloc((size + 1) * sizeof(size_t));
+    unsigned char *image;
+    uint32_t *pilots;
+    bool ok = true;
+    size_t begin = 0;
+    size_t g;
+    size_t i;
+
+    image = impl_image(size, slots, groups, element_size, groups * sizeof(uint32_t), keys, seed);
+    pilots = (uint32_t *)(image + sizeof(struct flat_header));
+
+    /* Group the items, as flat_build does buckets. */
+    for (i = 0; i < size; ++i) {
+        items[i].bucket = impl_group(items[i].hash, groups);
+        order[items[i].bucket].size++;
+    }
+
+    for (g = 0; g < groups; ++g) {
+        order[g].group = g;
+        order[g].begin = begin;
+        begin += order[g].size;
+        order[g].size = 0;
+    }
+
+    for (i = 0; i < size; ++i) {
+        struct flat_group *group = &order[items[i].bucket];
+
+        sorted[group->begin + group->size++] = items[i];
+    }
+
+    qsort(order, groups, sizeof(*order), impl_larger);
+
+    for (g = 0; g < groups && ok && order[g].size; ++g) {
+        const struct flat_item *group = sorted + order[g].begin;
+
+        ok = impl_place(group, order[g].size, taken, slots, &pilots[order[g].group], slot);
+
+        for (i = 0; ok && i < order[g].size; ++i) {
+            placed[slot[i]] = group[i];
+        }
+    }
+
+    if (ok) {
+        impl_fill(image, placed);
+
+    } else {
+        free(image);
+    }
+
+    free(slot);
+    free(taken);
+    free(order);
+    free(placed);
+    free(sorted);
+    free(items);
+
+    return ok ? impl_attach(image, ((struct flat_header *)image)->length, false) : NULL;
+}
+
+/// @return bool True if the bucket index of a bucketed @c image runs in order from the first entry to the end.
+static bool impl_valid_index(const unsigned char *image)
+{
+    const struct flat_header *header = (const struct flat_header *)image;
+    const uint64_t *first = (const uint64_t *)(image + sizeof(struct flat_header));
+    size_t b;
+
+    for (b = 0; b < header->buckets; ++b) {
+        if (first[b] > first[b + 1]) {
+            return false;
+        }
+    }
+
+    return first[0] == 0 && first[header->buckets] == header->size;
+}
+
+/// @return bool True if every entry of @c image of @c length bytes has the common stride and a terminated key
+/// inside the image, and only the last is marked as the end.
+static bool impl_valid_entries(const unsigned char *image, size_t length)
+{
+    const struct flat_header *header = (const struct flat_header *)image;
+    size_t i;
+
+    for (i = 0; i <= header->size; ++i) {
+        size_t offset = header->entries + i * header->stride;
+        const struct flat_entry *entry = (const struct flat_entry *)(image + offset);
+        size_t key;
+
+        if (entry->stride != header->stride || entry->end != (i == header->size)) {
+            return false;
+
+        } else if (i == header->size) {
+            break;
+
+        } else if (entry->key < 0 || (uint64_t)entry->key >= length - offset) {
+            return false;
+        }
+
+        key = offset + (size_t)entry->key;
+
+        if (entry->length >= length - key || image[key + entry->length] != '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// @return bool True if @c image of @c length bytes, at least a header, is consistent with this build,
+/// and every offset in it stays inside the image.
+static bool impl_valid(const unsigned char *image, size_t length)
+{
+    const struct flat_header *header = (const struct flat_header *)image;
+
+    if (memcmp(header->magic, FLAT_MAGIC, sizeof(FLAT_MAGIC))) {
+        return false;
+
+    } else if (header->version != FLAT_VERSION || header->order != FLAT_ORDER || header->length != length) {
+        return false;
+
+    } else if (header->element_size > length || header->stride != impl_stride(header->element_size)) {
+        return false;
+
+    } else if (header->entries > length || header->size >= (length - header->entries) / header->stride) {
+        return false;
+
+    } else if (header->groups) {
+        return header->groups <= length / sizeof(uint32_t)
+            && header->buckets == (header->size ? header->size : 1)
+            && header->entries == sizeof(struct flat_header) + ((header->groups * sizeof(uint32_t) + 7) & ~(size_t)7)
+            && impl_valid_entries(image, length);
+    }
+
+    return header->buckets && !(header->buckets & (header->buckets - 1)) && header->buckets < length / sizeof(uint64_t)
+        && header->entries == sizeof(struct flat_header) + (header->buckets + 1) * sizeof(uint64_t)
+        && impl_valid_index(image) && impl_valid_entries(image, length);
+}
+
+struct flat *flat_open(const char *path)
+{
+    struct stat st;
+    void *image;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct flat_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (!impl_valid((const unsigned char *)image, (size_t)st.st_size)) {
+        munmap(image, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return impl_attach((unsigned char *)image, (size_t)st.st_size, true);
+}
+
+int flat_save(const struct flat *f, const char *path)
+{
+    /* Write a new file and rename it into place, so that a map still mapped from @c path keeps its pages. */
+    size_t n = strlen(path);
+    char *tmp = (char *)malloc(n + sizeof(".tmp"));
+    FILE *fp;
+    bool ok;
+    int r = 0;
+
+    memcpy(tmp, path, n);
+    memcpy(tmp + n, ".tmp", sizeof(".tmp"));
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        r = -errno;
+        free(tmp);
+        return r;
+    }
+
+    errno = 0;
+    ok = fwrite(f->image, 1, f->length, fp) == f->length;
+
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0) {
+        r = errno ? -errno : -EIO;
+        remove(tmp);
+    }
+
+    free(tmp);
+    return r;
+}
+
+void flat_delete(struct flat *f)
+{
+    if (f->mapped) {
+        munmap(f->image, f->length);
+
+    } else {
+        free(f->image);
+    }
+
+    free(f);
+}
+
+size_t flat_size(const struct flat *f)
+{
+    return f->header->size;
+}
+
+size_t flat_element_size(const struct flat *f)
+{
+    return f->header->element_size;
+}
+
+uint64_t flat_seed(const struct flat *f)
+{
+    return f->header->seed;
+}
+
+struct hashmap_iter *flat_begin(struct flat *f)
+{
+    return iter_of(entry_at(f, 0));
+}
+
+struct hashmap_iter *flat_end(struct flat *f)
+{
+    return iter_of(entry_at(f, f->header->size));
+}
+
+struct hashmap_iter *flat_iter_inc(struct hashmap_iter *iter)
+{
+    struct flat_entry *entry = entry_of(iter);
+
+    if (entry->end) {
+        return iter;
+    }
+
+    return iter_of((struct flat_entry *)((unsigned char *)entry + entry->stride));
+}
+
+struct hashmap_pair flat_iter_deref(struct hashmap_iter *iter)
+{
+    struct flat_entry *entry = entry_of(iter);
+    struct hashmap_pair pair;
+
+    if (entry->end) {
+        pair.key = NULL;
+        pair.userdata = NULL;
+        pair.length = 0;
+
+    } else {
+        pair.key = (const char *)entry + entry->key;
+        pair.userdata = entry + 1;
+        pair.length = entry->length;
+    }
+
+    return pair;
+}
+
+/// @param probes Set to the number of entries compared.
+static struct flat_entry *impl_lookup(const struct flat *f, size_t hash, const void *key, size_t len, size_t *probes)
+{
+    size_t bucket = flat_bucket(f, hash);
+    size_t i;
+
+    *probes = 0;
+
+    if (f->header->groups) {
+        struct flat_entry *entry = entry_at(f, bucket);
+
+        *probes = 1;
+        if (!entry->end && entry->hash == hash && entry->length == len && !memcmp(key, (const char *)entry + entry->key, len)) {
+            return entry;
+        }
+
+        return NULL;
+    }
+
+    for (i = f->first[bucket]; i < f->first[bucket + 1]; ++i) {
+        struct flat_entry *entry = entry_at(f, i);
+
+        ++*probes;
+        if (entry->hash == hash && entry->length == len && !memcmp(key, (const char *)entry + entry->key, len)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+struct hashmap_iter *flat_find(struct flat *f, size_t hash, const void *key, size_t len)
+{
+    size_t probes;
+    struct flat_entry *entry = impl_lookup(f, hash, key, len, &probes);
+
+    if (f->stats) {
+        stats_lookup(f->stats, probes, entry != NULL);
+    }
+
+    if (entry) {
+        return iter_of(entry);
+    }
+
+    return flat_end(f);
+}
+
+size_t flat_bucket_count(const struct flat *f)
+{
+    return f->header->buckets;
+}
+
+size_t flat_bucket_size(const struct flat *f, size_t n)
+{
+    if (n >= f->header->buckets) {
+        return 0;
+
+    } else if (f->header->groups) {
+        return n < f->header->size;
+    }
+
+    return f->first[n + 1] - f->first[n];
+}
+
+size_t flat_bucket(const struct flat *f, size_t hash)
+{
+    if (f->header->groups) {
+        return impl_slot(hash, f->pilots[impl_group(hash, f->header->groups)], f->header->buckets);
+    }
+
+    return hash & (f->header->buckets - 1);
+}
+
+void flat_set_stats(struct flat *f, struct hashmap_stats *stats)
+{
+    f->stats = stats;
+}
+
+size_t flat_allocated(const struct flat *f)
+{
+    return sizeof(struct flat) + f->length;
+}
+
+struct hashmap_iter *flat_seek(struct flat *f, size_t i, size_t last)
+{
+    return i < last ? iter_of(entry_at(f, i)) : flat_end(f);
+}
+
+size_t flat_position(const struct flat *f, struct hashmap_iter *iter)
+{
+    return (size_t)((unsigned char *)entry_of(iter) - f->entries) / f->header->stride;
+}
@@ -0,0 +1,63 @@
+#include <stdint.h>
+
+/* Read-only flat image behind the hashmap API.
+ * Internal interface; the image holds no pointers, so it can be written to a file and mapped back anywhere. */
+
+struct flat;
+
+/* Flat iterators point at an entry and are tagged with the second bit;
+ * entries, slots and list nodes are all at least 8-byte aligned. */
+#define FLAT_ITER_TAG ((uintptr_t)2)
+
+#define flat_is_iter(iter) (((uintptr_t)(iter) & FLAT_ITER_TAG) != 0)
+
+/// Bucketed image of every element of @c h, whose userdata is @c element_size bytes.
+/// @param seed Seed of the built-in hash of @c h, kept so that the image hashes alike once mapped.
+struct flat *flat_build(struct hashmap *h, size_t element_size, uint64_t seed);
+
+/// Perfect image of every element of @c h: each element has its own slot, so a lookup probes once.
+/// @return NULL if no perfect hash separates the keys, which happens only if two of them have equal hashes.
+struct flat *flat_freeze(struct hashmap *h, size_t element_size, uint64_t seed);
+
+/// Map an image written by @c flat_save.
+/// @return NULL on error, with errno set (EINVAL if the file is not an image of this build).
+struct flat *flat_open(const char *path);
+
+/// @return int Zero on success, otherwise a negative errno.
+int flat_save(const struct flat *f, const char *path);
+
+void flat_delete(struct flat *f);
+
+size_t flat_size(const struct flat *f);
+
+size_t flat_element_size(const struct flat *f);
+
+uint64_t flat_seed(const struct flat *f);
+
+struct hashmap_iter *flat_begin(struct flat *f);
+
+struct hashmap_iter *flat_end(struct flat *f);
+
+struct hashmap_iter *flat_iter_inc(struct hashmap_iter *iter);
+
+struct hashmap_pair flat_iter_deref(struct hashmap_iter *iter);
+
+struct hashmap_iter *flat_find(struct flat *f, size_t hash, const void *key, size_t len);
+
+size_t flat_bucket_count(const struct flat *f);
+
+size_t flat_bucket_size(const struct flat *f, size_t n);
+
+size_t flat_bucket(const struct flat *f, size_t hash);
+
+/// Record lookups in @c stats from now on, or stop if NULL.
+void flat_set_stats(struct flat *f, struct hashmap_stats *stats);
+
+/// @return size_t Bytes of the image, mapped or not.
+size_t flat_allocated(const struct flat *f);
+
+/// @return Iterator to entry @c i, or the end if @c i is not below @c last.
+struct hashmap_iter *flat_seek(struct flat *f, size_t i, size_t last);
+
+/// @return size_t Index of the entry at @c iter.
+size_t flat_position(const struct flat *f, struct hashmap_iter *iter);
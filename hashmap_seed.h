@@ -0,0 +1,7 @@
+#include <stdint.h>
+
+/* Seeds of the built-in hash.
+ * Internal interface, for maps made of several hashmaps that must hash alike. */
+
+/// @return uint64_t A nonzero seed, drawn from a random seed of the process and different on each call.
+uint64_t seed_random(void);
@@ -0,0 +1,26 @@
+#include <time.h>
+
+/* Counters of a map created with the stats option, shared by every layout.
+ * Internal interface; a layout that holds a NULL stats pointer counts nothing. */
+
+/// Count one key search that probed @c probes nodes, groups or entries.
+static inline void stats_lookup(struct hashmap_stats *stats, size_t probes, bool hit)
+{
+    stats->lookups++;
+    stats->hits += hit;
+    stats->misses += !hit;
+    stats->probes += probes;
+
+    if (probes > stats->max_probe_length) {
+        stats->max_probe_length = probes;
+    }
+}
+
+/// @return double Monotonic time in seconds, to time rehashes.
+static inline double stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
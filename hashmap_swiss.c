@@ -0,0 +1,569 @@
+#include "hashmap.h"
+#include "hashmap_stats.h"
+#include "hashmap_swiss.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+/* Slots are probed in aligned groups of control bytes.
+ * A control byte holds 7 bits of the hash for a full slot, or one of the vacant markers below
+ * (high bit set), so one vector compare filters a whole group. */
+#define GROUP 16
+
+enum {
+    CTRL_EMPTY = 0x80,
+    CTRL_DELETED = 0xFE
+};
+
+struct swiss_slot {
+    uint32_t hash;
+    uint32_t stride;
+    char *key;
+    size_t length;
+    void *userdata;
+};
+
+struct swiss {
+    float max_load_factor;
+    size_t stride;
+    size_t capacity;
+    size_t size;
+    size_t tombstones;
+    size_t growth_limit;
+    uint8_t *ctrl;
+    unsigned char *slots;
+    struct hashmap_allocator allocator;
+    struct hashmap_stats *stats;
+};
+
+/* Key of the end slot, which follows the last real slot. */
+static char sentinel[1];
+
+#if defined(__SSE2__)
+
+typedef uint32_t mask_t;
+
+static mask_t group_match(const uint8_t *group, uint8_t value)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+}
+
+static mask_t group_vacant(const uint8_t *group)
+{
+    return (mask_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+static unsigned mask_first(mask_t mask)
+{
+    return (unsigned)__builtin_ctz(mask);
+}
+
+#elif defined(__ARM_NEON)
+
+/* NEON has no movemask; narrowing shift leaves one nibble per lane. */
+typedef uint64_t mask_t;
+
+static mask_t narrow(uint8x16_t v)
+{
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0) & 0x8888888888888888ull;
+}
+
+static mask_t group_match(const uint8_t *group, uint8_t value)
+{
+    return narrow(vceqq_u8(vld1q_u8(group), vdupq_n_u8(value)));
+}
+
+static mask_t group_vacant(const uint8_t *group)
+{
+    return narrow(vtstq_u8(vld1q_u8(group), vdupq_n_u8(CTRL_EMPTY)));
+}
+
+static unsigned mask_first(mask_t mask)
+{
+    return (unsigned)__builtin_ctzll(mask) >> 2;
+}
+
+#else
+
+typedef uint32_t mask_t;
+
+static mask_t group_match(const uint8_t *group, uint8_t value)
+{
+    mask_t mask = 0;
+    unsigned i;
+
+    for (i = 0; i < GROUP; ++i) {
+        mask |= (mask_t)(group[i] == value) << i;
+    }
+
+    return mask;
+}
+
+static mask_t group_vacant(const uint8_t *group)
+{
+    mask_t mask = 0;
+    unsigned i;
+
+    for (i = 0; i < GROUP; ++i) {
+        mask |= (mask_t)((group[i] & CTRL_EMPTY) != 0) << i;
+    }
+
+    return mask;
+}
+
+static unsigned mask_first(mask_t mask)
+{
+    return (unsigned)__builtin_ctz(mask);
+}
+
+#endif
+
+/// @return uint32_t Stored hash; the low bits select the group and the top 7 bits are the control byte.
+static uint32_t mix(size_t hash)
+{
+    return (uint32_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static uint8_t h2(uint32_t hash)
+{
+    return (uint8_t)(hash >> 25);
+}
+
+static struct swiss_slot *slot_at(const struct swiss *s, size_t i)
+{
+    return (struct swiss_slot *)(s->slots + i * s->stride);
+}
+
+static struct hashmap_iter *iter_of(struct swiss_slot *slot)
+{
+    return (struct hashmap_iter *)((uintptr_t)slot | SWISS_ITER_TAG);
+}
+
+static struct swiss_slot *slot_of(struct hashmap_iter *iter)
+{
+    return (struct swiss_slot *)((uintptr_t)iter & ~SWISS_ITER_TAG);
+}
+
+static struct hashmap_pair pair_of(struct swiss_slot *slot)
+{
+    struct hashmap_pair pair;
+
+    pair.key = slot->key;
+    pair.userdata = &slot->userdata;
+    pair.length = slot->length;
+    return pair;
+}
+
+static void impl_free(struct swiss *s, uint8_t *ctrl, unsigned char *slots, size_t capacity)
+{
+    s->allocator.free(s->allocator.context, ctrl, capacity);
+    s->allocator.free(s->allocator.context, slots, (capacity + 1) * s->stride);
+}
+
+static void impl_alloc(struct swiss *s, size_t capacity)
+{
+    struct swiss_slot *end;
+
+    s->capacity = capacity;
+    s->size = 0;
+    s->tombstones = 0;
+    s->growth_limit = (size_t)((float)capacity * s->max_load_factor);
+    s->ctrl = (uint8_t *)s->allocator.alloc(s->allocator.context, capacity);
+    memset(s->ctrl, CTRL_EMPTY, capacity);
+    s->slots = (unsigned char *)s->allocator.alloc(s->allocator.context, (capacity + 1) * s->stride);
+    memset(s->slots, 0, (capacity + 1) * s->stride);
+
+    end = slot_at(s, capacity);
+    end->stride = (uint32_t)s->stride;
+    end->key = sentinel;
+}
+
+/// @return size_t Index of the first vacant slot in the probe sequence of @c hash.
+static size_t impl_find_vacant(const struct swiss *s, uint32_t hash)
+{
+    size_t mask = s->capacity / GROUP - 1;
+    size_t g = hash & mask;
+    size_t i = 0;
+
+    for (;;) {
+        mask_t vacant = group_vacant(s->ctrl + g * GROUP);
+
+        if (vacant) {
+            return g * GROUP + mask_first(vacant);
+        }
+
+        g = (g + ++i) & mask;
+    }
+}
+
+/// @param stats Counters to record the lookup in, or NULL.
+static struct swiss_slot *impl_lookup(const struct swiss *s, uint32_t hash, const void *key, size_t len, struct hashmap_stats *stats)
+{
+    size_t mask = s->capacity / GROUP - 1;
+    size_t g = hash & mask;
+    size_t i = 0;
+
+    for (;;) {
+        const uint8_t *group = s->ctrl + g * GROUP;
+        mask_t match = group_match(group, h2(hash));
+
+        while (match) {
+            struct swiss_slot *slot = slot_at(s, g * GROUP + mask_first(match));
+
+            if (slot->hash == hash && slot->length == len && !memcmp(key, slot->key, len)) {
+                if (stats) {
+                    stats_lookup(stats, i + 1, true);
+                }
+
+                return slot;
+            }
+
+            match &= match - 1;
+        }
+
+        if (group_match(group, CTRL_EMPTY)) {
+            if (stats) {
+                stats_lookup(stats, i + 1, false);
+            }
+
+            return NULL;
+        }
+
+        g = (g + ++i) & mask;
+    }
+}
+
+/// Move every element into a fresh table of @c capacity slots.
+static void impl_resize(struct swiss *s, size_t capacity)
+{
+    uint8_t *ctrl = s->ctrl;
+    unsigned char *slots = s->slots;
+    size_t old = s->capacity;
+    size_t size = s->size;
+    double start = s->stats ? stats_now() : 0;
+    size_t i;
+
+    impl_alloc(s, capacity);
+
+    for (i = 0; i < old; ++i) {
+        if (!(ctrl[i] & CTRL_EMPTY)) {
+            struct swiss_slot *from = (struct swiss_slot *)(slots + i * s->stride);
+            size_t j = impl_find_vacant(s, from->hash);
+
+            s->ctrl[j] = ctrl[i];
+            memcpy(slot_at(s, j), from, s->stride);
+        }
+    }
+
+    s->size = size;
+
+    impl_free(s, ctrl, slots, old);
+
+    if (s->stats) {
+        s->stats->rehashes++;
+        s->stats->rehash_seconds += stats_now() - start;
+    }
+}
+
+/// @return size_t Smallest power-of-two capacity of at least @c slots that holds @c elements.
+static size_t impl_capacity(const struct swiss *s, size_t slots, size_t elements)
+{
+    size_t capacity = GROUP;
+
+    while (capacity < slots || (size_t)((float)capacity * s->max_load_factor) < elements) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+struct swiss *swiss_new(size_t element_size, float max_load_factor, const struct hashmap_allocator *allocator)
+{
+    struct swiss *s = (struct swiss *)malloc(sizeof(struct swiss));
+    size_t align = sizeof(void *);
+
+    s->allocator = *allocator;
+    s->stats = NULL;
+    s->max_load_factor = max_load_factor;
+    s->stride = (offsetof(struct swiss_slot, userdata) + element_size + align - 1) & ~(align - 1);
+    impl_alloc(s, GROUP);
+    return s;
+}
+
+void swiss_delete(struct swiss *s)
+{
+    swiss_clear(s);
+    impl_free(s, s->ctrl, s->slots, s->capacity);
+    free(s);
+}
+
+size_t swiss_size(const struct swiss *s)
+{
+    return s->size;
+}
+
+struct hashmap_iter *swiss_begin(struct swiss *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->capacity && (s->ctrl[i] & CTRL_EMPTY); ++i) {
+    }
+
+    return iter_of(slot_at(s, i));
+}
+
+struct hashmap_iter *swiss_end(struct swiss *s)
+{
+    return iter_of(slot_at(s, s->capacity));
+}
+
+struct hashmap_iter *swiss_iter_inc(struct hashmap_iter *iter)
+{
+    struct swiss_slot *slot = slot_of(iter);
+    size_t stride = slot->stride;
+
+    if (slot->key == sentinel) {
+        return iter;
+    }
+
+    do {
+        slot = (struct swiss_slot *)((unsigned char *)slot + stride);
+    } while (!slot->key);
+
+    return iter_of(slot);
+}
+
+struct hashmap_pair swiss_iter_deref(struct hashmap_iter *iter)
+{
+    struct swiss_slot *slot = slot_of(iter);
+    struct hashmap_pair pair;
+
+    if (slot->key != sentinel) {
+        return pair_of(slot);
+    }
+
+    pair.key = NULL;
+    pair.userdata = NULL;
+    pair.length = 0;
+    return pair;
+}
+
+void swiss_prefetch(const struct swiss *s, size_t hash)
+{
+    size_t g = mix(hash) & (s->capacity / GROUP - 1);
+
+    __builtin_prefetch(s->ctrl + g * GROUP);
+    __builtin_prefetch(slot_at(s, g * GROUP));
+}
+
+struct hashmap_iter *swiss_find(struct swiss *s, size_t hash, const void *key, size_t len)
+{
+    struct swiss_slot *slot = impl_lookup(s, mix(hash), key, len, s->stats);
+
+    if (slot) {
+        return iter_of(slot);
+    }
+
+    return swiss_end(s);
+}
+
+struct hashmap_insert_ret swiss_insert(struct swiss *s, size_t hash, const void *key, size_t len, char *take)
+{
+    uint32_t m = mix(hash);
+    struct swiss_slot *slot = impl_lookup(s, m, key, len, s->stats);
+    struct hashmap_insert_ret ret;
+
+    if (slot) {
+        free(take);
+        ret.ok = false;
+
+    } else {
+        size_t i = impl_find_vacant(s, m);
+
+        if (s->ctrl[i] == CTRL_DELETED) {
+            s->tombstones--;
+
+        } else if (s->size + s->tombstones >= s->growth_limit) {
+            /* Mostly tombstones: clean up in place, otherwise grow. */
+            if (s->size + 1 <= s->growth_limit / 2) {
+                impl_resize(s, s->capacity);
+            } else {
+                impl_resize(s, s->capacity * 2);
+            }
+
+            i = impl_find_vacant(s, m);
+        }
+
+        s->ctrl[i] = h2(m);
+        s->size++;
+
+        slot = slot_at(s, i);
+        slot->hash = m;
+        slot->stride = (uint32_t)s->stride;
+        if (take) {
+            slot->key = take;
+
+        } else {
+            slot->key = s->allocator.alloc(s->allocator.context, len + 1);
+            memcpy(slot->key, key, len);
+            slot->key[len] = '\0';
+        }
+
+        slot->length = len;
+
+        ret.ok = true;
+    }
+
+    ret.pair = pair_of(slot);
+    return ret;
+}
+
+void swiss_erase(struct swiss *s, struct hashmap_iter *iter)
+{
+    struct swiss_slot *slot = slot_of(iter);
+    size_t i = (size_t)((unsigned char *)slot - s->slots) / s->stride;
+
+    s->allocator.free(s->allocator.context, slot->key, slot->length + 1);
+    slot->key = NULL;
+    s->size--;
+
+    /* A group that still has an empty slot never ended a probe sequence,
+     * so the slot can become empty without breaking lookups of other keys. */
+    if (group_match(s->ctrl + (i & ~(size_t)(GROUP - 1)), CTRL_EMPTY)) {
+        s->ctrl[i] = CTRL_EMPTY;
+
+    } else {
+        s->ctrl[i] = CTRL_DELETED;
+        s->tombstones++;
+    }
+}
+
+void swiss_clear(struct swiss *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->capacity; ++i) {
+        struct swiss_slot *slot = slot_at(s, i);
+
+        if (slot->key) {
+            s->allocator.free(s->allocator.context, slot->key, slot->length + 1);
+            slot->key = NULL;
+        }
+    }
+
+    memset(s->ctrl, CTRL_EMPTY, s->capacity);
+    s->size = 0;
+    s->tombstones = 0;
+}
+
+size_t swiss_bucket_count(const struct swiss *s)
+{
+    return s->capacity;
+}
+
+size_t swiss_bucket_size(const struct swiss *s, size_t n)
+{
+    return n < s->capacity && !(s->ctrl[n] & CTRL_EMPTY);
+}
+
+size_t swiss_bucket(const struct swiss *s, size_t hash, const void *key, size_t len)
+{
+    uint32_t m = mix(hash);
+    struct swiss_slot *slot = impl_lookup(s, m, key, len, NULL);
+
+    if (slot) {
+        return (size_t)((unsigned char *)slot - s->slots) / s->stride;
+    }
+
+    return (m & (s->capacity / GROUP - 1)) * GROUP;
+}
+
+void swiss_max_load_factor_set(struct swiss *s, float z)
+{
+    s->max_load_factor = z;
+    s->growth_limit = (size_t)((float)s->capacity * z);
+    swiss_reserve(s, s->size);
+}
+
+void swiss_rehash(struct swiss *s, size_t n)
+{
+    size_t capacity = impl_capacity(s, n, s->size);
+
+    if (capacity > s->capacity) {
+        impl_resize(s, capacity);
+    }
+}
+
+void swiss_reserve(struct swiss *s, size_t elements)
+{
+    swiss_rehash(s, impl_capacity(s, 0, elements));
+}
+
+void swiss_shrink(struct swiss *s, size_t elements)
+{
+    size_t capacity = impl_capacity(s, 0, elements);
+
+    if (capacity < s->capacity) {
+        impl_resize(s, capacity);
+    }
+}
+
+void swiss_set_stats(struct swiss *s, struct hashmap_stats *stats)
+{
+    s->stats = stats;
+}
+
+size_t swiss_allocated(const struct swiss *s)
+{
+    size_t bytes = sizeof(struct swiss) + s->capacity + (s->capacity + 1) * s->stride;
+    size_t i;
+
+    for (i = 0; i < s->capacity; ++i) {
+        if (!(s->ctrl[i] & CTRL_EMPTY)) {
+            bytes += slot_at(s, i)->length + 1;
+        }
+    }
+
+    return bytes;
+}
+
+void swiss_chain_lengths(const struct swiss *s, size_t *counts, size_t n)
+{
+    size_t mask = s->capacity / GROUP - 1;
+    size_t i;
+
+    for (i = 0; i < s->capacity; ++i) {
+        if (!(s->ctrl[i] & CTRL_EMPTY)) {
+            size_t g = slot_at(s, i)->hash & mask;
+            size_t k = 0;
+
+            /* Follow the probe sequence from the first group to the one holding the element. */
+            while (g != i / GROUP) {
+                g = (g + ++k) & mask;
+            }
+
+            counts[k < n ? k : n - 1]++;
+        }
+    }
+}
+
+struct hashmap_iter *swiss_seek(struct swiss *s, size_t i, size_t last)
+{
+    for (; i < last && (s->ctrl[i] & CTRL_EMPTY); ++i) {
+    }
+
+    return i < last ? iter_of(slot_at(s, i)) : swiss_end(s);
+}
+
+size_t swiss_position(const struct swiss *s, struct hashmap_iter *iter)
+{
+    return (size_t)((unsigned char *)slot_of(iter) - s->slots) / s->stride;
+}
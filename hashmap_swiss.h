@@ -0,0 +1,71 @@
+#include <stdint.h>
+
+/* Open-addressing engine behind the hashmap API.
+ * Internal interface; the caller computes the hash so that both layouts agree on it. */
+
+struct swiss;
+
+/* Swiss iterators point at a slot and are tagged with the low bit, which is
+ * always clear in a list node pointer, so the map-less iterator functions can dispatch. */
+#define SWISS_ITER_TAG ((uintptr_t)1)
+
+#define swiss_is_iter(iter) (((uintptr_t)(iter) & SWISS_ITER_TAG) != 0)
+
+/// Maximum load factor supported by the layout.
+#define SWISS_MAX_LOAD_FACTOR 0.875f
+
+struct swiss *swiss_new(size_t element_size, float max_load_factor, const struct hashmap_allocator *allocator);
+
+void swiss_delete(struct swiss *s);
+
+size_t swiss_size(const struct swiss *s);
+
+struct hashmap_iter *swiss_begin(struct swiss *s);
+
+struct hashmap_iter *swiss_end(struct swiss *s);
+
+struct hashmap_iter *swiss_iter_inc(struct hashmap_iter *iter);
+
+struct hashmap_pair swiss_iter_deref(struct hashmap_iter *iter);
+
+/// Prefetch the first group probed for @c hash.
+void swiss_prefetch(const struct swiss *s, size_t hash);
+
+struct hashmap_iter *swiss_find(struct swiss *s, size_t hash, const void *key, size_t len);
+
+/// @param take Heap copy of @c key to adopt instead of copying it, or NULL; freed if the key exists.
+struct hashmap_insert_ret swiss_insert(struct swiss *s, size_t hash, const void *key, size_t len, char *take);
+
+void swiss_erase(struct swiss *s, struct hashmap_iter *iter);
+
+void swiss_clear(struct swiss *s);
+
+size_t swiss_bucket_count(const struct swiss *s);
+
+size_t swiss_bucket_size(const struct swiss *s, size_t n);
+
+size_t swiss_bucket(const struct swiss *s, size_t hash, const void *key, size_t len);
+
+void swiss_max_load_factor_set(struct swiss *s, float z);
+
+void swiss_rehash(struct swiss *s, size_t n);
+
+void swiss_reserve(struct swiss *s, size_t elements);
+
+/// Move to the smallest table that holds @c elements, if smaller than the current one.
+void swiss_shrink(struct swiss *s, size_t elements);
+
+/// Record lookups and rehashes in @c stats from now on, or stop if NULL.
+void swiss_set_stats(struct swiss *s, struct hashmap_stats *stats);
+
+/// @return size_t Bytes of the table and keys.
+size_t swiss_allocated(const struct swiss *s);
+
+/// Add to @c counts[k] each element that lies @c k groups past its first probe; the last of the @c n counts takes the rest.
+void swiss_chain_lengths(const struct swiss *s, size_t *counts, size_t n);
+
+/// @return Iterator to the first element in slots @c i up to @c last, or the end.
+struct hashmap_iter *swiss_seek(struct swiss *s, size_t i, size_t last);
+
+/// @return size_t Slot of the element at @c iter.
+size_t swiss_position(const struct swiss *s, struct hashmap_iter *iter);
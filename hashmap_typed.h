@@ -0,0 +1,244 @@
+#ifndef HASHMAP_TYPED_H
+#define HASHMAP_TYPED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Header-only maps with fixed key and value types, generated by HASHMAP_TYPED.
+ * Keys and values are stored inline in two parallel arrays, found by linear probing from a position that
+ * a multiplicative mix of the hash selects; an occupancy byte per slot marks the full ones.
+ * Erasing shifts the rest of the probe run back, so no tombstones are left. */
+
+/// Hash of an integer or pointer key; the generated map mixes it, so the identity is enough.
+#define HASHMAP_TYPED_HASH_INT(key) ((uint64_t)(uintptr_t)(key))
+
+/// Equality of integer or pointer keys.
+#define HASHMAP_TYPED_EQUAL_INT(a, b) ((a) == (b))
+
+/// Maximum load factor, as a fraction of 8.
+#define HASHMAP_TYPED_LOAD_EIGHTHS 7
+
+/// Define @c struct hashmap_<name> from @c key_type to @c value_type, and its functions @c hashmap_<name>_*.
+/// @param hash Function or function-like macro giving a @c uint64_t hash of a @c key_type; equal keys must hash alike.
+/// @param equal Function or function-like macro telling whether two @c key_type are equal.
+/// @discussion Positions returned by find, insert and iteration are indexes that stay valid until the next insert
+/// or erase: growing moves every element, and erasing may move later elements of the same probe run.
+/// The functions are static inline, so each translation unit that instantiates a map gets its own copy.
+#define HASHMAP_TYPED(name, key_type, value_type, hash, equal) \
+    struct hashmap_##name { \
+        size_t size; \
+        size_t capacity; \
+        unsigned shift; \
+        unsigned char *used; \
+        key_type *keys; \
+        value_type *values; \
+    }; \
+    \
+    struct hashmap_##name##_insert_ret { \
+        bool ok; \
+        size_t pos; \
+        value_type *value; \
+    }; \
+    \
+    /* Home slot of @c key: the top bits of the mixed hash. */ \
+    static inline size_t hashmap_##name##_home(const struct hashmap_##name *h, key_type key) \
+    { \
+        return (size_t)(((uint64_t)(hash(key)) * 0x9E3779B97F4A7C15ull) >> h->shift); \
+    } \
+    \
+    static inline void hashmap_##name##_alloc(struct hashmap_##name *h, size_t capacity) \
+    { \
+        h->capacity = capacity; \
+        for (h->shift = 64; capacity > 1; capacity /= 2) { \
+            h->shift--; \
+        } \
+        h->used = (unsigned char *)calloc(h->capacity, 1); \
+        h->keys = (key_type *)malloc(h->capacity * sizeof(key_type)); \
+        h->values = (value_type *)malloc(h->capacity * sizeof(value_type)); \
+    } \
+    \
+    /* Move every element into a fresh table of @c capacity slots. */ \
+    static inline void hashmap_##name##_resize(struct hashmap_##name *h, size_t capacity) \
+    { \
+        unsigned char *used = h->used; \
+        key_type *keys = h->keys; \
+        value_type *values = h->values; \
+        size_t old = h->capacity; \
+        size_t i; \
+        \
+        hashmap_##name##_alloc(h, capacity); \
+        \
+        for (i = 0; i < old; ++i) { \
+            if (used[i]) { \
+                size_t j = hashmap_##name##_home(h, keys[i]); \
+                \
+                while (h->used[j]) { \
+                    j = (j + 1) & (h->capacity - 1); \
+                } \
+                \
+                h->used[j] = 1; \
+                h->keys[j] = keys[i]; \
+                h->values[j] = values[i]; \
+            } \
+        } \
+        \
+        free(used); \
+        free(keys); \
+        free(values); \
+    } \
+    \
+    static inline struct hashmap_##name *hashmap_##name##_new(void) \
+    { \
+        struct hashmap_##name *h = (struct hashmap_##name *)malloc(sizeof(struct hashmap_##name)); \
+        \
+        h->size = 0; \
+        hashmap_##name##_alloc(h, 16); \
+        return h; \
+    } \
+    \
+    static inline void hashmap_##name##_delete(struct hashmap_##name *h) \
+    { \
+        if (!h) { \
+            return; \
+        } \
+        \
+        free(h->used); \
+        free(h->keys); \
+        free(h->values); \
+        free(h); \
+    } \
+    \
+    static inline size_t hashmap_##name##_size(const struct hashmap_##name *h) \
+    { \
+        return h->size; \
+    } \
+    \
+    /* Grow until @c elements fit within the maximum load factor. */ \
+    static inline void hashmap_##name##_reserve(struct hashmap_##name *h, size_t elements) \
+    { \
+        size_t capacity = h->capacity; \
+        \
+        while (capacity / 8 * HASHMAP_TYPED_LOAD_EIGHTHS < elements) { \
+            capacity *= 2; \
+        } \
+        \
+        if (capacity > h->capacity) { \
+            hashmap_##name##_resize(h, capacity); \
+        } \
+    } \
+    \
+    static inline size_t hashmap_##name##_end(const struct hashmap_##name *h) \
+    { \
+        return h->capacity; \
+    } \
+    \
+    /* @return Position of the first element after @c pos, or the end. */ \
+    static inline size_t hashmap_##name##_inc(const struct hashmap_##name *h, size_t pos) \
+    { \
+        for (++pos; pos < h->capacity && !h->used[pos]; ++pos) { \
+        } \
+        \
+        return pos; \
+    } \
+    \
+    static inline size_t hashmap_##name##_begin(const struct hashmap_##name *h) \
+    { \
+        return h->used[0] ? 0 : hashmap_##name##_inc(h, 0); \
+    } \
+    \
+    static inline const key_type *hashmap_##name##_key(const struct hashmap_##name *h, size_t pos) \
+    { \
+        return &h->keys[pos]; \
+    } \
+    \
+    static inline value_type *hashmap_##name##_value(struct hashmap_##name *h, size_t pos) \
+    { \
+        return &h->values[pos]; \
+    } \
+    \
+    /* @return Position of @c key, or the end. */ \
+    static inline size_t hashmap_##name##_find(const struct hashmap_##name *h, key_type key) \
+    { \
+        size_t i = hashmap_##name##_home(h, key); \
+        \
+        while (h->used[i]) { \
+            if (equal(h->keys[i], key)) { \
+                return i; \
+            } \
+            \
+            i = (i + 1) & (h->capacity - 1); \
+        } \
+        \
+        return h->capacity; \
+    } \
+    \
+    /* Insert @c key, whose value is left uninitialised, unless it exists. */ \
+    static inline struct hashmap_##name##_insert_ret hashmap_##name##_insert(struct hashmap_##name *h, key_type key) \
+    { \
+        struct hashmap_##name##_insert_ret ret; \
+        size_t i = hashmap_##name##_home(h, key); \
+        \
+        while (h->used[i]) { \
+            if (equal(h->keys[i], key)) { \
+                ret.ok = false; \
+                ret.pos = i; \
+                ret.value = &h->values[i]; \
+                return ret; \
+            } \
+            \
+            i = (i + 1) & (h->capacity - 1); \
+        } \
+        \
+        if (h->size >= h->capacity / 8 * HASHMAP_TYPED_LOAD_EIGHTHS) { \
+            hashmap_##name##_resize(h, h->capacity * 2); \
+            \
+            for (i = hashmap_##name##_home(h, key); h->used[i]; i = (i + 1) & (h->capacity - 1)) { \
+            } \
+        } \
+        \
+        h->used[i] = 1; \
+        h->keys[i] = key; \
+        h->size++; \
+        \
+        ret.ok = true; \
+        ret.pos = i; \
+        ret.value = &h->values[i]; \
+        return ret; \
+    } \
+    \
+    /* @return True if an element was erased. */ \
+    static inline bool hashmap_##name##_erase(struct hashmap_##name *h, key_type key) \
+    { \
+        size_t i = hashmap_##name##_find(h, key); \
+        size_t j; \
+        \
+        if (i == h->capacity) { \
+            return false; \
+        } \
+        \
+        /* Backward shift: an element may fill the hole unless its home lies cyclically in (hole, element]. */ \
+        for (j = (i + 1) & (h->capacity - 1); h->used[j]; j = (j + 1) & (h->capacity - 1)) { \
+            size_t k = hashmap_##name##_home(h, h->keys[j]); \
+            \
+            if (i < j ? (k <= i || k > j) : (k <= i && k > j)) { \
+                h->keys[i] = h->keys[j]; \
+                h->values[i] = h->values[j]; \
+                i = j; \
+            } \
+        } \
+        \
+        h->used[i] = 0; \
+        h->size--; \
+        return true; \
+    } \
+    \
+    static inline void hashmap_##name##_clear(struct hashmap_##name *h) \
+    { \
+        memset(h->used, 0, h->capacity); \
+        h->size = 0; \
+    }
+
+#endif
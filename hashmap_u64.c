@@ -0,0 +1,260 @@
+#include "hashmap.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each slot holds the key followed by the userdata, and bit i of the bitmap is set if slot i is full.
+ * The capacity is a power of two of at least one bitmap word, and at most 7/8 of the slots are full.
+ * Probe runs never hold a hole: erasing shifts the rest of the run back instead of leaving a tombstone. */
+#define MIN_CAPACITY 64
+
+struct hashmap_u64 {
+    size_t stride;
+    size_t size;
+    size_t capacity;
+    unsigned shift;
+    uint64_t *used;
+    unsigned char *slots;
+};
+
+static uint64_t *key_at(const struct hashmap_u64 *h, size_t i)
+{
+    return (uint64_t *)(h->slots + i * h->stride);
+}
+
+static bool impl_full(const struct hashmap_u64 *h, size_t i)
+{
+    return (h->used[i / 64] >> (i % 64)) & 1;
+}
+
+static void impl_set(struct hashmap_u64 *h, size_t i, bool full)
+{
+    if (full) {
+        h->used[i / 64] |= (uint64_t)1 << (i % 64);
+
+    } else {
+        h->used[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+}
+
+/// @return size_t Home slot of @c key: the high bits of a multiplicative mix, after folding the high half of the key in.
+static size_t impl_home(const struct hashmap_u64 *h, uint64_t key)
+{
+    return (size_t)(((key ^ (key >> 32)) * 0x9E3779B97F4A7C15ull) >> h->shift);
+}
+
+static void impl_alloc(struct hashmap_u64 *h, size_t capacity)
+{
+    h->capacity = capacity;
+    for (h->shift = 64; capacity > 1; capacity /= 2) {
+        h->shift--;
+    }
+
+    h->used = (uint64_t *)calloc(h->capacity / 64, sizeof(uint64_t));
+    h->slots = (unsigned char *)malloc(h->capacity * h->stride);
+}
+
+/// @return size_t First free slot in the probe run of @c key.
+static size_t impl_vacant(const struct hashmap_u64 *h, uint64_t key)
+{
+    size_t i;
+
+    for (i = impl_home(h, key); impl_full(h, i); i = (i + 1) & (h->capacity - 1)) {
+    }
+
+    return i;
+}
+
+/// Move every element into a fresh table of @c capacity slots.
+static void impl_resize(struct hashmap_u64 *h, size_t capacity)
+{
+    uint64_t *used = h->used;
+    unsigned char *slots = h->slots;
+    size_t old = h->capacity;
+    size_t i;
+
+    impl_alloc(h, capacity);
+
+    for (i = 0; i < old; ++i) {
+        if ((used[i / 64] >> (i % 64)) & 1) {
+            unsigned char *from = slots + i * h->stride;
+            size_t j = impl_vacant(h, *(uint64_t *)from);
+
+            impl_set(h, j, true);
+            memcpy(key_at(h, j), from, h->stride);
+        }
+    }
+
+    free(used);
+    free(slots);
+}
+
+/// @return size_t Slot of @c key, or the capacity.
+static size_t impl_find(const struct hashmap_u64 *h, uint64_t key)
+{
+    size_t i;
+
+    for (i = impl_home(h, key); impl_full(h, i); i = (i + 1) & (h->capacity - 1)) {
+        if (*key_at(h, i) == key) {
+            return i;
+        }
+    }
+
+    return h->capacity;
+}
+
+/// @return size_t First full slot from @c pos on, or the capacity; a bitmap word skips 64 empty slots at once.
+static size_t impl_next(const struct hashmap_u64 *h, size_t pos)
+{
+    size_t word = pos / 64;
+    uint64_t bits;
+
+    if (pos >= h->capacity) {
+        return h->capacity;
+    }
+
+    bits = h->used[word] & (~(uint64_t)0 << (pos % 64));
+    while (!bits) {
+        if (++word == h->capacity / 64) {
+            return h->capacity;
+        }
+
+        bits = h->used[word];
+    }
+
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+}
+
+static struct hashmap_u64_pair pair_of(const struct hashmap_u64 *h, size_t i)
+{
+    struct hashmap_u64_pair pair;
+
+    pair.key = *key_at(h, i);
+    pair.userdata = key_at(h, i) + 1;
+    return pair;
+}
+
+struct hashmap_u64 *hashmap_u64_new(size_t element_size)
+{
+    struct hashmap_u64 *h = (struct hashmap_u64 *)malloc(sizeof(struct hashmap_u64));
+
+    h->stride = (sizeof(uint64_t) + element_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    h->size = 0;
+    impl_alloc(h, MIN_CAPACITY);
+    return h;
+}
+
+void hashmap_u64_delete(struct hashmap_u64 *h)
+{
+    if (!h) {
+        return;
+    }
+
+    free(h->used);
+    free(h->slots);
+    free(h);
+}
+
+size_t hashmap_u64_size(const struct hashmap_u64 *h)
+{
+    return h ? h->size : 0;
+}
+
+void *hashmap_u64_find(const struct hashmap_u64 *h, uint64_t key)
+{
+    size_t i = impl_find(h, key);
+
+    return i < h->capacity ? key_at(h, i) + 1 : NULL;
+}
+
+struct hashmap_u64_insert_ret hashmap_u64_insert(struct hashmap_u64 *h, uint64_t key)
+{
+    struct hashmap_u64_insert_ret ret;
+    size_t i;
+
+    for (i = impl_home(h, key); impl_full(h, i); i = (i + 1) & (h->capacity - 1)) {
+        if (*key_at(h, i) == key) {
+            ret.ok = false;
+            ret.pair = pair_of(h, i);
+            return ret;
+        }
+    }
+
+    if (h->size >= h->capacity / 8 * 7) {
+        impl_resize(h, h->capacity * 2);
+        i = impl_vacant(h, key);
+    }
+
+    impl_set(h, i, true);
+    *key_at(h, i) = key;
+    h->size++;
+
+    ret.ok = true;
+    ret.pair = pair_of(h, i);
+    return ret;
+}
+
+bool hashmap_u64_erase(struct hashmap_u64 *h, uint64_t key)
+{
+    size_t mask = h->capacity - 1;
+    size_t i = impl_find(h, key);
+    size_t j;
+
+    if (i == h->capacity) {
+        return false;
+    }
+
+    /* Backward shift: an element may fill the hole unless its home lies cyclically in (hole, element]. */
+    for (j = (i + 1) & mask; impl_full(h, j); j = (j + 1) & mask) {
+        size_t k = impl_home(h, *key_at(h, j));
+
+        if (i < j ? (k <= i || k > j) : (k <= i && k > j)) {
+            memcpy(key_at(h, i), key_at(h, j), h->stride);
+            i = j;
+        }
+    }
+
+    impl_set(h, i, false);
+    h->size--;
+    return true;
+}
+
+void hashmap_u64_clear(struct hashmap_u64 *h)
+{
+    memset(h->used, 0, h->capacity / 64 * sizeof(uint64_t));
+    h->size = 0;
+}
+
+void hashmap_u64_reserve(struct hashmap_u64 *h, size_t elements)
+{
+    size_t capacity = h->capacity;
+
+    while (capacity / 8 * 7 < elements) {
+        capacity *= 2;
+    }
+
+    if (capacity > h->capacity) {
+        impl_resize(h, capacity);
+    }
+}
+
+size_t hashmap_u64_begin(const struct hashmap_u64 *h)
+{
+    return impl_next(h, 0);
+}
+
+size_t hashmap_u64_end(const struct hashmap_u64 *h)
+{
+    return h->capacity;
+}
+
+size_t hashmap_u64_inc(const struct hashmap_u64 *h, size_t pos)
+{
+    return impl_next(h, pos + 1);
+}
+
+struct hashmap_u64_pair hashmap_u64_deref(struct hashmap_u64 *h, size_t pos)
+{
+    return pair_of(h, pos);
+}
@@ -1,41 +1,2907 @@
 #include "hashmap.h"
+#include "hashmap_typed.h"
+
+#include <sys/stat.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bucket {
+    int value;
+    char data[16];
+};
+
+static void insert(struct hashmap *h, const char *key, int value)
+{
+    struct hashmap_insert_ret ret;
+    struct bucket *b;
+
+    ret = hashmap_insert(h, key);
+    assert(ret.ok == true);
+
+    b = (struct bucket *)ret.pair.userdata;
+    b->value = value;
+    memset(b->data, 0xCC, sizeof(b->data));
+}
+
+/// The original djb2 hash, which the bucket numbers in main were worked out with.
+static size_t djb2(void *context, const void *key, size_t len)
+{
+    const char *p = (const char *)key;
+    size_t hash = 5381;
+
+    (void)context;
+
+    while (len--) {
+        hash = ((hash << 5) + hash) + (unsigned)(*p++);
+    }
+
+    return hash;
+}
+
+static void check_element(struct hashmap *h, size_t bucket, const char *key, int value)
+{
+    struct hashmap_iter *iter;
+    struct hashmap_pair pair;
+
+    iter = hashmap_find(h, key);
+    assert(iter != hashmap_end(h));
+
+    pair = hashmap_iter_deref(iter);
+    assert(!strcmp(key, pair.key));
+    assert(strlen(key) == pair.length);
+
+    assert(bucket == hashmap_bucket(h, key));
+    assert(value == ((struct bucket *)pair.userdata)->value);
+}
+
+/// Every bucket must occupy one contiguous run of the iteration order.
+static void check_contiguous(struct hashmap *h)
+{
+    struct hashmap_iter *iter;
+    size_t runs = 0;
+    size_t previous = hashmap_bucket_count(h);
+    size_t buckets = 0;
+    size_t n;
+
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        size_t bucket = hashmap_bucket(h, hashmap_iter_deref(iter).key);
+
+        if (bucket != previous) {
+            runs++;
+            previous = bucket;
+        }
+    }
+
+    for (n = 0; n < hashmap_bucket_count(h); ++n) {
+        buckets += hashmap_bucket_size(h, n) != 0;
+    }
+
+    assert(runs == buckets);
+}
+
+static void test_rehash(void)
+{
+    struct hashmap *h;
+    char key[16];
+    int i;
+
+    h = hashmap_new(sizeof(struct bucket));
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    check_contiguous(h);
+
+    hashmap_rehash(h, 30011);
+    assert(hashmap_bucket_count(h) == 30011);
+    check_contiguous(h);
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_delete(h);
+}
+
+static void test_incremental_rehash(void)
+{
+    struct hashmap_options options = { .incremental_rehash = true };
+    struct hashmap *h;
+    struct hashmap_iter *iter;
+    char key[16];
+    size_t buckets;
+    size_t visited;
+    int pending = 0;
+    int i;
+
+    assert(!hashmap_rehash_step(NULL, 1));
+
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    assert(!hashmap_rehash_step(h, 1));
+
+    // Growth is spread over later operations, so no insert rehashes the whole table.
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+
+        if (i % 3 == 0) {
+            snprintf(key, sizeof(key), "k%d", i / 2);
+            assert(hashmap_find(h, key) != hashmap_end(h));
+        }
+
+        if (i % 7 == 0) {
+            snprintf(key, sizeof(key), "k%d", i / 2);
+            hashmap_erase(h, hashmap_find(h, key));
+            insert(h, key, i / 2);
+        }
+
+        buckets = hashmap_bucket_count(h);
+        if (hashmap_rehash_step(h, 0)) {
+            pending++;
+        }
+    }
+    assert(pending > 0);
+    assert(hashmap_size(h) == 5000);
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    assert(!hashmap_rehash_step(h, SIZE_MAX));
+    check_contiguous(h);
+
+    // Leave a rehash pending, then complete it synchronously.
+    for (i = 5000; hashmap_bucket_count(h) == buckets; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(hashmap_rehash_step(h, 1));
+
+    // Lookups leave the pending rehash alone, so a loop that finds each element it visits sees each once.
+    visited = 0;
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        struct hashmap_pair pair = hashmap_iter_deref(iter);
+        struct hashmap_iter *found;
+
+        assert(((struct bucket *)pair.userdata)->data[0] == (char)0xCC);
+        ((struct bucket *)pair.userdata)->data[0] = 0;
+        assert(hashmap_find(h, pair.key) == iter);
+        hashmap_find_batch(h, &pair.key, 1, &found);
+        assert(found == iter);
+        visited++;
+    }
+    assert(visited == hashmap_size(h));
+    assert(hashmap_rehash_step(h, 0));
+
+    hashmap_rehash(h, hashmap_bucket_count(h) * 2);
+    assert(!hashmap_rehash_step(h, 1));
+    check_contiguous(h);
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    // Clear and delete with a rehash pending.
+    buckets = hashmap_bucket_count(h);
+    for (i = 0; hashmap_bucket_count(h) == buckets; ++i) {
+        snprintf(key, sizeof(key), "n%d", i);
+        hashmap_insert(h, key);
+    }
+    assert(hashmap_rehash_step(h, 0));
+    hashmap_clear(h);
+    assert(!hashmap_rehash_step(h, 1));
+    assert(hashmap_empty(h));
+
+    buckets = hashmap_bucket_count(h);
+    for (i = 0; hashmap_bucket_count(h) == buckets; ++i) {
+        snprintf(key, sizeof(key), "n%d", i);
+        hashmap_insert(h, key);
+    }
+    assert(hashmap_rehash_step(h, 0));
+
+    hashmap_delete(h);
+}
+
+struct counting {
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+};
+
+static void *counting_alloc(void *context, size_t size)
+{
+    struct counting *c = (struct counting *)context;
+
+    c->allocs++;
+    c->bytes += size;
+    return malloc(size);
+}
+
+static void counting_free(void *context, void *ptr, size_t size)
+{
+    struct counting *c = (struct counting *)context;
+
+    c->frees++;
+    c->bytes -= size;
+    free(ptr);
+}
+
+static void test_allocator(void)
+{
+    struct counting c = { 0, 0, 0 };
+    struct hashmap_allocator allocator = { counting_alloc, counting_free, &c };
+    struct hashmap_options options = { .allocator = &allocator };
+    struct hashmap *h;
+    char key[16];
+    int i;
+
+    // One allocation per node, and one per key.
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    for (i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(c.allocs == 200);
+
+    hashmap_erase(h, hashmap_find(h, "k7"));
+    assert(c.frees == 2);
+
+    // A key handed over from malloc is copied, since the map frees its keys through the allocator.
+    assert(hashmap_insert_take(h, strdup("taken")).ok);
+    assert(c.allocs == 202);
+    assert(!hashmap_insert_take(h, strdup("taken")).ok);
+    assert(c.allocs == 202);
+
+    hashmap_delete(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    // Slab: nodes come from a few chunks and erased nodes are reused; keys are allocated one by one.
+    options.slab = true;
+    c.allocs = c.frees = 0;
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(c.allocs == 5 + 1000);
+
+    for (i = 0; i < 10; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        hashmap_erase(h, hashmap_find(h, key));
+    }
+    for (i = 0; i < 10; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(c.allocs == 5 + 1010);
+    assert(c.frees == 10);
+
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_clear(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    insert(h, "bacteria", 1);
+    check_element(h, hashmap_bucket(h, "bacteria"), "bacteria", 1);
+
+    hashmap_delete(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    // Swiss slot arrays and dense arrays, and their keys.
+    for (i = HASHMAP_LAYOUT_SWISS; i <= HASHMAP_LAYOUT_DENSE; ++i) {
+        struct hashmap_insert_ret ret;
+        int j;
+
+        options.layout = (enum hashmap_layout)i;
+        c.allocs = c.frees = 0;
+        h = hashmap_new_with(sizeof(struct bucket), &options);
+        for (j = 0; j < 100; ++j) {
+            snprintf(key, sizeof(key), "k%d", j);
+            insert(h, key, j);
+        }
+        assert(c.allocs > 100);
+
+        ret = hashmap_insert_take(h, strdup("taken"));
+        assert(ret.ok && !strcmp(ret.pair.key, "taken"));
+        hashmap_erase(h, hashmap_find(h, "k7"));
+        hashmap_clear(h);
+        assert(c.bytes > 0);
+
+        hashmap_delete(h);
+        assert(c.frees == c.allocs);
+        assert(c.bytes == 0);
+    }
+}
+
+static void test_keys(void)
+{
+    struct counting c = { 0, 0, 0 };
+    struct hashmap_allocator allocator = { counting_alloc, counting_free, &c };
+    struct hashmap_options options = { .allocator = &allocator, .inline_key_size = 24 };
+    struct hashmap *h;
+    struct hashmap_iter *iter;
+    char key[16];
+    char *big;
+    int i;
+
+    // Short keys are stored in the node.
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    insert(h, "abcdefghijklmnopqrstuvw", 1);
+    insert(h, "abcdefghijklmnopqrstuvwx", 2);
+    insert(h, "", 3);
+    check_element(h, hashmap_bucket(h, "abcdefghijklmnopqrstuvw"), "abcdefghijklmnopqrstuvw", 1);
+    check_element(h, hashmap_bucket(h, "abcdefghijklmnopqrstuvwx"), "abcdefghijklmnopqrstuvwx", 2);
+    check_element(h, hashmap_bucket(h, ""), "", 3);
+
+    iter = hashmap_find(h, "abcdefghijklmnopqrstuvw");
+    assert(hashmap_iter_deref(iter).key < (const char *)hashmap_iter_deref(iter).userdata);
+    assert(!hashmap_insert(h, "abcdefghijklmnopqrstuvw").ok);
+
+    hashmap_erase(h, iter);
+    hashmap_erase(h, hashmap_find(h, "abcdefghijklmnopqrstuvwx"));
+    assert(hashmap_find(h, "abcdefghijklmnopqrstuvw") == hashmap_end(h));
+    assert(hashmap_size(h) == 1);
+
+    hashmap_delete(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    // With the slab as well, clearing frees only the chunks.
+    options.slab = true;
+    c.allocs = c.frees = 0;
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_clear(h);
+    assert(c.allocs == 5);
+    assert(c.frees == 5);
+    hashmap_delete(h);
+
+    // Dense entries hold short keys at their end, and the last entry carries its key into a hole.
+    options.slab = false;
+    options.layout = HASHMAP_LAYOUT_DENSE;
+    options.inline_key_size = 3;
+    c.allocs = c.frees = 0;
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    insert(h, "ab", 1);
+    insert(h, "abc", 2);
+    insert(h, "xy", 3);
+    assert(c.allocs == 2 + 1);
+
+    hashmap_erase(h, hashmap_find(h, "ab"));
+    assert(c.frees == 0);
+    check_element(h, hashmap_bucket(h, "abc"), "abc", 2);
+    check_element(h, hashmap_bucket(h, "xy"), "xy", 3);
+    assert(hashmap_find(h, "ab") == hashmap_end(h));
+
+    assert(hashmap_insert_take(h, strdup("q")).ok);
+    assert(!strcmp(hashmap_iter_deref(hashmap_find(h, "q")).key, "q"));
+    assert(c.allocs == 2 + 1);
+
+    hashmap_delete(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    // Arena: longer keys are copied into shared blocks and erasing does not free them.
+    options.layout = HASHMAP_LAYOUT_CHAINED;
+    options.inline_key_size = 0;
+    options.key_arena = true;
+    c.allocs = c.frees = 0;
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(c.allocs == 1000 + 1);
+
+    hashmap_erase(h, hashmap_find(h, "k7"));
+    assert(c.frees == 1);
+
+    // A large key gets a block of its own (plus its node) behind the current block, which stays in use.
+    big = malloc(100000);
+    memset(big, 'x', 99999);
+    big[99999] = '\0';
+    insert(h, big, -1);
+    assert(c.allocs == 1001 + 2);
+    insert(h, "bacteria", 1);
+    assert(c.allocs == 1001 + 3);
+
+    check_element(h, hashmap_bucket(h, big), big, -1);
+    check_element(h, hashmap_bucket(h, "k999"), "k999", 999);
+    free(big);
+
+    hashmap_clear(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+
+    // Keys that overflow a block start a new one.
+    for (i = 0; i < 10000; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    for (i = 0; i < 10000; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_delete(h);
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+}
+
+static void test_binary_keys(void)
+{
+    static const char packet[] = "GET /index.html\0HTTP/1.1";
+    enum hashmap_layout layouts[] = { HASHMAP_LAYOUT_CHAINED, HASHMAP_LAYOUT_SWISS };
+    size_t l;
+
+    for (l = 0; l < sizeof(layouts) / sizeof(*layouts); ++l) {
+        struct hashmap_options options = { .layout = layouts[l] };
+        struct hashmap *h = hashmap_new_with(sizeof(int), &options);
+        struct hashmap_insert_ret ret;
+        struct hashmap_pair pair;
+
+        // Substrings of a buffer, without copying them out.
+        ret = hashmap_insert_n(h, packet, 3);
+        assert(ret.ok);
+        assert(!strcmp(ret.pair.key, "GET"));
+        assert(ret.pair.length == 3);
+        *(int *)ret.pair.userdata = 1;
+
+        ret = hashmap_insert_n(h, packet + 4, 11);
+        assert(ret.ok);
+        *(int *)ret.pair.userdata = 2;
+
+        assert(!hashmap_insert(h, "GET").ok);
+        assert(!hashmap_insert_n(h, "/index.html", 11).ok);
+        assert(hashmap_find_n(h, packet, 2) == hashmap_end(h));
+        assert(hashmap_find_n(h, packet, 4) == hashmap_end(h));
+        assert(*(int *)hashmap_iter_deref(hashmap_find(h, "/index.html")).userdata == 2);
+
+        // Keys may contain NUL.
+        ret = hashmap_insert_n(h, packet + 4, sizeof(packet) - 5);
+        assert(ret.ok);
+        assert(ret.pair.length == sizeof(packet) - 5);
+        *(int *)ret.pair.userdata = 3;
+
+        pair = hashmap_iter_deref(hashmap_find_n(h, packet + 4, sizeof(packet) - 5));
+        assert(*(int *)pair.userdata == 3);
+        assert(!memcmp(pair.key, packet + 4, pair.length));
+        assert(pair.key[pair.length] == '\0');
+
+        ret = hashmap_insert_n(h, "", 0);
+        assert(ret.ok);
+        assert(hashmap_find(h, "") != hashmap_end(h));
+        assert(hashmap_size(h) == 4);
+
+        assert(hashmap_erase_n(h, packet, 3));
+        assert(!hashmap_erase_n(h, packet, 3));
+        assert(hashmap_find(h, "GET") == hashmap_end(h));
+        assert(hashmap_erase_n(h, packet + 4, sizeof(packet) - 5));
+        assert(hashmap_find(h, "/index.html") != hashmap_end(h));
+        assert(hashmap_size(h) == 2);
+
+        hashmap_delete(h);
+    }
+
+    assert(!hashmap_erase_n(NULL, "", 0));
+}
+
+/// Keys that carry their own hash in the first word.
+static size_t prehashed(void *context, const void *key, size_t len)
+{
+    size_t hash;
+
+    ++*(int *)context;
+    assert(len >= sizeof(hash));
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static void test_hash(void)
+{
+    struct hashmap *h;
+    struct hashmap_hasher hasher;
+    struct hashmap_options options;
+    char key[200];
+    size_t max;
+    size_t i;
+    int calls = 0;
+
+    // Every key length takes a different path through the hash.
+    h = hashmap_new(0);
+    memset(key, 'a', sizeof(key));
+    for (i = 0; i <= sizeof(key); ++i) {
+        assert(hashmap_insert_n(h, key, i).ok);
+    }
+    key[0] = 'b';
+    for (i = 1; i <= sizeof(key); ++i) {
+        assert(hashmap_insert_n(h, key, i).ok);
+    }
+    key[0] = 'a';
+    for (i = 0; i <= sizeof(key); ++i) {
+        assert(hashmap_find_n(h, key, i) != hashmap_end(h));
+    }
+    for (i = 1; i < sizeof(key); ++i) {
+        key[i] = 'b';
+        assert(hashmap_find_n(h, key, sizeof(key)) == hashmap_end(h));
+        key[i] = 'a';
+    }
+    assert(hashmap_size(h) == 2 * sizeof(key) + 1);
+    hashmap_delete(h);
+
+    // Sequential keys spread evenly.
+    h = hashmap_new(0);
+    for (i = 0; i < 10000; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        hashmap_insert(h, key);
+    }
+    max = 0;
+    for (i = 0; i < hashmap_bucket_count(h); ++i) {
+        if (hashmap_bucket_size(h, i) > max) {
+            max = hashmap_bucket_size(h, i);
+        }
+    }
+    assert(max <= 8);
+    hashmap_delete(h);
+
+    // Custom hasher, for both layouts.
+    hasher.hash = prehashed;
+    hasher.context = &calls;
+    options = (struct hashmap_options){ .hasher = &hasher };
+
+    for (; options.layout <= HASHMAP_LAYOUT_SWISS; options.layout++) {
+        h = hashmap_new_with(0, &options);
+        calls = 0;
+
+        for (i = 0; i < 100; ++i) {
+            size_t hash = i * 7;
+
+            memcpy(key, &hash, sizeof(hash));
+            snprintf(key + sizeof(hash), sizeof(key) - sizeof(hash), "%zu", i);
+            assert(hashmap_insert_n(h, key, sizeof(hash) + strlen(key + sizeof(hash))).ok);
+            assert(hashmap_find_n(h, key, sizeof(hash) + strlen(key + sizeof(hash))) != hashmap_end(h));
+        }
+        assert(calls == 200);
+
+        hashmap_delete(h);
+    }
+}
+
+static void test_pow2(void)
+{
+    struct hashmap_hasher hasher = { djb2, NULL };
+    struct hashmap_options options = { .sizing = HASHMAP_SIZING_POW2, .hasher = &hasher };
+    struct hashmap *h;
+    char key[16];
+    int i;
+
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    assert(hashmap_bucket_count(h) == 8);
+
+    hashmap_reserve(h, 50);
+    assert(hashmap_bucket_count(h) == 64);
+
+    hashmap_rehash(h, 100);
+    assert(hashmap_bucket_count(h) == 128);
+
+    // The bucket is the low bits of the hash.
+    insert(h, "adept", 2);
+    assert(hashmap_bucket(h, "adept") == (djb2(NULL, "adept", 5) & 127));
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(hashmap_bucket_count(h) == 8192);
+    check_contiguous(h);
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_delete(h);
+
+    // Incremental growth splits each bucket in two.
+    options.incremental_rehash = true;
+    options.hasher = NULL;
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    hashmap_rehash_step(h, SIZE_MAX);
+    check_contiguous(h);
+
+    for (i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    hashmap_delete(h);
+}
+
+static void test_batch(void)
+{
+    static char storage[1000][16];
+    const char *keys[1000];
+    struct hashmap_insert_ret rets[1000];
+    struct hashmap_iter *iters[1000];
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .incremental_rehash = true },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+        { .layout = HASHMAP_LAYOUT_DENSE },
+    };
+    size_t o;
+    int i;
+
+    // Every third key repeats an earlier one, within the same batch or not.
+    for (i = 0; i < 1000; ++i) {
+        snprintf(storage[i], sizeof(storage[i]), "k%d", i % 3 == 2 ? i / 3 : i);
+        keys[i] = storage[i];
+    }
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(int), &options[o]);
+        size_t inserted = 0;
+
+        hashmap_insert_batch(h, keys, 1000, rets);
+        for (i = 0; i < 1000; ++i) {
+            assert(!strcmp(rets[i].pair.key, keys[i]));
+            inserted += rets[i].ok;
+        }
+        assert(inserted == hashmap_size(h));
+        assert(!rets[2].ok);
+
+        for (i = 0; i < 1000; ++i) {
+            *(int *)hashmap_iter_deref(hashmap_find(h, keys[i])).userdata = i;
+        }
+
+        hashmap_find_batch(h, keys, 1000, iters);
+        for (i = 0; i < 1000; ++i) {
+            assert(iters[i] == hashmap_find(h, keys[i]));
+        }
+
+        // Misses, then erase half.
+        hashmap_find_batch(h, keys, 0, iters);
+        inserted = hashmap_size(h);
+        assert(hashmap_erase_batch(h, keys, 500) == inserted - hashmap_size(h));
+        assert(hashmap_size(h) < inserted);
+        assert(hashmap_erase_batch(h, keys, 500) == 0);
+        hashmap_find_batch(h, keys, 1000, iters);
+        for (i = 0; i < 1000; ++i) {
+            assert((iters[i] == hashmap_end(h)) == (hashmap_find(h, keys[i]) == hashmap_end(h)));
+        }
+        assert(iters[0] == hashmap_end(h));
+        assert(iters[999] != hashmap_end(h));
+        assert(*(int *)hashmap_iter_deref(iters[999]).userdata == 999);
+
+        hashmap_delete(h);
+    }
+
+    assert(hashmap_erase_batch(NULL, keys, 1) == 0);
+}
+
+/// Counts calls, then hashes like djb2.
+static size_t counted_djb2(void *context, const void *key, size_t len)
+{
+    ++*(int *)context;
+    return djb2(NULL, key, len);
+}
+
+static void test_with_hash(void)
+{
+    int calls = 0;
+    struct hashmap_hasher hasher = { counted_djb2, &calls };
+    struct hashmap_options options = { .hasher = &hasher };
+
+    for (; options.layout <= HASHMAP_LAYOUT_SWISS; options.layout++) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options);
+        size_t hash;
+
+        hash = hashmap_hash(h, "bacteria");
+        assert(hash == djb2(NULL, "bacteria", 8));
+        assert(hashmap_hash_n(h, "bacteria!", 8) == hash);
+        assert(calls == 2);
+
+        // One hash for the whole sequence of operations.
+        calls = 0;
+        assert(hashmap_find_with_hash(h, "bacteria", hash) == hashmap_end(h));
+        assert(hashmap_insert_with_hash(h, "bacteria", hash).ok);
+        assert(!hashmap_insert_with_hash(h, "bacteria", hash).ok);
+        assert(hashmap_find_with_hash(h, "bacteria", hash) == hashmap_find(h, "bacteria"));
+        assert(calls == 1);
+
+        if (options.layout == HASHMAP_LAYOUT_CHAINED) {
+            assert(hashmap_bucket(h, "bacteria") == hash % hashmap_bucket_count(h));
+        }
+
+        calls = 0;
+        assert(hashmap_erase_with_hash(h, "bacteria", hash));
+        assert(!hashmap_erase_with_hash(h, "bacteria", hash));
+        assert(hashmap_empty(h));
+        assert(calls == 0);
+
+        hashmap_delete(h);
+    }
+
+    assert(!hashmap_erase_with_hash(NULL, "bacteria", 0));
+}
+
+struct worker {
+    struct hashmap_concurrent *c;
+    int id;
+};
+
+static void increment(void *context, void *userdata, bool inserted)
+{
+    (void)context;
+
+    if (inserted) {
+        *(int *)userdata = 0;
+    }
+
+    ++*(int *)userdata;
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    char key[32];
+    int value;
+    int i;
+
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "w%d-%d", w->id, i);
+        value = i;
+        assert(hashmap_concurrent_upsert(w->c, key, &value));
+        value = -i;
+        assert(!hashmap_concurrent_upsert(w->c, key, &value));
+
+        hashmap_concurrent_update(w->c, "shared", increment, NULL);
+
+        assert(hashmap_concurrent_find(w->c, key, &value));
+        assert(value == -i);
+
+        if (i % 4 == 0) {
+            assert(hashmap_concurrent_erase(w->c, key));
+            assert(!hashmap_concurrent_find(w->c, key, NULL));
+        }
+    }
+
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    struct hashmap_options swiss = { .layout = HASHMAP_LAYOUT_SWISS, .incremental_rehash = true };
+    struct hashmap_options incremental = { .incremental_rehash = true, .stats = true };
+    struct counting counts = { 0, 0, 0 };
+    struct hashmap_allocator allocator = { counting_alloc, counting_free, &counts };
+    struct hashmap_options counted = { .allocator = &allocator };
+    const struct hashmap_options *options[] = { NULL, &incremental, &swiss, &counted };
+    size_t shards[] = { 1, 5, 16, 8 };
+    size_t o;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap_concurrent *c = hashmap_concurrent_new(sizeof(int), shards[o], options[o]);
+        struct worker workers[4];
+        pthread_t threads[4];
+        int value;
+        int i;
+
+        for (i = 0; i < 4; ++i) {
+            workers[i].c = c;
+            workers[i].id = i;
+            pthread_create(&threads[i], NULL, work, &workers[i]);
+        }
+        for (i = 0; i < 4; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        assert(hashmap_concurrent_size(c) == 4 * (2000 - 500) + 1);
+        assert(hashmap_concurrent_find(c, "shared", &value));
+        assert(value == 4 * 2000);
+        assert(!hashmap_concurrent_erase(c, "w0-0"));
+        assert(hashmap_concurrent_find(c, "w3-1999", &value));
+        assert(value == -1999);
+
+        hashmap_concurrent_delete(c);
+    }
+
+    // Writers to different shards share the counting allocator, which is not thread-safe, by turns.
+    assert(counts.allocs > 0);
+    assert(counts.frees == counts.allocs);
+    assert(counts.bytes == 0);
+
+    hashmap_concurrent_delete(NULL);
+}
+
+struct rcu_reader {
+    struct hashmap_rcu *m;
+    _Atomic int *stop;
+    size_t reads;
+};
+
+/// Both keys are always written together, so every version must show them equal.
+static void *rcu_read(void *arg)
+{
+    struct rcu_reader *w = (struct rcu_reader *)arg;
+    struct hashmap_rcu_reader *r = hashmap_rcu_join(w->m);
+
+    while (!atomic_load(w->stop) || w->reads == 0) {
+        struct hashmap *h = hashmap_rcu_read_lock(r);
+        struct hashmap_iter *a = hashmap_find(h, "a");
+        struct hashmap_iter *b = hashmap_find(h, "b");
+
+        assert((a == hashmap_end(h)) == (b == hashmap_end(h)));
+        if (a != hashmap_end(h)) {
+            assert(*(int *)hashmap_iter_deref(a).userdata == *(int *)hashmap_iter_deref(b).userdata);
+        }
+
+        hashmap_rcu_read_unlock(r);
+        w->reads++;
+    }
+
+    hashmap_rcu_leave(r);
+    return NULL;
+}
+
+static void *rcu_write(void *arg)
+{
+    struct hashmap_rcu *m = (struct hashmap_rcu *)arg;
+    struct hashmap *h = hashmap_rcu_write_lock(m);
+
+    *(int *)hashmap_insert(h, "late").pair.userdata = 1;
+    hashmap_rcu_write_unlock(m);
+    return NULL;
+}
+
+static void test_rcu(void)
+{
+    struct hashmap_options options = { .incremental_rehash = true, .stats = true };
+    struct hashmap_rcu *m = hashmap_rcu_new(sizeof(int), &options);
+    struct hashmap_rcu_reader *r = hashmap_rcu_join(m);
+    struct hashmap_rcu_reader *r2 = hashmap_rcu_join(m);
+    struct rcu_reader readers[3];
+    pthread_t threads[3];
+    struct timespec pause = { 0, 20000000 };
+    _Atomic int stop = 0;
+    struct hashmap *h;
+    struct hashmap *old;
+    int i;
+
+    h = hashmap_rcu_read_lock(r);
+    assert(hashmap_empty(h));
+    hashmap_rcu_read_unlock(r);
+
+    // Readers run while versions are published.
+    for (i = 0; i < 3; ++i) {
+        readers[i].m = m;
+        readers[i].stop = &stop;
+        readers[i].reads = 0;
+        pthread_create(&threads[i], NULL, rcu_read, &readers[i]);
+    }
+
+    for (i = 0; i < 200; ++i) {
+        char key[16];
+
+        h = hashmap_rcu_write_lock(m);
+        *(int *)hashmap_insert(h, "a").pair.userdata = i;
+        *(int *)hashmap_insert(h, "b").pair.userdata = i;
+        snprintf(key, sizeof(key), "k%d", i);
+        *(int *)hashmap_insert(h, key).pair.userdata = i;
+        hashmap_rcu_write_unlock(m);
+    }
+
+    atomic_store(&stop, 1);
+    for (i = 0; i < 3; ++i) {
+        pthread_join(threads[i], NULL);
+        assert(readers[i].reads > 0);
+    }
+
+    h = hashmap_rcu_read_lock(r);
+    assert(hashmap_size(h) == 202);
+    assert(*(int *)hashmap_iter_deref(hashmap_find(h, "k150")).userdata == 150);
+    hashmap_rcu_read_unlock(r);
+
+    // A writer waits for a reader that may still see the old version.
+    old = hashmap_rcu_read_lock(r);
+    pthread_create(&threads[0], NULL, rcu_write, m);
+    do {
+        h = hashmap_rcu_read_lock(r2);
+        hashmap_rcu_read_unlock(r2);
+    } while (h == old);
+    nanosleep(&pause, NULL);
+    assert(hashmap_find(old, "late") == hashmap_end(old));
+    assert(hashmap_size(old) == 202);
+    hashmap_rcu_read_unlock(r);
+    pthread_join(threads[0], NULL);
+
+    h = hashmap_rcu_read_lock(r);
+    assert(hashmap_find(h, "late") != hashmap_end(h));
+    hashmap_rcu_read_unlock(r);
+
+    hashmap_rcu_leave(r2);
+    hashmap_rcu_leave(r);
+    hashmap_rcu_delete(m);
+    hashmap_rcu_delete(NULL);
+
+    // Every version uses copies of the allocator, hasher and evictor, which the caller may release at once.
+    {
+        struct counting c = { 0, 0, 0 };
+        int calls = 0;
+        struct hashmap_allocator *allocator = malloc(sizeof(*allocator));
+        struct hashmap_hasher *hasher = malloc(sizeof(*hasher));
+        struct hashmap_evictor *evictor = malloc(sizeof(*evictor));
+
+        allocator->alloc = counting_alloc;
+        allocator->free = counting_free;
+        allocator->context = &c;
+        hasher->hash = counted_djb2;
+        hasher->context = &calls;
+        evictor->evict = NULL;
+        evictor->context = NULL;
+        options.allocator = allocator;
+        options.hasher = hasher;
+        options.evictor = evictor;
+        m = hashmap_rcu_new(sizeof(int), &options);
+        memset(allocator, 0, sizeof(*allocator));
+        memset(hasher, 0, sizeof(*hasher));
+        free(allocator);
+        free(hasher);
+        free(evictor);
+
+        h = hashmap_rcu_write_lock(m);
+        *(int *)hashmap_insert(h, "a").pair.userdata = 1;
+        hashmap_rcu_write_unlock(m);
+        assert(calls > 0);
+        assert(c.allocs > c.frees);
+
+        hashmap_rcu_delete(m);
+        assert(c.frees == c.allocs);
+    }
+}
+
+static void test_build(void)
+{
+    static char storage[5000][16];
+    const char *keys[5000];
+    struct counting c = { 0, 0, 0 };
+    struct hashmap_allocator allocator = { counting_alloc, counting_free, &c };
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .sizing = HASHMAP_SIZING_POW2, .inline_key_size = 8 },
+        { .incremental_rehash = true },
+        { .slab = true },
+        { .allocator = &allocator, .key_arena = true },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+        { .allocator = &allocator, .layout = HASHMAP_LAYOUT_DENSE },
+        { .filter = true, .incremental_rehash = true },
+        { .allocator = &allocator, .inline_key_size = 4 },
+    };
+    size_t threads[] = { 4, 3, 0, 2, 1, 8, 2, 3, 4 };
+    size_t o;
+    int i;
+
+    // Every tenth key repeats the one before it.
+    for (i = 0; i < 5000; ++i) {
+        snprintf(storage[i], sizeof(storage[i]), "k%d", i % 10 == 9 ? i - 1 : i);
+        keys[i] = storage[i];
+    }
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        size_t buckets;
+
+        // Some elements already present, some of them also in the keys.
+        insert(h, "bacteria", -1);
+        insert(h, "k3", 3);
+        for (i = 0; i < 100; ++i) {
+            char key[16];
+
+            snprintf(key, sizeof(key), "n%d", i);
+            insert(h, key, 0);
+        }
+        assert(hashmap_rehash_step(h, 0) == (o == 2 || o == 7));
+
+        assert(hashmap_build(h, keys, 5000, threads[o]) == 4500 - 1);
+        assert(hashmap_size(h) == 4500 + 101);
+        buckets = hashmap_bucket_count(h);
+
+        for (i = 0; i < 5000; ++i) {
+            struct hashmap_iter *iter = hashmap_find(h, keys[i]);
+
+            assert(iter != hashmap_end(h));
+            assert(!strcmp(hashmap_iter_deref(iter).key, keys[i]));
+            ((struct bucket *)hashmap_iter_deref(iter).userdata)->value = i % 10 == 9 ? i - 1 : i;
+        }
+        for (i = 0; i < 5000; ++i) {
+            check_element(h, hashmap_bucket(h, keys[i]), keys[i], i % 10 == 9 ? i - 1 : i);
+        }
+        check_element(h, hashmap_bucket(h, "bacteria"), "bacteria", -1);
+        assert(hashmap_bucket_count(h) == buckets);
+
+        if (!options[o].layout) {
+            check_contiguous(h);
+        }
+
+        assert(hashmap_build(h, keys, 5000, threads[o]) == 0);
+        assert(hashmap_build(h, keys, 0, threads[o]) == 0);
+
+        hashmap_delete(h);
+    }
+
+    assert(c.frees == c.allocs);
+    assert(c.bytes == 0);
+}
+
+static void test_snapshot(void)
+{
+    const char *path = "test_hashmap.snapshot";
+    struct hashmap_hasher hasher = { djb2, NULL };
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .hasher = &hasher },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+    };
+    const char *keys[] = { "k7", "missing" };
+    struct hashmap_iter *iters[2];
+    struct hashmap_insert_ret rets[2];
+    size_t o;
+    int i;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        struct hashmap *m;
+        struct hashmap *n;
+        struct hashmap_iter *iter;
+        struct hashmap_insert_ret ret;
+        size_t count = 0;
+        size_t total = 0;
+        size_t previous = 0;
+
+        for (i = 0; i < 1000; ++i) {
+            char key[16];
+
+            snprintf(key, sizeof(key), "k%d", i);
+            insert(h, key, i);
+        }
+        hashmap_insert_n(h, "nul\0key", 7);
+        assert(hashmap_save(h, path) == 0);
+        hashmap_delete(h);
+
+        // Two mappings of the same file, at different addresses.
+        m = hashmap_open(path, o == 1 ? &options[o] : NULL);
+        n = hashmap_open(path, o == 1 ? &options[o] : NULL);
+        assert(m && n);
+        assert(hashmap_size(m) == 1001);
+        assert(!hashmap_empty(m));
+
+        for (i = 0; i < 1000; ++i) {
+            char key[16];
+
+            snprintf(key, sizeof(key), "k%d", i);
+            check_element(m, hashmap_bucket(m, key), key, i);
+            check_element(n, hashmap_bucket(n, key), key, i);
+        }
+        assert(hashmap_find_n(m, "nul\0key", 7) != hashmap_end(m));
+        assert(hashmap_find_n(m, "nul\0kez", 7) == hashmap_end(m));
+        assert(hashmap_find(m, "k1000") == hashmap_end(m));
+
+        // Entries are in bucket order.
+        for (iter = hashmap_begin(m); iter != hashmap_end(m); iter = hashmap_iter_inc(iter)) {
+            struct hashmap_pair pair = hashmap_iter_deref(iter);
+            size_t bucket = hashmap_hash_n(m, pair.key, pair.length) & (hashmap_bucket_count(m) - 1);
+
+            assert(bucket >= previous);
+            previous = bucket;
+            assert(hashmap_find_n(m, pair.key, pair.length) == iter);
+            assert(pair.key[pair.length] == '\0');
+            count++;
+        }
+        assert(count == 1001);
+        assert(hashmap_iter_inc(hashmap_end(m)) == hashmap_end(m));
+        assert(hashmap_iter_deref(hashmap_end(m)).key == NULL);
+        assert(hashmap_iter_deref(hashmap_end(m)).userdata == NULL);
+        assert(hashmap_iter_deref(hashmap_end(m)).length == 0);
+
+        assert(hashmap_bucket_count(m) == 1024);
+        for (count = 0; count < hashmap_bucket_count(m); ++count) {
+            total += hashmap_bucket_size(m, count);
+        }
+        assert(total == 1001);
+        assert(hashmap_bucket_size(m, 1024) == 0);
+
+        // Read-only: modifications report or do nothing.
+        ret = hashmap_insert(m, "k5");
+        assert(!ret.ok);
+        assert(((struct bucket *)ret.pair.userdata)->value == 5);
+        ret = hashmap_insert(m, "new");
+        assert(!ret.ok);
+        assert(ret.pair.key == NULL);
+        hashmap_insert_batch(m, keys, 2, rets);
+        assert(!rets[0].ok && !rets[1].ok);
+        hashmap_find_batch(m, keys, 2, iters);
+        assert(iters[0] == hashmap_find(m, "k7"));
+        assert(iters[1] == hashmap_end(m));
+        hashmap_erase(m, hashmap_find(m, "k5"));
+        hashmap_erase(m, hashmap_end(m));
+        assert(!hashmap_erase_n(m, "k6", 2));
+        assert(hashmap_erase_batch(m, keys, 2) == 0);
+        assert(hashmap_build(m, keys, 2, 1) == 0);
+        hashmap_clear(m);
+        hashmap_rehash(m, 4096);
+        hashmap_reserve(m, 4096);
+        hashmap_max_load_factor_set(m, 0.5f);
+        assert(hashmap_size(m) == 1001);
+        assert(hashmap_bucket_count(m) == 1024);
+        assert(hashmap_max_load_factor(m) == 1.0f);
+        assert(!hashmap_rehash_step(m, 1));
+
+        // A snapshot of a snapshot.
+        assert(hashmap_save(m, path) == 0);
+        hashmap_delete(m);
+        hashmap_delete(n);
+        m = hashmap_open(path, o == 1 ? &options[o] : NULL);
+        check_element(m, hashmap_bucket(m, "k999"), "k999", 999);
+        hashmap_delete(m);
+    }
+
+    // Empty map.
+    {
+        struct hashmap *h = hashmap_new(0);
+
+        assert(hashmap_save(h, path) == 0);
+        hashmap_delete(h);
+
+        h = hashmap_open(path, NULL);
+        assert(hashmap_empty(h));
+        assert(hashmap_begin(h) == hashmap_end(h));
+        assert(hashmap_find(h, "k") == hashmap_end(h));
+        assert(hashmap_bucket_count(h) == 1);
+        assert(hashmap_bucket(h, "k") == 0);
+        hashmap_delete(h);
+    }
+
+    // Files that are not snapshots.
+    {
+        struct hashmap *h = hashmap_new(0);
+        char junk[256];
+        FILE *fp;
+
+        assert(hashmap_save(h, "/nonexistent/test_hashmap.snapshot") == -ENOENT);
+        mkdir("test_hashmap.dir", 0700);
+        assert(hashmap_save(h, "test_hashmap.dir") == -EISDIR);
+        rmdir("test_hashmap.dir");
+        hashmap_delete(h);
+
+        errno = 0;
+        assert(hashmap_open("/nonexistent/test_hashmap.snapshot", NULL) == NULL);
+        assert(errno == ENOENT);
+        errno = 0;
+        assert(hashmap_open("/", NULL) == NULL);
+        assert(errno != 0);
+
+        memset(junk, 0, sizeof(junk));
+        fp = fopen(path, "wb");
+        fwrite(junk, 1, 16, fp);
+        fclose(fp);
+        errno = 0;
+        assert(hashmap_open(path, NULL) == NULL);
+        assert(errno == EINVAL);
+
+        fp = fopen(path, "wb");
+        fwrite(junk, 1, sizeof(junk), fp);
+        fclose(fp);
+        errno = 0;
+        assert(hashmap_open(path, NULL) == NULL);
+        assert(errno == EINVAL);
+    }
+
+    // Damaged headers: version, bucket count, entry offset, element count too large and too small, element size;
+    // damaged index: first entry of the first bucket; damaged entries: key length, key offset, stride and end mark.
+    {
+        static const struct {
+            /* Entry whose field is damaged, or -1 for an offset from the start of the file. */
+            int entry;
+            size_t offset;
+            uint64_t delta;
+        } damage[] = {
+            { -1, 8, 1 }, { -1, 24, 1 }, { -1, 48, 8 }, { -1, 16, 1000 }, { -1, 16, (uint64_t)-1 },
+            { -1, 32, (uint64_t)1 << 40 }, { -1, 80, 3 },
+            { 0, 8, 1 }, { 1, 8, 1000 }, { 0, 16, 4096 }, { 1, 16, (uint64_t)-4096 }, { 1, 24, 8 }, { 2, 24, (uint64_t)1 << 32 },
+        };
+        struct hashmap *h = hashmap_new(sizeof(struct bucket));
+        unsigned char image[4096];
+        size_t length;
+        size_t d;
+        FILE *fp;
+
+        insert(h, "a", 0);
+        insert(h, "b", 0);
+        assert(hashmap_save(h, path) == 0);
+        hashmap_delete(h);
+
+        fp = fopen(path, "rb");
+        length = fread(image, 1, sizeof(image), fp);
+        fclose(fp);
+
+        for (d = 0; d < sizeof(damage) / sizeof(*damage); ++d) {
+            unsigned char copy[4096];
+            uint64_t entries;
+            uint64_t stride;
+            uint64_t field;
+            size_t offset = damage[d].offset;
+
+            memcpy(&stride, image + 40, sizeof(stride));
+            memcpy(&entries, image + 48, sizeof(entries));
+            if (damage[d].entry >= 0) {
+                offset += entries + (size_t)damage[d].entry * stride;
+            }
+
+            memcpy(copy, image, length);
+            memcpy(&field, copy + offset, sizeof(field));
+            field += damage[d].delta;
+            memcpy(copy + offset, &field, sizeof(field));
+
+            fp = fopen(path, "wb");
+            fwrite(copy, 1, length, fp);
+            fclose(fp);
+            errno = 0;
+            assert(hashmap_open(path, NULL) == NULL);
+            assert(errno == EINVAL);
+        }
+    }
+
+    remove(path);
+}
+
+/// Every key has the same hash.
+static size_t constant(void *context, const void *key, size_t len)
+{
+    (void)context;
+    (void)key;
+    (void)len;
+    return 42;
+}
+
+static void test_freeze(void)
+{
+    const char *path = "test_hashmap.snapshot";
+    struct hashmap_hasher hasher = { djb2, NULL };
+    struct hashmap_hasher same = { constant, NULL };
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .hasher = &hasher, .slab = true, .key_arena = true },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+    };
+    size_t sizes[] = { 0, 1, 5, 3000 };
+    size_t o;
+    size_t s;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        for (s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+            struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+            struct hashmap_iter *iter;
+            size_t count = 0;
+            size_t n;
+            int i;
+
+            for (i = 0; i < (int)sizes[s]; ++i) {
+                char key[16];
+
+                snprintf(key, sizeof(key), "key%d", i);
+                insert(h, key, i);
+            }
+
+            assert(hashmap_freeze(h));
+            assert(hashmap_size(h) == sizes[s]);
+            assert(hashmap_bucket_count(h) == (sizes[s] ? sizes[s] : 1));
+
+            // Each element has a slot of its own.
+            for (i = 0; i < (int)sizes[s]; ++i) {
+                char key[16];
+
+                snprintf(key, sizeof(key), "key%d", i);
+                check_element(h, hashmap_bucket(h, key), key, i);
+            }
+            for (n = 0; n < hashmap_bucket_count(h); ++n) {
+                assert(hashmap_bucket_size(h, n) == (n < sizes[s]));
+            }
+            assert(hashmap_bucket_size(h, hashmap_bucket_count(h)) == 0);
+            assert(hashmap_find(h, "key-1") == hashmap_end(h));
+            assert(hashmap_find(h, "") == hashmap_end(h));
+
+            for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+                struct hashmap_pair pair = hashmap_iter_deref(iter);
+
+                assert(hashmap_find(h, pair.key) == iter);
+                ((struct bucket *)pair.userdata)->value += 1;
+                count++;
+            }
+            assert(count == sizes[s]);
+
+            // Userdata stays writable, and a saved frozen map is still perfect.
+            assert(hashmap_save(h, path) == 0);
+            assert(hashmap_freeze(h));
+            hashmap_delete(h);
+
+            h = hashmap_open(path, &options[o]);
+            assert(hashmap_bucket_count(h) == (sizes[s] ? sizes[s] : 1));
+            for (i = 0; i < (int)sizes[s]; ++i) {
+                char key[16];
+
+                snprintf(key, sizeof(key), "key%d", i);
+                check_element(h, hashmap_bucket(h, key), key, i + 1);
+            }
+            hashmap_delete(h);
+        }
+    }
+
+    // Keys of equal hash cannot be separated.
+    {
+        struct hashmap_options collide = { .hasher = &same };
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &collide);
+
+        insert(h, "a", 1);
+        insert(h, "b", 2);
+        assert(!hashmap_freeze(h));
+        check_element(h, 42 % hashmap_bucket_count(h), "a", 1);
+        check_element(h, 42 % hashmap_bucket_count(h), "b", 2);
+        hashmap_delete(h);
+    }
+
+    remove(path);
+}
+
+static void test_shrink(void)
+{
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .sizing = HASHMAP_SIZING_POW2 },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+    };
+    const char *keys[] = { "k0", "k1", "k2" };
+    size_t o;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        size_t peak;
+        size_t buckets;
+        size_t shrinks = 0;
+        char key[16];
+        int i;
+
+        for (i = 0; i < 10000; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            insert(h, key, i);
+        }
+        peak = hashmap_bucket_count(h);
+
+        // No policy: erasing keeps the buckets, shrink_to_fit releases them.
+        for (i = 10; i < 10000; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            assert(hashmap_erase_n(h, key, strlen(key)));
+        }
+        assert(hashmap_bucket_count(h) == peak);
+        hashmap_shrink_to_fit(h);
+        assert(hashmap_bucket_count(h) < 32);
+        assert(hashmap_load_factor(h) <= hashmap_max_load_factor(h));
+        for (i = 0; i < 10; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            check_element(h, hashmap_bucket(h, key), key, i);
+        }
+        buckets = hashmap_bucket_count(h);
+        hashmap_shrink_to_fit(h);
+        assert(hashmap_bucket_count(h) == buckets);
+
+        // The minimum is capped at a quarter of the maximum.
+        assert(hashmap_min_load_factor(h) == 0);
+        hashmap_min_load_factor_set(h, 0.9f);
+        assert(hashmap_min_load_factor(h) == hashmap_max_load_factor(h) / 4);
+        hashmap_max_load_factor_set(h, 0.5f);
+        assert(hashmap_min_load_factor(h) == hashmap_max_load_factor(h) / 4);
+        hashmap_min_load_factor_set(h, -1);
+        assert(hashmap_min_load_factor(h) == 0);
+        hashmap_min_load_factor_set(h, 0.1f);
+        assert(hashmap_min_load_factor(h) == 0.1f);
+
+        for (i = 10; i < 10000; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            insert(h, key, i);
+        }
+        peak = hashmap_bucket_count(h);
+
+        // Downsizing keeps the load factor above the minimum, a few times over the whole way down.
+        buckets = peak;
+        for (i = 9999; i >= 100; --i) {
+            snprintf(key, sizeof(key), "k%d", i);
+
+            if (i % 3 == 0) {
+                hashmap_erase(h, hashmap_find(h, key));
+
+            } else if (i % 3 == 1) {
+                assert(hashmap_erase_with_hash(h, key, hashmap_hash(h, key)));
+
+            } else {
+                const char *batch[] = { key };
+
+                assert(hashmap_erase_batch(h, batch, 1) == 1);
+            }
+
+            assert(hashmap_load_factor(h) >= hashmap_min_load_factor(h));
+            shrinks += hashmap_bucket_count(h) != buckets;
+            buckets = hashmap_bucket_count(h);
+        }
+        assert(buckets < peak);
+        assert(shrinks > 0 && shrinks < 10);
+
+        // Oscillating around the threshold does not thrash.
+        for (i = 0; i < 1000; ++i) {
+            snprintf(key, sizeof(key), "x%d", i % 2);
+
+            if (i % 4 < 2) {
+                insert(h, key, 0);
+
+            } else {
+                assert(hashmap_erase_n(h, key, strlen(key)));
+            }
+        }
+        assert(hashmap_bucket_count(h) == buckets);
+
+        for (i = 0; i < 100; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            check_element(h, hashmap_bucket(h, key), key, i);
+        }
+        if (!options[o].layout) {
+            check_contiguous(h);
+        }
+
+        // Clearing drops to the smallest table.
+        hashmap_clear(h);
+        assert(hashmap_bucket_count(h) < 32);
+        insert(h, "again", 1);
+        check_element(h, hashmap_bucket(h, "again"), "again", 1);
+
+        hashmap_delete(h);
+    }
+
+    // An incremental rehash is never interrupted by downsizing.
+    {
+        struct hashmap_options incremental = { .incremental_rehash = true };
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &incremental);
+        char key[16];
+        int i;
+
+        hashmap_min_load_factor_set(h, 0.25f);
+        for (i = 0; i < 1000 || !hashmap_rehash_step(h, 0); ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            insert(h, key, i);
+        }
+        assert(hashmap_erase_batch(h, keys, 3) == 3);
+        assert(hashmap_rehash_step(h, 0));
+        hashmap_shrink_to_fit(h);
+        assert(!hashmap_rehash_step(h, 0));
+        assert(hashmap_load_factor(h) <= hashmap_max_load_factor(h));
+        hashmap_delete(h);
+    }
+
+    // Frozen maps keep their table.
+    {
+        struct hashmap *h = hashmap_new(sizeof(struct bucket));
+
+        insert(h, "a", 1);
+        hashmap_rehash(h, 1000);
+        assert(hashmap_freeze(h));
+        hashmap_min_load_factor_set(h, 0.25f);
+        hashmap_shrink_to_fit(h);
+        assert(hashmap_bucket_count(h) == 1);
+        check_element(h, 0, "a", 1);
+        hashmap_delete(h);
+    }
+}
+
+static void test_swiss(void)
+{
+    struct hashmap_options options = { .layout = HASHMAP_LAYOUT_SWISS };
+    struct hashmap *h;
+    struct hashmap_iter *iter;
+    struct hashmap_insert_ret ret;
+    struct hashmap_pair pair;
+    char key[16];
+    int group[17];
+    size_t count;
+    float d;
+    int i;
+
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    assert(hashmap_empty(h));
+    assert(hashmap_bucket_count(h) == 16);
+    assert(hashmap_begin(h) == hashmap_end(h));
+    assert(hashmap_iter_inc(hashmap_end(h)) == hashmap_end(h));
+
+    pair = hashmap_iter_deref(hashmap_end(h));
+    assert(NULL == pair.key);
+    assert(NULL == pair.userdata);
+
+    d = fabsf(0.875f - hashmap_max_load_factor(h));
+    assert(d <= FLT_MIN);
+    hashmap_max_load_factor_set(h, 1.f);
+    d = fabsf(0.875f - hashmap_max_load_factor(h));
+    assert(d <= FLT_MIN);
+
+    hashmap_reserve(h, 50);
+    assert(hashmap_bucket_count(h) == 64);
+
+    // NOP
+    hashmap_rehash(h, 50);
+    assert(hashmap_bucket_count(h) == 64);
+
+    insert(h, "bacteria", 10);
+    ret = hashmap_insert(h, "bacteria");
+    assert(ret.ok == false);
+    assert(((struct bucket *)ret.pair.userdata)->value == 10);
+    insert(h, "adept", 2);
+    insert(h, "choir", 4);
+    assert(hashmap_size(h) == 3);
+
+    check_element(h, hashmap_bucket(h, "adept"), "adept", 2);
+    assert(1 == hashmap_bucket_size(h, hashmap_bucket(h, "choir")));
+    assert(0 == hashmap_bucket_size(h, hashmap_bucket_count(h)));
+    assert(hashmap_find(h, "alumnal") == hashmap_end(h));
+    assert(hashmap_bucket(h, "alumnal") < hashmap_bucket_count(h));
+
+    d = fabsf(3 / 64.f - hashmap_load_factor(h));
+    assert(d <= FLT_MIN);
+
+    iter = hashmap_find(h, "adept");
+    hashmap_erase(h, iter);
+    hashmap_erase(h, hashmap_end(h));
+    assert(hashmap_size(h) == 2);
+    assert(hashmap_find(h, "adept") == hashmap_end(h));
+
+    count = 0;
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        pair = hashmap_iter_deref(iter);
+        assert(!strcmp(pair.key, "bacteria") || !strcmp(pair.key, "choir"));
+        count++;
+    }
+    assert(count == 2);
+
+    hashmap_clear(h);
+    assert(hashmap_empty(h));
+    assert(hashmap_begin(h) == hashmap_end(h));
+
+    // Grow from the minimum size, then churn through tombstones.
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(hashmap_size(h) == 2000);
+    assert(hashmap_bucket_count(h) == 4096);
+
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    for (i = 1000; i < 50000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        if (i >= 2000) {
+            insert(h, key, i);
+        }
+        snprintf(key, sizeof(key), "k%d", i - 1000);
+        hashmap_erase(h, hashmap_find(h, key));
+    }
+    assert(hashmap_size(h) == 1000);
+    assert(hashmap_bucket_count(h) == 4096);
+
+    hashmap_max_load_factor_set(h, 0.25f);
+    assert(hashmap_bucket_count(h) == 4096);
+    hashmap_max_load_factor_set(h, 0.875f);
+
+    count = 0;
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        pair = hashmap_iter_deref(iter);
+        assert(hashmap_find(h, pair.key) == iter);
+        count++;
+    }
+    assert(count == 1000);
+
+    hashmap_delete(h);
+
+
+    // Erasing from a full group leaves tombstones, which are purged in place.
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    hashmap_reserve(h, 20);
+    assert(hashmap_bucket_count(h) == 32);
+
+    for (i = 0, count = 0; count < 17; ++i) {
+        snprintf(key, sizeof(key), "g%d", i);
+        if (hashmap_bucket(h, key) == 0) {
+            insert(h, key, i);
+            group[count++] = i;
+        }
+    }
+
+    for (count = 0; count < 16; ++count) {
+        snprintf(key, sizeof(key), "g%d", group[count]);
+        hashmap_erase(h, hashmap_find(h, key));
+    }
+    assert(hashmap_size(h) == 1);
+
+    for (i = 0, count = 0; count < 12; ++i) {
+        snprintf(key, sizeof(key), "g%d", i);
+        if (hashmap_bucket(h, key) == 16 && hashmap_find(h, key) == hashmap_end(h)) {
+            insert(h, key, i);
+            count++;
+        }
+    }
+    assert(hashmap_size(h) == 13);
+    assert(hashmap_bucket_count(h) == 32);
+
+    snprintf(key, sizeof(key), "g%d", group[16]);
+    check_element(h, hashmap_bucket(h, key), key, group[16]);
+
+    hashmap_delete(h);
+}
+
+/// @return size_t Elements counted by a chain-length histogram.
+static size_t histogram_elements(const struct hashmap_stats *stats)
+{
+    size_t elements = 0;
+    size_t i;
+
+    for (i = 0; i < HASHMAP_STATS_CHAIN_LENGTHS; ++i) {
+        elements += i * stats->chain_lengths[i];
+    }
+
+    return elements;
+}
+
+/// @return size_t Buckets counted by a chain-length histogram.
+static size_t histogram_buckets(const struct hashmap_stats *stats)
+{
+    size_t buckets = 0;
+    size_t i;
+
+    for (i = 0; i < HASHMAP_STATS_CHAIN_LENGTHS; ++i) {
+        buckets += stats->chain_lengths[i];
+    }
+
+    return buckets;
+}
+
+static void test_stats(void)
+{
+    const char *path = "test_hashmap.snapshot";
+    struct hashmap_hasher same = { constant, NULL };
+    struct hashmap_options options[] = {
+        { .stats = true },
+        { .stats = true, .incremental_rehash = true },
+        { .stats = true, .slab = true, .key_arena = true },
+        { .stats = true, .inline_key_size = 8, .sizing = HASHMAP_SIZING_POW2 },
+        { .stats = true, .layout = HASHMAP_LAYOUT_SWISS },
+        { .stats = true, .layout = HASHMAP_LAYOUT_DENSE },
+    };
+    struct hashmap_options plain = { .layout = HASHMAP_LAYOUT_CHAINED };
+    struct hashmap_options flooded = { .stats = true, .hasher = &same };
+    struct hashmap_stats stats;
+    struct hashmap *h;
+    char key[16];
+    size_t o;
+    int i;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+
+        hashmap_stats(h, &stats);
+        assert(stats.lookups == 0);
+        assert(stats.average_probe_length == 0);
+        assert(stats.allocated_bytes > 0);
+
+        // Each insert misses once, then every find and erase searches once.
+        for (i = 0; i < 1000; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            insert(h, key, i);
+        }
+        for (i = 0; i < 1100; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            hashmap_find(h, key);
+        }
+        for (i = 0; i < 10; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            assert(hashmap_erase_n(h, key, strlen(key)));
+        }
+
+        hashmap_stats(h, &stats);
+        assert(stats.lookups == 2110);
+        assert(stats.hits == 1010);
+        assert(stats.misses == 1100);
+        assert(stats.probes >= stats.hits);
+        assert(stats.max_probe_length >= 1);
+        assert(stats.average_probe_length > 0);
+        assert(stats.average_probe_length <= (double)stats.max_probe_length);
+        assert(stats.rehashes > 0);
+        assert(stats.rehash_seconds >= 0);
+        assert(stats.allocated_bytes > 990 * (strlen("key0") + sizeof(struct bucket)));
+
+        if (options[o].layout != HASHMAP_LAYOUT_CHAINED) {
+            assert(histogram_buckets(&stats) == hashmap_size(h));
+
+        } else {
+            assert(histogram_elements(&stats) == hashmap_size(h));
+            assert(histogram_buckets(&stats) >= hashmap_bucket_count(h));
+            hashmap_rehash_step(h, SIZE_MAX);
+            hashmap_stats(h, &stats);
+            assert(histogram_buckets(&stats) == hashmap_bucket_count(h));
+        }
 
-struct bucket {
-    int value;
-    char data[16];
-};
+        // Read-only maps count lookups too.
+        assert(hashmap_freeze(h));
+        hashmap_find(h, "key500");
+        hashmap_find(h, "key1000");
+        hashmap_stats(h, &stats);
+        assert(stats.lookups == 2112);
+        assert(stats.misses == 1101);
+        assert(stats.max_probe_length >= 1);
+        assert(histogram_elements(&stats) == hashmap_size(h));
+        assert(stats.allocated_bytes > 990 * sizeof(struct bucket));
 
-static void insert(struct hashmap *h, const char *key, int value)
+        assert(hashmap_save(h, path) == 0);
+        hashmap_delete(h);
+
+        h = hashmap_open(path, &options[o]);
+        assert(hashmap_find(h, "key500") != hashmap_end(h));
+        hashmap_stats(h, &stats);
+        assert(stats.lookups == 1);
+        assert(stats.probes == 1);
+        hashmap_delete(h);
+    }
+
+    // Without the option only the table is described.
+    h = hashmap_new_with(sizeof(struct bucket), &plain);
+    for (i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    hashmap_stats(h, &stats);
+    assert(stats.lookups == 0);
+    assert(stats.rehashes == 0);
+    assert(stats.allocated_bytes > 100 * sizeof(struct bucket));
+    assert(histogram_elements(&stats) == 100);
+    assert(hashmap_save(h, path) == 0);
+    hashmap_delete(h);
+
+    h = hashmap_open(path, NULL);
+    hashmap_stats(h, &stats);
+    assert(stats.lookups == 0);
+    assert(histogram_elements(&stats) == 100);
+    hashmap_delete(h);
+    remove(path);
+
+    // Hash flooding shows up as one long chain and long probes.
+    h = hashmap_new_with(sizeof(struct bucket), &flooded);
+    for (i = 0; i < 20; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    hashmap_stats(h, &stats);
+    assert(stats.chain_lengths[HASHMAP_STATS_CHAIN_LENGTHS - 1] == 1);
+    assert(stats.max_probe_length == 19);
+    hashmap_delete(h);
+
+    // In the swiss layout the keys overflow their first group into the next.
+    flooded.layout = HASHMAP_LAYOUT_SWISS;
+    h = hashmap_new_with(sizeof(struct bucket), &flooded);
+    for (i = 0; i < 20; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    hashmap_stats(h, &stats);
+    assert(stats.chain_lengths[0] == 16);
+    assert(stats.chain_lengths[1] == 4);
+    assert(stats.max_probe_length == 2);
+    hashmap_delete(h);
+}
+
+static void test_reseed(void)
 {
-    struct hashmap_insert_ret ret;
-    struct bucket *b;
+    struct hashmap_options random = { .stats = true };
+    struct hashmap_options seeded = { .seed = 7 };
+    struct hashmap_options filtered = { .stats = true, .filter = true, .sizing = HASHMAP_SIZING_POW2 };
+    const char *batch[] = { "target", "a", "b" };
+    struct hashmap_insert_ret rets[3];
+    struct hashmap_stats stats;
+    struct hashmap *h;
+    struct hashmap *g;
+    size_t target;
+    size_t i;
+    char key[16];
 
-    ret = hashmap_insert(h, key);
-    assert(ret.ok == true);
+    // Each map draws its own seed, unless one is given.
+    h = hashmap_new_with(sizeof(struct bucket), &random);
+    g = hashmap_new_with(sizeof(struct bucket), &random);
+    assert(hashmap_hash(h, "x") != hashmap_hash(g, "x"));
+    hashmap_delete(g);
 
-    b = (struct bucket *)ret.pair.userdata;
-    b->value = value;
-    memset(b->data, 0xCC, sizeof(b->data));
+    g = hashmap_new_with(sizeof(struct bucket), &seeded);
+    target = hashmap_hash(g, "target");
+    hashmap_delete(g);
+    g = hashmap_new_with(sizeof(struct bucket), &seeded);
+    assert(hashmap_hash(g, "target") == target);
+
+    // Simulate keys that collide under the seed: a given seed is kept however long the chain.
+    for (i = 0; i < 40; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        assert(hashmap_insert_with_hash(g, key, target).ok);
+    }
+    assert(hashmap_hash(g, "target") == target);
+    assert(hashmap_bucket_size(g, hashmap_bucket(g, "target")) == 40);
+    hashmap_delete(g);
+
+    // A random seed is replaced, and every key hashed again, once an insert meets a flooded chain;
+    // here the insert of "target" in a batch, whose other keys must then hash under the new seed.
+    target = hashmap_hash(h, "target");
+    for (i = 0; i < 32; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        assert(hashmap_insert_with_hash(h, key, target).ok);
+    }
+    hashmap_stats(h, &stats);
+    assert(stats.reseeds == 0);
+    assert(stats.max_probe_length == 31);
+
+    hashmap_insert_batch(h, batch, 3, rets);
+    for (i = 0; i < 3; ++i) {
+        assert(rets[i].ok);
+        assert(!strcmp(rets[i].pair.key, batch[i]));
+    }
+
+    hashmap_stats(h, &stats);
+    assert(stats.reseeds == 1);
+    assert(hashmap_hash(h, "target") != target);
+    assert(stats.chain_lengths[HASHMAP_STATS_CHAIN_LENGTHS - 1] == 0);
+
+    for (i = 0; i < 32; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        assert(hashmap_find(h, key) != hashmap_end(h));
+        assert(hashmap_find_with_hash(h, key, hashmap_hash(h, key)) != hashmap_end(h));
+    }
+    for (i = 0; i < 3; ++i) {
+        assert(hashmap_find(h, batch[i]) == hashmap_find_n(h, rets[i].pair.key, rets[i].pair.length));
+        assert(hashmap_find(h, batch[i]) != hashmap_end(h));
+    }
+    assert(hashmap_size(h) == 35);
+    hashmap_delete(h);
+
+    // Distinct hashes that share one bucket flood it just the same when the filter rejects each new key.
+    h = hashmap_new_with(sizeof(struct bucket), &filtered);
+    hashmap_reserve(h, 5000);
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        assert(hashmap_insert_with_hash(h, key, i << 32).ok);
+    }
+
+    // Each chain forms anew after a reseed; the next reseed waits until the map has doubled.
+    hashmap_stats(h, &stats);
+    assert(stats.reseeds == 6);
+    assert(stats.filtered > 0);
+    assert(hashmap_size(h) == 2000);
+    hashmap_delete(h);
+
+    // Keys that zero a factor of the hash's first multiply (bytes equal to its secret) still hash under
+    // the seed, so they neither collide nor set off a reseed.
+    h = hashmap_new_with(sizeof(struct bucket), &random);
+    for (i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        insert(h, key, (int)i);
+    }
+    for (i = 0; i < 500; ++i) {
+        const uint64_t zero = 0x8bb84b93962eacc9ull;
+        uint32_t halves[3] = { (uint32_t)(zero >> 32), (uint32_t)zero, (uint32_t)i };
+        unsigned char wide[40];
+
+        memset(wide, 'x', sizeof(wide));
+        memcpy(wide, &zero, sizeof(zero));
+        memcpy(wide + 8, &i, sizeof(i));
+        assert(hashmap_insert_n(h, wide, sizeof(wide)).ok);
+        assert(hashmap_insert_n(h, halves, sizeof(halves)).ok);
+    }
+
+    hashmap_stats(h, &stats);
+    assert(stats.reseeds == 0);
+    assert(stats.max_probe_length < 32);
+    assert(hashmap_size(h) == 2000);
+    hashmap_delete(h);
 }
 
-static void check_element(struct hashmap *h, size_t bucket, const char *key, int value)
+/// Initialise a bucket with the value at @c context, counting calls in the value's neighbour.
+static void init_bucket(void *context, void *userdata)
+{
+    int *values = (int *)context;
+    struct bucket *b = (struct bucket *)userdata;
+
+    b->value = values[0];
+    memset(b->data, 0, sizeof(b->data));
+    values[1]++;
+}
+
+static void test_take(void)
+{
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .inline_key_size = 8 },
+        { .key_arena = true, .slab = true },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+    };
+    const char *long_key = "a key too long to be stored inline";
+    size_t o;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        bool adopts = !options[o].key_arena;
+        struct hashmap_insert_ret ret;
+        int values[2] = { 7, 0 };
+        char *key;
+
+        // A miss adopts the key, unless it belongs inline or in the arena; a hit frees it.
+        key = strdup(long_key);
+        ret = hashmap_insert_take(h, key);
+        assert(ret.ok);
+        assert(!strcmp(ret.pair.key, long_key));
+        assert(ret.pair.length == strlen(long_key));
+        assert((ret.pair.key == key) == adopts);
+        ((struct bucket *)ret.pair.userdata)->value = 1;
+
+        ret = hashmap_insert_take(h, strdup(long_key));
+        assert(!ret.ok);
+        assert(((struct bucket *)ret.pair.userdata)->value == 1);
+
+        key = strdup("short");
+        ret = hashmap_insert_take(h, key);
+        assert(ret.ok);
+        assert(!strcmp(ret.pair.key, "short"));
+        assert((ret.pair.key == key) == (adopts && !options[o].inline_key_size));
+        assert(hashmap_find(h, "short") != hashmap_end(h));
+
+        // Userdata is initialised before try_emplace returns, and only on a miss.
+        ret = hashmap_try_emplace(h, "emplaced", init_bucket, values);
+        assert(ret.ok);
+        assert(((struct bucket *)ret.pair.userdata)->value == 7);
+        values[0] = 8;
+        ret = hashmap_try_emplace(h, "emplaced", init_bucket, values);
+        assert(!ret.ok);
+        assert(((struct bucket *)ret.pair.userdata)->value == 7);
+        ret = hashmap_try_emplace(h, long_key, init_bucket, values);
+        assert(!ret.ok);
+        assert(((struct bucket *)ret.pair.userdata)->value == 1);
+        assert(values[1] == 1);
+        assert(hashmap_size(h) == 3);
+
+        // Adopted keys are freed like copied ones.
+        assert(hashmap_erase_n(h, long_key, strlen(long_key)));
+        assert(hashmap_find(h, long_key) == hashmap_end(h));
+
+        // A read-only map frees every key handed to it.
+        assert(hashmap_freeze(h));
+        ret = hashmap_insert_take(h, strdup("short"));
+        assert(!ret.ok);
+        assert(!strcmp(ret.pair.key, "short"));
+        assert(!hashmap_insert_take(h, strdup("absent")).ok);
+        assert(!hashmap_try_emplace(h, "absent", init_bucket, values).ok);
+        assert(values[1] == 1);
+        assert(hashmap_size(h) == 2);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Select elements whose value is not a multiple of the number at @c context, counting calls.
+static bool not_multiple_of(void *context, struct hashmap_pair pair)
+{
+    int *args = (int *)context;
+
+    args[1]++;
+    return ((struct bucket *)pair.userdata)->value % args[0] != 0;
+}
+
+static void test_erase_key(void)
+{
+    struct hashmap_options options[] = {
+        { .stats = true },
+        { .stats = true, .incremental_rehash = true },
+        { .stats = true, .slab = true, .sizing = HASHMAP_SIZING_POW2 },
+        { .stats = true, .layout = HASHMAP_LAYOUT_SWISS },
+        { .stats = true, .layout = HASHMAP_LAYOUT_DENSE },
+    };
+    size_t o;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        struct hashmap_iter *iter;
+        struct hashmap_stats stats;
+        struct bucket out = { -1, { 0 } };
+        size_t rehashes;
+        size_t count;
+        int args[2] = { 4, 0 };
+        char key[16];
+        int i;
+
+        for (i = 0; i < 1000; ++i) {
+            snprintf(key, sizeof(key), "k%d", i);
+            insert(h, key, i);
+        }
+
+        assert(hashmap_erase_key(h, "k5"));
+        assert(!hashmap_erase_key(h, "k5"));
+        assert(hashmap_find(h, "k5") == hashmap_end(h));
+
+        assert(hashmap_extract(h, "k6", &out));
+        assert(out.value == 6);
+        assert(hashmap_find(h, "k6") == hashmap_end(h));
+        assert(!hashmap_extract(h, "k6", &out));
+        assert(hashmap_extract(h, "k7", NULL));
+        assert(!hashmap_extract(NULL, "k8", &out));
+        assert(out.value == 6);
+        assert(hashmap_extract_n(h, "k9 and more", 2, &out));
+        assert(out.value == 9);
+        assert(!hashmap_extract_n(NULL, "k10", 3, &out));
+        assert(hashmap_size(h) == 996);
+
+        // One sweep keeps every fourth element, then shrinks the table once, unless a rehash is pending.
+        if (options[o].incremental_rehash) {
+            assert(hashmap_rehash_step(h, 0));
+        }
+        hashmap_min_load_factor_set(h, 0.25f);
+        hashmap_stats(h, &stats);
+        rehashes = stats.rehashes;
+
+        assert(hashmap_erase_if(h, not_multiple_of, args) == 746);
+        assert(args[1] == 996);
+        assert(hashmap_size(h) == 250);
+
+        hashmap_stats(h, &stats);
+        assert(stats.rehashes == rehashes + !options[o].incremental_rehash);
+
+        hashmap_rehash_step(h, SIZE_MAX);
+        count = 0;
+        for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+            struct hashmap_pair pair = hashmap_iter_deref(iter);
+            struct bucket *b = (struct bucket *)pair.userdata;
+
+            assert(b->value % 4 == 0);
+            check_element(h, hashmap_bucket(h, pair.key), pair.key, b->value);
+            count++;
+        }
+        assert(count == 250);
+
+        args[1] = 0;
+        assert(hashmap_erase_if(h, not_multiple_of, args) == 0);
+        assert(args[1] == 250);
+
+        // Read-only maps keep every element.
+        assert(hashmap_freeze(h));
+        args[0] = 1;
+        args[1] = 0;
+        assert(hashmap_erase_if(h, not_multiple_of, args) == 0);
+        assert(args[1] == 0);
+        assert(!hashmap_erase_key(h, "k4"));
+        assert(!hashmap_extract(h, "k4", &out));
+        assert(hashmap_size(h) == 250);
+
+        hashmap_delete(h);
+    }
+}
+
+/// Count an element and its value, then increment the value.
+static void tally(void *context, struct hashmap_pair pair)
+{
+    atomic_size_t *totals = (atomic_size_t *)context;
+    struct bucket *b = (struct bucket *)pair.userdata;
+
+    atomic_fetch_add(&totals[0], 1);
+    atomic_fetch_add(&totals[1], (size_t)b->value);
+    b->value++;
+}
+
+static void test_partition(void)
+{
+    const char *path = "test_hashmap.snapshot";
+    struct hashmap_options options[] = {
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .sizing = HASHMAP_SIZING_POW2, .incremental_rehash = true },
+        { .layout = HASHMAP_LAYOUT_SWISS },
+        { .layout = HASHMAP_LAYOUT_DENSE },
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+        { .layout = HASHMAP_LAYOUT_CHAINED },
+    };
+    size_t sizes[] = { 1100, 3, 0 };
+    size_t o;
+    size_t n;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        for (n = 0; n < sizeof(sizes) / sizeof(*sizes); ++n) {
+            struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+            struct hashmap_range ranges[64];
+            char *seen = (char *)calloc(sizes[n] + 1, 1);
+            atomic_size_t totals[2];
+            size_t count = 0;
+            size_t k;
+            size_t i;
+            char key[24];
+
+            for (i = 0; i < sizes[n]; ++i) {
+                snprintf(key, sizeof(key), "k%zu", i);
+                insert(h, key, (int)i);
+            }
+
+            // The last two rows scan a frozen map and a mapped bucketed image.
+            if (o == 4) {
+                assert(hashmap_freeze(h));
+
+            } else if (o == 5) {
+                assert(hashmap_save(h, path) == 0);
+                hashmap_delete(h);
+                h = hashmap_open(path, NULL);
+                remove(path);
+            }
+
+            if (options[o].incremental_rehash && sizes[n] == 1100) {
+                assert(hashmap_rehash_step(h, 0));
+            }
+
+            // Ranges are disjoint and cover the map, however many there are.
+            for (k = 1; k <= 64; k *= 4) {
+                struct hashmap_iter *iter;
+
+                hashmap_partition(h, k, ranges);
+                assert(!hashmap_rehash_step(h, 0));
+                assert(ranges[0].first == 0);
+                assert(ranges[k - 1].last == hashmap_bucket_count(h) || ranges[k - 1].last == hashmap_size(h));
+
+                memset(seen, 0, sizes[n] + 1);
+                count = 0;
+                for (i = 0; i < k; ++i) {
+                    assert(ranges[i].map == h);
+                    assert(i == 0 || ranges[i].first == ranges[i - 1].last);
+
+                    for (iter = hashmap_range_begin(&ranges[i]); iter != hashmap_end(h); iter = hashmap_range_inc(&ranges[i], iter)) {
+                        struct bucket *b = (struct bucket *)hashmap_iter_deref(iter).userdata;
+
+                        assert(!seen[b->value]);
+                        seen[b->value] = 1;
+                        count++;
+                    }
+                }
+                assert(count == sizes[n]);
+            }
+
+            // Every element is visited once, from any number of threads.
+            if (o < 4) {
+                atomic_init(&totals[0], 0);
+                atomic_init(&totals[1], 0);
+                hashmap_for_each_parallel(h, tally, totals, 3);
+                assert(atomic_load(&totals[0]) == sizes[n]);
+                assert(atomic_load(&totals[1]) == (sizes[n] ? sizes[n] * (sizes[n] - 1) / 2 : 0));
+
+                atomic_init(&totals[1], 0);
+                hashmap_for_each_parallel(h, tally, totals, 0);
+                assert(atomic_load(&totals[0]) == 2 * sizes[n]);
+                assert(atomic_load(&totals[1]) == (sizes[n] ? sizes[n] * (sizes[n] + 1) / 2 : 0));
+            }
+
+            free(seen);
+            hashmap_delete(h);
+        }
+    }
+}
+
+static void test_dense(void)
 {
+    struct hashmap_options options = { .layout = HASHMAP_LAYOUT_DENSE };
+    struct hashmap_hasher same = { constant, NULL };
+    struct hashmap_options flooded = { .layout = HASHMAP_LAYOUT_DENSE, .stats = true, .hasher = &same };
+    struct hashmap *h;
     struct hashmap_iter *iter;
+    struct hashmap_insert_ret ret;
+    struct hashmap_stats stats;
     struct hashmap_pair pair;
+    struct bucket out;
+    int args[2] = { 2, 0 };
+    char key[16];
+    size_t count;
+    float d;
+    int i;
 
-    iter = hashmap_find(h, key);
-    assert(iter != hashmap_end(h));
+    h = hashmap_new_with(sizeof(struct bucket), &options);
+    assert(hashmap_empty(h));
+    assert(hashmap_bucket_count(h) == 16);
+    assert(hashmap_begin(h) == hashmap_end(h));
+    assert(hashmap_iter_inc(hashmap_end(h)) == hashmap_end(h));
 
-    pair = hashmap_iter_deref(iter);
-    assert(!strcmp(key, pair.key));
+    pair = hashmap_iter_deref(hashmap_end(h));
+    assert(NULL == pair.key);
+    assert(NULL == pair.userdata);
 
-    assert(bucket == hashmap_bucket(h, key));
-    assert(value == ((struct bucket *)pair.userdata)->value);
+    d = fabsf(0.8f - hashmap_max_load_factor(h));
+    assert(d <= FLT_MIN);
+    hashmap_max_load_factor_set(h, 1.f);
+    d = fabsf(0.875f - hashmap_max_load_factor(h));
+    assert(d <= FLT_MIN);
+    hashmap_max_load_factor_set(h, 0.8f);
+
+    hashmap_reserve(h, 50);
+    assert(hashmap_bucket_count(h) == 64);
+
+    // NOP
+    hashmap_rehash(h, 50);
+    assert(hashmap_bucket_count(h) == 64);
+
+    insert(h, "bacteria", 10);
+    ret = hashmap_insert(h, "bacteria");
+    assert(ret.ok == false);
+    assert(((struct bucket *)ret.pair.userdata)->value == 10);
+    insert(h, "adept", 2);
+    insert(h, "choir", 4);
+    assert(hashmap_size(h) == 3);
+
+    // Elements are packed in the order of insertion until one is erased.
+    iter = hashmap_begin(h);
+    assert(!strcmp(hashmap_iter_deref(iter).key, "bacteria"));
+    iter = hashmap_iter_inc(iter);
+    assert(!strcmp(hashmap_iter_deref(iter).key, "adept"));
+    iter = hashmap_iter_inc(iter);
+    assert(!strcmp(hashmap_iter_deref(iter).key, "choir"));
+    assert(hashmap_iter_inc(iter) == hashmap_end(h));
+
+    check_element(h, hashmap_bucket(h, "adept"), "adept", 2);
+    assert(1 == hashmap_bucket_size(h, hashmap_bucket(h, "choir")));
+    assert(0 == hashmap_bucket_size(h, hashmap_bucket_count(h)));
+    assert(hashmap_find(h, "alumnal") == hashmap_end(h));
+    assert(hashmap_bucket(h, "alumnal") < hashmap_bucket_count(h));
+
+    d = fabsf(3 / 64.f - hashmap_load_factor(h));
+    assert(d <= FLT_MIN);
+
+    // Erasing moves the last element into the hole, so the iterator then refers to it.
+    iter = hashmap_find(h, "bacteria");
+    hashmap_erase(h, iter);
+    assert(!strcmp(hashmap_iter_deref(iter).key, "choir"));
+    assert(hashmap_find(h, "choir") == iter);
+    hashmap_erase(h, hashmap_end(h));
+    assert(hashmap_size(h) == 2);
+    assert(hashmap_find(h, "bacteria") == hashmap_end(h));
+    check_element(h, hashmap_bucket(h, "choir"), "choir", 4);
+
+    ret = hashmap_insert_take(h, strdup("taken"));
+    assert(ret.ok);
+    assert(hashmap_iter_inc(hashmap_find(h, "taken")) == hashmap_end(h));
+    assert(!hashmap_insert_take(h, strdup("taken")).ok);
+
+    assert(hashmap_extract(h, "choir", &out));
+    assert(out.value == 4);
+    assert(!hashmap_erase_key(h, "choir"));
+    assert(hashmap_size(h) == 2);
+
+    hashmap_clear(h);
+    assert(hashmap_empty(h));
+    assert(hashmap_begin(h) == hashmap_end(h));
+
+    // Grow from the minimum size, then churn, so that the last element keeps moving into holes.
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        insert(h, key, i);
+    }
+    assert(hashmap_size(h) == 2000);
+    assert(hashmap_bucket_count(h) == 4096);
+
+    for (i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        check_element(h, hashmap_bucket(h, key), key, i);
+    }
+
+    for (i = 1000; i < 20000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        if (i >= 2000) {
+            insert(h, key, i);
+        }
+        snprintf(key, sizeof(key), "k%d", i - 1000);
+        hashmap_erase(h, hashmap_find(h, key));
+    }
+    assert(hashmap_size(h) == 1000);
+    assert(hashmap_bucket_count(h) == 4096);
+
+    // A lower maximum load factor keeps the index; a higher one than ever before needs more entries.
+    hashmap_max_load_factor_set(h, 0.25f);
+    assert(hashmap_bucket_count(h) == 4096);
+    hashmap_max_load_factor_set(h, 0.875f);
+    assert(hashmap_bucket_count(h) == 4096);
+
+    count = 0;
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        pair = hashmap_iter_deref(iter);
+        assert(hashmap_find(h, pair.key) == iter);
+        assert(((struct bucket *)pair.userdata)->value >= 19000);
+        count++;
+    }
+    assert(count == 1000);
+
+    // The sweep looks at a moved element in the place of each erased one.
+    assert(hashmap_erase_if(h, not_multiple_of, args) == 500);
+    assert(args[1] == 1000);
+    for (iter = hashmap_begin(h); iter != hashmap_end(h); iter = hashmap_iter_inc(iter)) {
+        pair = hashmap_iter_deref(iter);
+        check_element(h, hashmap_bucket(h, pair.key), pair.key, ((struct bucket *)pair.userdata)->value);
+        assert(((struct bucket *)pair.userdata)->value % 2 == 0);
+    }
+
+    hashmap_min_load_factor_set(h, 0.2f);
+    assert(hashmap_bucket_count(h) == 2048);
+    hashmap_shrink_to_fit(h);
+    assert(hashmap_bucket_count(h) == 1024);
+    assert(hashmap_size(h) == 500);
+
+    hashmap_delete(h);
+
+
+    // Equal hashes form one Robin Hood run, which closes up behind an erased element.
+    h = hashmap_new_with(sizeof(struct bucket), &flooded);
+    for (i = 0; i < 20; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    hashmap_stats(h, &stats);
+    assert(stats.chain_lengths[0] == 1);
+    assert(stats.chain_lengths[14] == 1);
+    assert(stats.chain_lengths[HASHMAP_STATS_CHAIN_LENGTHS - 1] == 5);
+    assert(stats.max_probe_length == 20);
+    assert(stats.allocated_bytes > 20 * sizeof(struct bucket));
+
+    assert(hashmap_erase_key(h, "key5"));
+    assert(hashmap_erase_key(h, "key0"));
+    assert(hashmap_size(h) == 18);
+    for (i = 1; i < 20; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        if (i != 5) {
+            check_element(h, hashmap_bucket(h, key), key, i);
+        }
+    }
+    hashmap_stats(h, &stats);
+    assert(histogram_buckets(&stats) == 18);
+    assert(stats.chain_lengths[HASHMAP_STATS_CHAIN_LENGTHS - 1] == 3);
+
+    hashmap_delete(h);
+}
+
+struct point {
+    int x;
+    int y;
+};
+
+static uint64_t point_hash(struct point p)
+{
+    return (uint64_t)(unsigned)p.x << 32 | (unsigned)p.y;
+}
+
+static bool point_equal(struct point a, struct point b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+/// Every key has the same home slot.
+#define COLLIDE(key) ((void)(key), (uint64_t)0)
+
+HASHMAP_TYPED(u32, uint32_t, struct bucket, HASHMAP_TYPED_HASH_INT, HASHMAP_TYPED_EQUAL_INT)
+HASHMAP_TYPED(point, struct point, int, point_hash, point_equal)
+HASHMAP_TYPED(collide, int, int, COLLIDE, HASHMAP_TYPED_EQUAL_INT)
+
+static void test_filter(void)
+{
+    struct hashmap_options options[] = {
+        { .stats = true, .filter = true },
+        { .stats = true, .filter = true, .incremental_rehash = true, .slab = true },
+        { .stats = true, .filter = true, .sizing = HASHMAP_SIZING_POW2 },
+        { .stats = true, .filter = true, .layout = HASHMAP_LAYOUT_SWISS },
+    };
+    struct hashmap_options plain = { .stats = true };
+    struct hashmap_stats stats;
+    struct hashmap_stats before;
+    struct hashmap *h;
+    char key[16];
+    size_t o;
+    int i;
+
+    for (o = 0; o < sizeof(options) / sizeof(*options); ++o) {
+        h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+        if (o == 2) {
+            hashmap_min_load_factor_set(h, 0.2f);
+        }
+
+        // An empty filter rejects every key.
+        assert(hashmap_find(h, "missing") == hashmap_end(h));
+        hashmap_stats(h, &stats);
+        assert(stats.filtered == (o < 3));
+        assert(stats.misses == 1);
+
+        // Growing past the size the filter was built for rebuilds it; no element may be rejected.
+        for (i = 0; i < 5000; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            insert(h, key, i);
+        }
+        for (i = 0; i < 5000; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            check_element(h, hashmap_bucket(h, key), key, i);
+        }
+
+        // Nearly all absent keys stop at the filter, and each still counts as a miss.
+        hashmap_stats(h, &before);
+        for (i = 0; i < 5000; ++i) {
+            snprintf(key, sizeof(key), "absent%d", i);
+            assert(hashmap_find(h, key) == hashmap_end(h));
+        }
+        hashmap_stats(h, &stats);
+        assert(stats.misses - before.misses == 5000);
+        if (o < 3) {
+            assert(stats.filtered - before.filtered > 4900);
+            assert(stats.probes - before.probes < 100);
+
+        } else {
+            assert(stats.filtered == 0);
+        }
+
+        // Erasing most elements makes the filter stale; the rebuild must keep every remaining element.
+        for (i = 0; i < 4900; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            assert(hashmap_erase_n(h, key, strlen(key)));
+        }
+        for (i = 0; i < 5000; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            assert((hashmap_find(h, key) != hashmap_end(h)) == (i >= 4900));
+        }
+
+        hashmap_rehash(h, 4096);
+        for (i = 4900; i < 5000; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            check_element(h, hashmap_bucket(h, key), key, i);
+        }
+
+        hashmap_clear(h);
+        snprintf(key, sizeof(key), "key%d", 4999);
+        assert(hashmap_find(h, key) == hashmap_end(h));
+        insert(h, key, 1);
+        check_element(h, hashmap_bucket(h, key), key, 1);
+
+        hashmap_delete(h);
+    }
+
+    // The filter adds its bytes to the map, and goes with the chains when the map is frozen.
+    h = hashmap_new_with(sizeof(struct bucket), &plain);
+    hashmap_stats(h, &before);
+    hashmap_delete(h);
+
+    h = hashmap_new_with(sizeof(struct bucket), &options[0]);
+    hashmap_stats(h, &stats);
+    assert(stats.allocated_bytes == before.allocated_bytes + 64);
+
+    insert(h, "frozen", 7);
+    assert(hashmap_freeze(h));
+    check_element(h, hashmap_bucket(h, "frozen"), "frozen", 7);
+    assert(hashmap_find(h, "missing") == hashmap_end(h));
+    hashmap_delete(h);
+}
+
+/// Hash of a key written as a number, so that a test can choose which keys share a bucket.
+static size_t numeric(void *context, const void *key, size_t len)
+{
+    (void)context;
+    (void)len;
+    return (size_t)strtoull((const char *)key, NULL, 0);
+}
+
+static void test_tags(void)
+{
+    struct hashmap_hasher hasher = { numeric, NULL };
+    struct hashmap_options options = { .stats = true, .hasher = &hasher, .sizing = HASHMAP_SIZING_POW2 };
+    struct hashmap *h = hashmap_new_with(sizeof(struct bucket), &options);
+    struct hashmap_stats before;
+    struct hashmap_stats stats;
+    struct hashmap_iter *iter;
+    char key[32];
+    int i;
+
+    // Keys that differ only in the high bits share bucket 0, but not their tags.
+    hashmap_rehash(h, 16);
+    for (i = 1; i <= 4; ++i) {
+        snprintf(key, sizeof(key), "%#llx", (unsigned long long)i << 40);
+        insert(h, key, i);
+    }
+    assert(hashmap_bucket_size(h, 0) == 4);
+
+    // A miss whose tag no element of the run carries reads no node.
+    hashmap_stats(h, &before);
+    assert(hashmap_find(h, "0x50000000000") == hashmap_end(h));
+    hashmap_stats(h, &stats);
+    assert(stats.misses - before.misses == 1);
+    assert(stats.probes == before.probes);
+
+    // Erasing drops the tag of the element, and the run keeps its insertion order.
+    assert(hashmap_erase_n(h, "0x20000000000", 13));
+    hashmap_stats(h, &before);
+    assert(hashmap_find(h, "0x20000000000") == hashmap_end(h));
+    hashmap_stats(h, &stats);
+    assert(stats.probes == before.probes);
+
+    insert(h, "0x20000000000", 2);
+    for (i = 1, iter = hashmap_begin(h); iter != hashmap_end(h); ++i, iter = hashmap_iter_inc(iter)) {
+        assert(((struct bucket *)hashmap_iter_deref(iter).userdata)->value == (i == 4 ? 2 : i + (i > 1)));
+    }
+
+    hashmap_delete(h);
+}
+
+struct evicted {
+    size_t count;
+    int sum;
+    char last[16];
+};
+
+static void record_eviction(void *context, const char *key, size_t len, void *userdata)
+{
+    struct evicted *e = (struct evicted *)context;
+
+    assert(strlen(key) == len);
+    e->count++;
+    e->sum += ((struct bucket *)userdata)->value;
+    snprintf(e->last, sizeof(e->last), "%s", key);
+}
+
+static void test_cache(void)
+{
+    static char storage[200][16];
+    const char *keys[200];
+    struct evicted e = { 0, 0, "" };
+    struct hashmap_evictor evictor = { record_eviction, &e };
+    struct hashmap_options options[] = {
+        { .stats = true, .capacity = 3, .evictor = &evictor, .seed = 1 },
+        { .stats = true, .capacity = 100, .evictor = &evictor, .seed = 1, .slab = true, .inline_key_size = 8 },
+        { .stats = true, .capacity = 100, .evictor = &evictor, .seed = 1, .incremental_rehash = true, .filter = true },
+    };
+    struct hashmap_options silent = { .capacity = 50, .seed = 1 };
+    struct hashmap_insert_ret rets[100];
+    struct hashmap_options swiss = { .capacity = 3, .evictor = &evictor, .layout = HASHMAP_LAYOUT_SWISS };
+    struct hashmap_stats stats;
+    struct hashmap *h;
+    char key[16];
+    size_t o;
+    int i;
+
+    // A hit spares an element from the next sweep of the hand.
+    h = hashmap_new_with(sizeof(struct bucket), &options[0]);
+    insert(h, "a", 1);
+    insert(h, "b", 2);
+    insert(h, "c", 3);
+    assert(hashmap_find(h, "a") != hashmap_end(h));
+    assert(hashmap_find(h, "b") != hashmap_end(h));
+    insert(h, "d", 4);
+    assert(hashmap_size(h) == 3);
+    assert(e.count == 1 && e.sum == 3 && !strcmp(e.last, "c"));
+    assert(hashmap_find(h, "c") == hashmap_end(h));
+    check_element(h, hashmap_bucket(h, "d"), "d", 4);
+
+    // Inserting a key that exists is a hit, not an eviction.
+    assert(!hashmap_insert(h, "a").ok);
+    hashmap_stats(h, &stats);
+    assert(stats.evictions == 1);
+    assert(stats.hits == 4);
+
+    hashmap_delete(h);
+
+    // A batch as large as the capacity evicts none of its own elements, though its later keys find the
+    // earlier ones unreferenced; a repeated key in the batch returns the element it inserted.
+    h = hashmap_new_with(sizeof(struct bucket), &options[1]);
+    for (o = 0; o < 50; ++o) {
+        for (i = 0; i < 99; ++i) {
+            snprintf(storage[i], sizeof(storage[i]), "batch%zu-%d", o, i);
+            keys[i] = storage[i];
+        }
+        keys[99] = keys[0];
+
+        hashmap_insert_batch(h, keys, 100, rets);
+        for (i = 0; i < 100; ++i) {
+            assert(rets[i].ok == (i < 99));
+            assert(hashmap_iter_deref(hashmap_find(h, keys[i])).userdata == rets[i].pair.userdata);
+        }
+        assert(hashmap_size(h) == (o ? 100 : 99));
+    }
+    hashmap_delete(h);
+
+    // A batch larger than the capacity is evicted down to it once the batch ends.
+    h = hashmap_new_with(sizeof(struct bucket), &options[0]);
+    hashmap_insert_batch(h, keys, 5, rets);
+    assert(hashmap_size(h) == 3);
+    hashmap_delete(h);
+
+    // Under churn, keys hit between inserts stay, and the map never holds more than its capacity.
+    for (o = 1; o < sizeof(options) / sizeof(*options); ++o) {
+        memset(&e, 0, sizeof(e));
+        h = hashmap_new_with(sizeof(struct bucket), &options[o]);
+
+        for (i = 0; i < 10000; ++i) {
+            int hot;
+
+            snprintf(key, sizeof(key), "key%d", i);
+            insert(h, key, 1);
+            assert(hashmap_size(h) <= 100);
+
+            for (hot = 0; hot < 10 && hot <= i; ++hot) {
+                snprintf(key, sizeof(key), "key%d", hot);
+                assert(hashmap_find(h, key) != hashmap_end(h));
+            }
+
+            // Erase some elements, which sometimes sit under the hand.
+            if (i % 7 == 0 && i > 10) {
+                snprintf(key, sizeof(key), "key%d", i - 3);
+                hashmap_erase_n(h, key, strlen(key));
+            }
+        }
+
+        hashmap_stats(h, &stats);
+        assert(hashmap_size(h) == 100);
+        assert(stats.evictions == e.count);
+        assert((int)e.count == e.sum);
+        assert(e.count + hashmap_size(h) < 10000);
+        assert(e.count + hashmap_size(h) > 10000 - 10000 / 7);
+
+        hashmap_clear(h);
+        insert(h, "again", 1);
+        check_element(h, hashmap_bucket(h, "again"), "again", 1);
+        hashmap_delete(h);
+    }
+
+    // A bulk build evicts down to the capacity once all keys are linked; no evictor is needed.
+    for (i = 0; i < 200; ++i) {
+        snprintf(storage[i], sizeof(storage[i]), "k%d", i);
+        keys[i] = storage[i];
+    }
+
+    h = hashmap_new_with(sizeof(struct bucket), &silent);
+    insert(h, "first", 0);
+    assert(hashmap_find(h, "first") != hashmap_end(h));
+    assert(hashmap_build(h, keys, 200, 2) == 200);
+    assert(hashmap_size(h) == 50);
+    assert(hashmap_find(h, "first") != hashmap_end(h));
+    hashmap_delete(h);
+
+    // Other layouts are not bounded.
+    memset(&e, 0, sizeof(e));
+    h = hashmap_new_with(sizeof(struct bucket), &swiss);
+    for (i = 0; i < 10; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        insert(h, key, i);
+    }
+    assert(hashmap_size(h) == 10);
+    assert(e.count == 0);
+    hashmap_delete(h);
+}
+
+static void test_typed(void)
+{
+    struct hashmap_u32 *h = hashmap_u32_new();
+    struct hashmap_point *p = hashmap_point_new();
+    struct hashmap_collide *c = hashmap_collide_new();
+    struct hashmap_u32_insert_ret ret;
+    struct point at = { 0, 0 };
+    static bool present[4096];
+    uint64_t state = 1;
+    size_t count;
+    size_t pos;
+    uint32_t k;
+    int i;
+
+    assert(hashmap_u32_size(h) == 0);
+    assert(hashmap_u32_begin(h) == hashmap_u32_end(h));
+    assert(hashmap_u32_find(h, 7) == hashmap_u32_end(h));
+    assert(!hashmap_u32_erase(h, 7));
+
+    ret = hashmap_u32_insert(h, 7);
+    assert(ret.ok);
+    ret.value->value = 70;
+    ret = hashmap_u32_insert(h, 7);
+    assert(!ret.ok);
+    assert(ret.value->value == 70);
+    assert(*hashmap_u32_key(h, ret.pos) == 7);
+    assert(hashmap_u32_value(h, hashmap_u32_find(h, 7))->value == 70);
+    assert(hashmap_u32_erase(h, 7));
+    assert(hashmap_u32_size(h) == 0);
+
+    // Random inserts and erases against a reference set, growing past many resizes.
+    for (i = 0; i < 100000; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        k = (uint32_t)(state >> 33) % 4096;
+
+        if (state >> 63) {
+            ret = hashmap_u32_insert(h, k);
+            assert(ret.ok == !present[k]);
+            ret.value->value = (int)k;
+            present[k] = true;
+
+        } else {
+            assert(hashmap_u32_erase(h, k) == present[k]);
+            present[k] = false;
+        }
+    }
+    for (k = 0, count = 0; k < 4096; ++k) {
+        pos = hashmap_u32_find(h, k);
+        assert((pos != hashmap_u32_end(h)) == present[k]);
+        assert(!present[k] || hashmap_u32_value(h, pos)->value == (int)k);
+        count += present[k];
+    }
+    assert(hashmap_u32_size(h) == count);
+
+    for (pos = hashmap_u32_begin(h); pos != hashmap_u32_end(h); pos = hashmap_u32_inc(h, pos)) {
+        assert(present[*hashmap_u32_key(h, pos)]);
+        count--;
+    }
+    assert(count == 0);
+
+    hashmap_u32_clear(h);
+    assert(hashmap_u32_size(h) == 0);
+    assert(hashmap_u32_begin(h) == hashmap_u32_end(h));
+
+    // Reserving sizes the table once.
+    hashmap_u32_delete(h);
+    h = hashmap_u32_new();
+    hashmap_u32_reserve(h, 1000);
+    assert(hashmap_u32_end(h) == 2048);
+    hashmap_u32_reserve(h, 10);
+    assert(hashmap_u32_end(h) == 2048);
+
+    hashmap_u32_delete(h);
+    hashmap_u32_delete(NULL);
+
+    // Struct keys, with a caller hash and equality.
+    for (at.x = 0; at.x < 30; ++at.x) {
+        for (at.y = 0; at.y < 30; ++at.y) {
+            *hashmap_point_insert(p, at).value = at.x * at.y;
+        }
+    }
+    assert(hashmap_point_size(p) == 900);
+    at.x = 12;
+    at.y = 25;
+    assert(*hashmap_point_value(p, hashmap_point_find(p, at)) == 300);
+    at.y = 30;
+    assert(hashmap_point_find(p, at) == hashmap_point_end(p));
+    hashmap_point_delete(p);
+
+    // One long probe run: erasing from it pulls the rest back, so every other key stays reachable.
+    for (i = 0; i < 50; ++i) {
+        *hashmap_collide_insert(c, i).value = -i;
+    }
+    for (i = 0; i < 50; i += 3) {
+        assert(hashmap_collide_erase(c, i));
+    }
+    for (i = 0; i < 50; ++i) {
+        pos = hashmap_collide_find(c, i);
+        assert((pos == hashmap_collide_end(c)) == (i % 3 == 0));
+        assert(i % 3 == 0 || *hashmap_collide_value(c, pos) == -i);
+    }
+    assert(hashmap_collide_size(c) == 33);
+    hashmap_collide_delete(c);
+}
+
+static void test_u64(void)
+{
+    struct hashmap_u64 *h = hashmap_u64_new(sizeof(struct bucket));
+    struct hashmap_u64_insert_ret ret;
+    struct hashmap_u64_pair pair;
+    static bool present[4096];
+    uint64_t state = 7;
+    size_t count;
+    size_t pos;
+    uint64_t k;
+    int i;
+
+    assert(hashmap_u64_size(h) == 0);
+    assert(hashmap_u64_size(NULL) == 0);
+    assert(hashmap_u64_begin(h) == hashmap_u64_end(h));
+    assert(hashmap_u64_inc(h, hashmap_u64_end(h)) == hashmap_u64_end(h));
+    assert(hashmap_u64_find(h, 7) == NULL);
+    assert(!hashmap_u64_erase(h, 7));
+
+    ret = hashmap_u64_insert(h, UINT64_MAX);
+    assert(ret.ok);
+    assert(ret.pair.key == UINT64_MAX);
+    ((struct bucket *)ret.pair.userdata)->value = 70;
+    ret = hashmap_u64_insert(h, UINT64_MAX);
+    assert(!ret.ok);
+    assert(((struct bucket *)hashmap_u64_find(h, UINT64_MAX))->value == 70);
+    assert(hashmap_u64_deref(h, hashmap_u64_begin(h)).key == UINT64_MAX);
+    assert(hashmap_u64_inc(h, hashmap_u64_begin(h)) == hashmap_u64_end(h));
+    assert(hashmap_u64_erase(h, UINT64_MAX));
+
+    // Random inserts and erases against a reference set; keys differ only in their high bits.
+    for (i = 0; i < 100000; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        k = (state >> 33) % 4096;
+
+        if (state >> 63) {
+            ret = hashmap_u64_insert(h, k << 52);
+            assert(ret.ok == !present[k]);
+            ((struct bucket *)ret.pair.userdata)->value = (int)k;
+            present[k] = true;
+
+        } else {
+            assert(hashmap_u64_erase(h, k << 52) == present[k]);
+            present[k] = false;
+        }
+    }
+    for (k = 0, count = 0; k < 4096; ++k) {
+        struct bucket *b = (struct bucket *)hashmap_u64_find(h, k << 52);
+
+        assert((b != NULL) == present[k]);
+        assert(!b || b->value == (int)k);
+        count += present[k];
+    }
+    assert(hashmap_u64_size(h) == count);
+
+    for (pos = hashmap_u64_begin(h); pos != hashmap_u64_end(h); pos = hashmap_u64_inc(h, pos)) {
+        pair = hashmap_u64_deref(h, pos);
+        assert(present[pair.key >> 52]);
+        assert(((struct bucket *)pair.userdata)->value == (int)(pair.key >> 52));
+        count--;
+    }
+    assert(count == 0);
+
+    hashmap_u64_clear(h);
+    assert(hashmap_u64_size(h) == 0);
+    assert(hashmap_u64_begin(h) == hashmap_u64_end(h));
+    hashmap_u64_delete(h);
+
+    // Reserving sizes the table once; sparse slots are skipped a word at a time.
+    h = hashmap_u64_new(0);
+    hashmap_u64_reserve(h, 1000);
+    assert(hashmap_u64_end(h) == 2048);
+    hashmap_u64_reserve(h, 10);
+    assert(hashmap_u64_end(h) == 2048);
+    hashmap_u64_insert(h, 1);
+    hashmap_u64_insert(h, 2);
+    for (pos = hashmap_u64_begin(h), count = 0; pos != hashmap_u64_end(h); pos = hashmap_u64_inc(h, pos)) {
+        count++;
+    }
+    assert(count == 2);
+    hashmap_u64_delete(h);
+    hashmap_u64_delete(NULL);
 }
 
 int main(void)
@@ -45,6 +2911,8 @@ int main(void)
     struct hashmap_insert_ret ret;
     struct bucket *b;
     struct hashmap_pair pair;
+    struct hashmap_hasher hasher = { djb2, NULL };
+    struct hashmap_options options = { .hasher = &hasher };
     float d;
 
 
@@ -53,7 +2921,7 @@ int main(void)
     assert(hashmap_size(NULL) == 0);
 
 
-    h = hashmap_new(sizeof(struct bucket));
+    h = hashmap_new_with(sizeof(struct bucket), &options);
     assert(hashmap_empty(h));
     assert(hashmap_size(h) == 0);
     assert(hashmap_bucket_count(h) == 5);
@@ -144,16 +3012,17 @@ int main(void)
     assert(NULL == pair.key);
     assert(NULL == pair.userdata);
 
+    /* Buckets run in reverse order of creation; impermeable was erased and inserted again last. */
     iter = hashmap_begin(h);
     assert(iter != hashmap_end(h));
     pair = hashmap_iter_deref(iter);
-    assert(!strcmp("adept", pair.key));
+    assert(!strcmp("impermeable", pair.key));
 
     iter = hashmap_iter_inc(iter);
     assert(iter != hashmap_begin(h));
     assert(iter != hashmap_end(h));
     pair = hashmap_iter_deref(iter);
-    assert(!strcmp("adjuster", pair.key));
+    assert(!strcmp("geodesic", pair.key));
 
     iter = hashmap_find(h, "germless");
     assert(iter != hashmap_begin(h));
@@ -163,8 +3032,9 @@ int main(void)
     assert(iter != hashmap_begin(h));
     assert(iter != hashmap_end(h));
     pair = hashmap_iter_deref(iter);
-    assert(!strcmp("impermeable", pair.key));
+    assert(!strcmp("choir", pair.key));
 
+    iter = hashmap_find(h, "bandage");
     iter = hashmap_iter_inc(iter);
     assert(iter != hashmap_begin(h));
     assert(iter == hashmap_end(h));
@@ -244,7 +3114,7 @@ int main(void)
 
 
     // https://cplusplus.com/reference/unordered_map/unordered_map/max_load_factor/
-    h = hashmap_new(sizeof(struct bucket));
+    h = hashmap_new_with(sizeof(struct bucket), &options);
 
     ret = hashmap_insert(h, "Au");
     ((struct bucket *)ret.pair.userdata)->value = 10;
@@ -277,4 +3147,33 @@ int main(void)
     check_element(h, 6, "Pt", 40);
 
     hashmap_delete(h);
+
+
+    test_rehash();
+    test_incremental_rehash();
+    test_allocator();
+    test_keys();
+    test_binary_keys();
+    test_hash();
+    test_pow2();
+    test_batch();
+    test_with_hash();
+    test_concurrent();
+    test_rcu();
+    test_build();
+    test_snapshot();
+    test_freeze();
+    test_shrink();
+    test_stats();
+    test_reseed();
+    test_take();
+    test_erase_key();
+    test_partition();
+    test_swiss();
+    test_dense();
+    test_filter();
+    test_tags();
+    test_cache();
+    test_typed();
+    test_u64();
 }